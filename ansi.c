@@ -3,7 +3,7 @@
    Program:    ansi
    File:       ansi.c
    
-   Version:    V1.7
+   Version:    V4.1
    Date:       16.12.91
    Function:   Convert C source to and from ANSI form.
    
@@ -49,9 +49,128 @@
    Usage:
    ======
 
-   ansi [-k -p] <in.c> <out.c>
+   ansi [-k -p -q] [-j n] [-c dir [-m MB]] <in.c> <out.c>
+   ansi [-k -p] < in.c > out.c
+   ansi [-k -p -q] [-j n] [-c dir [-m MB]] -b <in.c> <out.c> [...]
+   ansi [-k -p -q] [-j n] [-c dir [-m MB]] -0 < list
+   ansi [-k -q] [-j n] -i <file.c> [...]
+   ansi [-k -q] [-j n] -i -0 < list
+   ansi [-k] [-j n] --check <file.c> [...]
+   ansi [-k] [-j n] --check -0 < list
+   ansi [-k -q] [-j n] -e <file.c> [...] > edits
+   ansi [-k -q] [-j n] -e -0 < list > edits
+   ansi [-k -q] [-j n] -u <file.c> [...] > patch
+   ansi [-k -q] [-j n] -u -0 < list > patch
+   ansi [-q] --apply [edits ...]
+   ansi -p [-q -g -n -x] [-j n] [-s db] -h <protos.h> <in.c> [...]
+   ansi -p [-q -g -n -x] [-j n] [-s db] -h <protos.h> -0 < list
+   ansi [-q -g -n -x] [-j n] [-s db] -h <protos.h> [-b] <in.c> <out.c> 
+        [...]
+   ansi [-q -g -n -x] [-j n] [-s db] -h <protos.h> -i <file.c> [...]
+   ansi -s db -f <name>
+   ansi [-q] [-j n] -d <socket>
+   ansi [-k -p -q] [-j n] [--stats] --watch <srcdir> <outdir>
          -k generates K&R form code from ANSI
          -p generates a set of prototypes
+         -q quiet mode
+         -b batch mode; converts each pair of files in turn
+         -0 batch mode; pairs of files are read from standard input
+            with each name terminated by a NUL (as from find -print0)
+         -i convert each file in place (with -0, single names are read).
+            A file is only written if its conversion is different, so
+            one which needs no change keeps its modification time and
+            isn't rebuilt by make. It's written to a temporary file 
+            beside it and renamed over it. -p may not be used with it,
+            since a file would be replaced by its prototypes
+         -e write an edit script to stdout rather than converting files.
+            Only the definitions which change are converted and each is
+            a line of JSON giving the file, the offsets of the first 
+            byte replaced and of the byte after the last, the XXH64 of
+            the bytes replaced, and what replaces them:
+            {"file":"x.c","start":120,"end":151,
+             "hash":"9a2c...","replacement":"..."}
+            Offsets are to the files as they were, so apply the script
+            before changing them
+         -u write the changes -e would make as a unified diff to stdout,
+            with DIFFCONTEXT lines of context, for patch -p1 or git 
+            apply. Parts of files which don't change aren't written, nor
+            files which don't change at all. A file given by an absolute
+            path, or one outside the current directory, is named as it
+            is rather than as a/ and b/, so needs patch -p0
+         -j number of threads (default is the number of processors). In
+            batch mode this is the number of files converted at once.
+            Files of 8MB or more are also split between them
+         -c keep each conversion in a cache in this directory. When an
+            input is found there, the output is copied from the cache 
+            (or left alone if it's already the same) rather than being
+            converted again
+         -m once the cache holds more than this many MB, the least
+            recently used entries are removed (default 1024)
+         -s (with -p) keep the functions and prototypes of each file in
+            this signature store. A file which hasn't changed since is
+            not converted again; its prototypes come from the store.
+            Without -p, the prototypes made while converting each file 
+            are kept, but every file is converted
+         -h (with -p) write the prototypes of all the files, in order,
+            to this header. Only input files are given (or listed with
+            -0). The header is left alone if it's already the same. A
+            prototype found more than once is only written once and 
+            static functions go in a section at the end. Without -p 
+            (or -k), the files are converted to ANSI as usual, in pairs
+            or in place with -i, and the header is made from the same
+            reading of each file
+         -g (with -h) group the prototypes under the name of each file
+         -n (with -h) sort the prototypes by function name
+         -x (with -h) leave out static functions
+         -f list the file, offset and prototype of each definition of a 
+            function in the signature store
+         -d serve requests on this Unix domain socket until asked to 
+            quit, with -j threads answering them. A request converts a
+            buffer sent with it or a file, or asks for the numbers of 
+            requests and bytes converted and a histogram of the time 
+            requests took. See ServerRun() for the protocol
+         --stats (with any of the above but -f) say, for each file 
+            converted and in total, how many lines, possible definitions
+            and functions were found and converted, and how long reading 
+            and scanning, converting and writing took
+         --watch (Linux only) keep a copy of a source tree converted. 
+            Each .c file is converted to the same place in the output
+            directory if the output is missing or older, and again 
+            whenever it's saved. Saves close together are converted 
+            together once there's a pause of WATCHQUIET ms. Outputs are
+            written to a temporary file and renamed, so they're never
+            seen half written. Deleting a file leaves its output alone
+         --check only look for function definitions which would be 
+            converted, writing nothing. For each file which has one, the
+            file:line and first line of the first are listed and the 
+            rest of the file isn't read. The exit status is 1 if any 
+            file has one (or can't be read), 0 if none do
+         --apply make the edits in edit scripts from -e, or in one read
+            from stdin. Each file is written once, to a temporary file
+            which is renamed over it, and is left alone if an edit 
+            doesn't fit it or the bytes it replaces aren't the ones it
+            was made from. A file named in different ways (such as x.c 
+            and ./x.c) is still only written once
+   An output file of - means standard output. Output for these appears
+   in the order the files were given, and isn't cached. An input file
+   of - means standard input.
+
+   A usage error (such as an unknown switch, or switches which can't be
+   used together) exits with status 1.
+
+   Given no files, ansi is a filter from standard input to standard 
+   output, and is quiet. Reading from a pipe, memory use depends only on
+   the largest function definition, not the size of the input, and the
+   output is sent as each top-level construct (function, declaration,
+   etc.) is finished, unless more input is already waiting.
+
+   On Unix systems link with -lpthread for batch mode and large files to
+   run in parallel.
+   Define NOTHREADS to build without threads.
+   Define NOSTATS to build without the counting and timing for --stats.
+
+   Define ANSI_LIBRARY to build the converter as a library without the
+   command line program. See ansi.h for the interface.
 
 ****************************************************************************
 
@@ -97,12 +216,259 @@
    A little tidying up to match own commenting standards, etc. Includes
    stdlib.h
    
+   V1.8  16.10.26
+   Where the input is a regular file it is now mapped into memory with
+   mmap() and the lines are classified and converted in place, referenced
+   by pointer and length, rather than being copied line by line with
+   fgets(). Pipes (and systems without mmap()) still use the original
+   streaming path. Introduced INFILE, DEFLINES, OpenInput(), GetLine(),
+   CloseInput(), WriteLine() and CodeHasChar().
+   
+   V1.9  16.10.26
+   Added batch mode (-b and -0) to convert many pairs of files in one
+   run, spread over a pool of worker threads (-j) which steal work from
+   each other. The state which was held in statics in isInteresting() and
+   process_file() is now in an ANSICTX so that files can be converted at
+   the same time. Messages are now written to the context's message file.
+   
+   V2.0  16.10.26
+   The converter can now be built as a library (define ANSI_LIBRARY) with
+   the interface in ansi.h. AnsiCreate() makes a context, which can then
+   convert a buffer or a stream, and AnsiDestroy() frees it. Errors are
+   returned as codes rather than calling exit(), and messages are held in
+   the context for AnsiMessages(). main() is now a thin wrapper over this
+   interface.
+   
+   V2.1  16.10.26
+   Removed the MAXBUFF and MAXLINES limits. Lines read from a stream now
+   go into an arena which grows as needed and is reset, not freed, after
+   each definition; funcdef holds offsets into the arena (or into the
+   mapped file) in a table which also grows. Lines of any length and
+   definitions of any size can be converted without splitting lines or
+   running out of space, and memory use stays flat however many functions
+   there are.
+   
+   V2.2  16.10.26
+   Each line is now scanned once, by LexLine(), which replaces
+   isInteresting(), KillComments() and CodeHasChar(). As well as keeping
+   the brace count, it notes the first (, ; and { in code on the line and
+   the character before the first ;, so process_file() and isFunc() no
+   longer search the lines again. Lines which might start a definition,
+   and the lines of a definition, are also broken into tokens which
+   Ansify() and DeAnsify() use to drop comments and find the parameters.
+   Strings and character constants now understand \ escapes and end at 
+   the end of the line unless it is continued, comments no longer nest,
+   // comments are only comments outside strings and other comments, and
+   a # may be preceded by spaces. ( ; and { in strings or comments are
+   ignored when assembling a definition.
+   
+   V2.3  16.10.26
+   LexLine() now skips comments, strings and the bodies of functions a
+   block at a time, looking only for the bytes which can change its 
+   state. The scanner is chosen when the context is created: AVX2 or SSE2
+   where the processor has them (x86 with gcc or clang), otherwise a 
+   table driven scalar loop. Set ANSI_SCAN to scalar, sse2 or avx2 to 
+   choose one, or use AnsiSetScanner(). Added ansibench.c to measure them.
+   
+   V2.4  16.10.26
+   All output now goes through an OUTBUF held in the context rather than
+   fprintf() and putc() a character at a time. Lines and spans are 
+   appended with memcpy(), padding with memset(), and the buffer is
+   written a block at a time with write() (or writev() together with a 
+   large span) where there is a file descriptor. AnsiConvertBuffer() 
+   builds its output in the buffer itself rather than in an 
+   open_memstream() or temporary file.
+   
+   V2.5  16.10.26
+   Lines which are copied through unchanged (function bodies, comments,
+   # lines, externs, prototypes and definitions already in the form 
+   wanted) are no longer written a line at a time. PassLine() adds them
+   to a span of the mapped input held in the OUTBUF, which is written in
+   one go before anything else. On Linux, large spans are copied from 
+   the input file with copy_file_range() or sendfile() without passing
+   through the program at all.
+   
+   V2.6  16.10.26
+   Large mapped files are split into pieces which are converted at the
+   same time on separate threads (-j, or AnsiSetThreads()). SplitFile()
+   pre-scans the file with LexLine() keeping just the brace count etc.,
+   and ends a piece after a line which closes the last open brace outside
+   any comment, string or # line. Each piece is converted by a worker with
+   a context of its own and the output and messages are joined in order,
+   so they are exactly as they would be from one thread.
+   
+   V2.7  16.10.26
+   Added a conversion cache (-c and -m) for runs over a tree in which
+   few files have changed. Entries are named by an XXH64 hash of the 
+   input, seeded with the mode and VERSION, and hold the messages and
+   output. A hit doesn't convert the file at all. Entries are written 
+   atomically, touched when used and evicted least recently used first 
+   at the end of a run, when a line of statistics is given. A single pair
+   of files is now run as a batch of one, so - means stdout there too.
+   
+   V2.8  16.10.26
+   Added a signature store (-s) so that -p over a tree only converts the
+   files which have changed. The library notes each function it converts
+   (AnsiFunctions() gives its name, where it was in the input and where
+   its output is) and the store keeps these and the prototypes for each
+   file, keyed by path and checked against an XXH64 hash of the file.
+   Files and functions are held in hash tables, so -f finds a function by
+   name at once. -h builds one header from the store for all the files.
+   The OUTBUF now counts the bytes output.
+   
+   V2.9  16.10.26
+   With no files, ansi is now a quiet filter from stdin to stdout, and 
+   an input of - is stdin. Reading from a pipe and writing to one, the
+   output is sent at the end of each top-level construct unless FIONREAD
+   says there's more input waiting, so the next program in a pipeline 
+   can start at once without a write() per line. Functions are only 
+   kept for AnsiFunctions() if AnsiKeepFunctions() is called, so memory 
+   use from a pipe is limited by the largest definition.
+   
+   V3.0  16.10.26
+   Added --stats and AnsiKeepStats()/AnsiStats(). Once asked for, a 
+   context counts the lines scanned, possible definitions, functions and
+   prototypes found, functions converted and searches for parameters in
+   an ANSISTATS, and times the whole conversion and the converting and 
+   writing within it; the rest is reading and scanning. Pieces of a 
+   split file count on their own threads and are added in. Every count
+   is behind a test of the context's stats pointer, which is never set 
+   if NOSTATS is defined, so the compiler drops them.
+   
+   V3.1  16.10.26
+   WriteANSI() no longer searches the K&R declarations three times for
+   each parameter with FindVarName(). ParseDecls() goes through them once
+   when a definition is converted, keeping the type, *'s and [] of each 
+   name FindVarName() could have found in a table hashed on the name, so
+   each parameter is looked up by FindDecl(). The output is the same.
+   FindVarName() works out the length of the name once.
+   
+   V3.2  16.10.26
+   DeAnsify() keeps each parameter it finds as a PARAM (the offsets of 
+   the type, name and anything after it, such as []) and WriteKR() 
+   writes from that, so the names are no longer copied into a list with
+   strcpy(), read back with GetVarName() (now gone) and searched for 
+   again with FindVarName(). A parameter whose name doesn't follow a 
+   space, * or , (such as f(x) with no type) no longer crashes, and a 
+   pointer to a function is named by what's in its (* ).
+   
+   V3.3  16.10.26
+   -h now writes a prototype found in more than one file only once, 
+   finding repeats by their XXH64 hashes, and puts static functions in a
+   section of their own at the end. Added -g to group the prototypes 
+   under the name of each file, -n to sort them by name and -x to leave
+   out static functions.
+   
+   V3.4  16.10.26
+   Added -d to run as a server on a Unix domain socket, so editors and
+   hooks can have buffers or files converted without starting ansi each
+   time. Connections are answered by a pool of threads, each keeping a
+   context for each mode. A stats request gives the requests, failures
+   and bytes converted and a histogram of how long requests took.
+   
+   V3.5  16.10.26
+   Added --watch to keep a mirror of a source tree converted. inotify 
+   watches the tree and a burst of saves is converted as one batch a 
+   few ms after it ends. A JOB may now be atomic, when RunJob() writes 
+   to a temporary file beside the output and renames it.
+   
+   V3.6  16.10.26
+   Added -i to convert files in place. Each is converted in memory and
+   compared with the original, and only if they differ is it written 
+   (atomically, by renaming a temporary file over it). Files which are
+   already in the form wanted aren't written at all.
+   
+   V3.7  16.10.26
+   Added --check to find files which still need converting, for use in
+   hooks and CI. It only finds and classifies definitions (with the new
+   isKRDef() and NeedsConverting(), which Ansify() and DeAnsify() now 
+   share) and stops at the first which would be converted. The library
+   gains AnsiCheckBuffer().
+   
+   V3.8  16.10.26
+   A file which needs no change is no longer converted. It's pre-scanned
+   as for --check and, if nothing would be converted, copied (with a 
+   reflink or copy_file_range() on Linux) or, with -i, left alone. A 
+   MakeKR definition with no parameters only counts as unchanged if 
+   DeAnsify() would write it exactly as it is.
+   
+   V3.9  16.10.26
+   Added -e to write an edit script rather than converted files, and 
+   --apply to make its edits. With AnsiEditsOnly() (new in the library)
+   a conversion writes only the definitions which change and notes each
+   as a function, so the script grows with the number of definitions 
+   converted, not the size of the files. ReadAll() is split out of 
+   ReadJobList() to read scripts too. Each record has a hash of the 
+   bytes it replaces, so a file which has changed since is refused.
+   
+   V4.0  16.10.26
+   Added -u to write a unified diff of the changes. GetLine() counts the
+   lines of the input, so each function noted (ANSIFUNC, now also in the
+   library) has the line it starts on. A large file split over threads 
+   moves each piece's lines on by the lines before it. The hunks are 
+   made from the edits, only looking at the lines around them.
+   
+   V4.1  16.10.26
+   -h and -s can be used when converting to ANSI, rather than running 
+   ansi -p over the same files as well. Ansify() writes each prototype
+   to the context at the same time as the definition (AnsiKeepPrototypes()
+   and AnsiPrototypes() in the library), so every file is only read and
+   parsed once, and SigJob() or InPlaceJob() put them in the store. 
+   They're the same as -p would make, so a later -p -s reuses them.
+   
 *************************************************************************/
 /* System includes
 */
+#ifdef __linux__
+#  define _GNU_SOURCE        /* copy_file_range()                       */
+#endif
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <time.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#  define POSIX_IO           /* mmap() etc. available                   */
+#  include <sys/types.h>
+#  include <sys/stat.h>
+#  include <sys/mman.h>
+#  include <sys/uio.h>
+#  include <unistd.h>
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <dirent.h>
+#  include <utime.h>
+#  include <stdint.h>
+#  include <sys/ioctl.h>
+#  include <sys/socket.h>
+#  include <sys/un.h>
+#  include <sys/time.h>
+#  include <poll.h>
+#  include <signal.h>
+#  ifdef __linux__
+#     define WATCH           /* inotify() available                     */
+#     include <sys/inotify.h>
+#  endif
+#  if defined(__linux__) && defined(__GLIBC__) && \
+      (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#     define ZERO_COPY       /* copy_file_range() and sendfile()        */
+#     include <sys/sendfile.h>
+#     ifndef FICLONE
+#        define FICLONE _IOW(0x94, 9, int) /* From linux/fs.h           */
+#     endif
+#  endif
+#  ifndef NOTHREADS
+#     define THREADS         /* POSIX threads available                 */
+#     include <pthread.h>
+#  endif
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define SIMD_X86           /* SSE2/AVX2 scanners, chosen at run time  */
+#  include <immintrin.h>
+#endif
 
 #ifdef AMIGA                 /* Amiga's have these defined              */
 #  include <exec/types.h>
@@ -114,45 +480,712 @@
 #  endif
 #endif
 
+#include "ansi.h"
+
 /************************************************************************/
-#define MAXBUFF      200   /* Max chars in a line                       */
-#define MAXLINES     50    /* Max lines in a function definition        */
+#define VERSION      "4.1" /* V2.7: Also part of each cache key         */
+#define ARENABUFF    4096  /* Initial size of the line arena            */
+#define DEFLINES0    64    /* Initial lines allowed in a definition     */
 #define DIC          34    /* Double inverted commas                    */
 #define SIC          39    /* Single inverted commas                    */
 #define LF           10    /* Line feed                                 */
 #define CR           13    /* Carriage return                           */
-#define MakeANSI     1     /* K&R-->ANSI                                */
-#define MakeKR       2     /* ANSI-->K&R                                */
-#define MakeProtos   3     /* Make prototypes                           */
+#define MSGBUFF      160   /* Max chars in a message                    */
+#define TOKENS0      256   /* Initial tokens allowed in a definition    */
+#define OUTBUFF      65536 /* Size of the output buffer                 */
+#define PROTOBUFF    4096  /* Initial space for prototypes kept         */
+#define ZCOPYMIN     16384 /* Smallest span copied file to file         */
+#define CACHEMAX     1024  /* Default size of the cache in MB           */
+#define SIGFILES0    256   /* Initial buckets for files in a SIGDB      */
+#define SIGFUNCS0    1024  /* Initial buckets for functions in a SIGDB  */
+#define LATENCYBINS  32    /* Request times kept by the server, in      */
+                           /* powers of 2 microseconds                  */
+#define MAXREQUEST   4096  /* Server request line buffer (with the NUL) */
+#define MAXINPUT     268435456UL /* Most bytes a server buffer request  */
+                           /* may send (256MB)                          */
+#define SERVERWAIT   10    /* Seconds a client may stop part way through*/
+                           /* a server request                          */
+#define WATCHQUIET   2     /* ms without changes before --watch converts*/
+#define WATCHMAX     50    /* Longest ms a change waits if they go on   */
+#define DIFFCONTEXT  3     /* Lines of context around a -u hunk         */
+
+/* V3.4: What a server connection is doing                             */
+#define CONN_IDLE    0     /* Polled for its next request               */
+#define CONN_READY   1     /* Has a request, waiting for a thread       */
+#define CONN_BUSY    2     /* Being answered                            */
+
+/* V3.3: How SigHeader() lays out a header                              */
+#define HDR_GROUP    1     /* Each file's prototypes under its name     */
+#define HDR_SORT     2     /* Sorted by function name                   */
+#define HDR_NOSTATIC 4     /* static functions left out                 */
+
+/* V2.6: Large files are split into pieces of at least CHUNKSIZE bytes
+   which are converted on separate threads. Either may be set when
+   compiling
+*/
+#ifndef CHUNKSIZE
+#  define CHUNKSIZE  4194304L
+#endif
+#ifndef SPLITMIN
+#  define SPLITMIN   (2*CHUNKSIZE) /* Smallest file which is split      */
+#endif
+
+/* V2.2: Token types from LexLine(). Punctuation tokens ( ) { } ; , * [ ]
+   have the character as their type
+*/
+#define TK_IDENT     256   /* Identifier or keyword                     */
+#define TK_COMMENT   257   /* Comment, or the part of one on this line  */
+#define TK_STRING    258   /* String constant (or part of one)          */
+#define TK_CHAR      259   /* Character constant                        */
+
+/* V2.3: Sets of bytes the scanners look for                           */
+#define SC_CODE      0     /* / " ' { } in code                         */
+#define SC_COMMENT   1     /* * which may end a comment                 */
+#define SC_DIC       2     /* \ or " in a string                        */
+#define SC_SIC       3     /* \ or ' in a character constant            */
+
+/* V2.6: Which tokens LexLine() keeps                                   */
+#define LEX_AUTO     0     /* Those of lines which may start a function */
+#define LEX_TOKENS   1     /* All of them                               */
+#define LEX_STATE    2     /* None; just keep track of braces, etc.     */
+
+#define isIdentStart(c) (isalpha((unsigned char)(c)) || (c) == '_')
+#define isIdentChar(c)  (isalnum((unsigned char)(c)) || (c) == '_')
+#define isSpace(c)      ((c) == ' ' || (c) == '\t' || (c) == CR || \
+                         (c) == '\f')
+#define isBlank(c)      ((c) == ' ' || (c) == '\t')
+
+/* V2.1: Start of line i of a function definition                       */
+#define DEFLINE(d,i) ((d)->base + (d)->start[i])
+
+/* V2.4: Append a string constant to an OUTBUF                          */
+#define OutString(out,s) OutWrite((out), (s), sizeof(s)-1)
+
+/* V2.8: Offset in the output of the next byte written to an OUTBUF     */
+#define OutPos(out)      ((out)->pos + (out)->spanlen)
+
+/* V2.7: Add one to a count in a CACHE                                  */
+#ifdef THREADS
+#  define CacheCount(c,n) (pthread_mutex_lock(&(c)->lock), (c)->n++, \
+                           pthread_mutex_unlock(&(c)->lock))
+#else
+#  define CacheCount(c,n) ((c)->n++)
+#endif
+
+/* V3.0: Statistics being kept by a context or OUTBUF (never if NOSTATS
+   is defined) and counting in them
+*/
+#ifdef NOSTATS
+#  define Stats(p)        ((void)(p), (ANSISTATS *)NULL)
+#else
+#  define Stats(p)        ((p)->stats)
+#endif
+#define StatCount(p,n)    (Stats(p) != NULL ? (void)(Stats(p)->n++) : \
+                                              (void)0)
+
+/* V2.8: Lock and unlock a SIGDB (V3.4: or a SERVER)                   */
+#ifdef THREADS
+#  define SigLock(d)      pthread_mutex_lock(&(d)->lock)
+#  define SigUnlock(d)    pthread_mutex_unlock(&(d)->lock)
+#else
+#  define SigLock(d)
+#  define SigUnlock(d)
+#endif
+
+/************************************************************************/
+/* Type definitions
+*/
+typedef struct                /* V1.8: An input file                    */
+{
+   FILE  *fp;                 /* Stream for the line at a time path     */
+   int   fd;                  /* V2.5: Descriptor if mapped, else -1    */
+   char  *map,                /* Mapped file, or the arena if streaming */
+         *arena;              /* V2.1: Lines read from a stream         */
+   long  size,                /* Size of the mapped file/used in arena  */
+         pos,                 /* Offset of the next line in the map     */
+         arenasize;           /* V2.1: Space allocated for the arena    */
+   BOOL  mapped,              /* TRUE if we mapped it so must unmap it  */
+         streaming,           /* V2.1: TRUE if reading into the arena   */
+         nomem;               /* V2.1: Set if the arena couldn't grow   */
+   long  nread,               /* V2.9: Bytes read from a stream, and    */
+         ready,               /* how many can be without waiting        */
+         line;                /* V4.0: Lines got so far                 */
+}  INFILE;
+
+typedef struct                /* V1.8: Lines of a function definition   */
+{                             /* V2.1: Offsets rather than fixed arrays */
+   char  *base;               /* Lines are at offsets from here         */
+   long  *start;              /* Offset of each line (not terminated)   */
+   int   *len,                /* Length of each line                    */
+         maxlines;            /* Space allocated for start and len      */
+}  DEFLINES;
+
+typedef struct                /* V2.2: A token found by LexLine()       */
+{
+   long  start;               /* Offset from the start of the input     */
+   int   len,
+         type,                /* TK_... or the punctuation character    */
+         clean;               /* Offset once comments are removed       */
+}  TOKEN;
+
+typedef struct                /* V2.2: What LexLine() found on a line   */
+{
+   int   paren,               /* Offset of the first ( in code or -1    */
+         semi,                /* Offset of the first ; in code or -1    */
+         brace;               /* Offset of the first { in code or -1    */
+   BOOL  interesting;         /* Line might start a function            */
+}  LINEINFO;
+
+typedef struct                /* V3.1: A K&R parameter's declaration, as
+                                 offsets in the joined definitions      */
+{
+   int   name,                /* Its name                               */
+         namelen,
+         type,                /* The type of its statement              */
+         typelen,
+         array,               /* Any [] after the name                  */
+         arraylen,
+         stars,               /* Number of *'s before the name          */
+         next;                /* Next in the same bucket (-1 if none)   */
+}  PARAMDECL;
+
+typedef struct                /* V3.2: An ANSI parameter, as offsets in
+                                 the joined definition                  */
+{
+   int   type,                /* Everything before its name             */
+         typelen,
+         name,                /* Its name                               */
+         namelen,
+         suffix,              /* Everything after it, such as []        */
+         suffixlen;
+}  PARAM;
+
+typedef struct                /* V2.4: Buffered output                  */
+{
+   FILE     *fp;              /* Output file, NULL if kept in memory    */
+   char     *buffer;          /* Output waiting to be written           */
+   size_t   len,              /* Bytes in buffer                        */
+            size;             /* Space allocated for buffer             */
+   int      fd;               /* Written with write() unless -1         */
+   BOOL     memory,           /* Output is kept in buffer, which grows  */
+            error,            /* A write failed or we ran out of memory */
+            nocopy;           /* V2.5: File to file copies don't work   */
+   const char *span;          /* V2.5: Unchanged input waiting to be    */
+   size_t   spanlen;          /* written after buffer                   */
+   int      spanfd;           /* File it's in (-1 if none) and where    */
+   long     spanoff;
+   size_t   pos;              /* V2.8: Bytes output since OutOpen(), 
+                                 not counting the span waiting          */
+   BOOL     flush;            /* V2.9: Going to a pipe, etc., so sent as
+                                 soon as each construct is finished     */
+   ANSISTATS *stats;          /* V3.0: Where writing is timed, or NULL  */
+}  OUTBUF;
+
+/* V2.3: A scanner returns the offset of the first byte in buffer which
+   is in the set, or len if there isn't one
+*/
+typedef int (*SCANFUNC)(const char *buffer, int len, int set);
+
+typedef struct                /* V2.3: A scanner which may be chosen    */
+{
+   char     *name;
+   SCANFUNC func;
+}  SCANNER;
+
+struct ansi_context           /* V1.9: State for converting a file      */
+{                             /* V2.0: ANSICTX is declared in ansi.h    */
+   int      mode,             /* MakeANSI, MakeKR or MakeProtos         */
+            bra_count,        /* V2.2: These four are kept by LexLine() */
+            quote;            /* from one line to the next. quote is    */
+   BOOL     inComment,        /* DIC or SIC in a string or character    */
+            inDirective;      /* constant; inDirective in a continued # */
+   int      lastcode,         /* V2.2: Last code character seen and the */
+            beforesemi;       /* one before the first ; (-1 if none)    */
+   TOKEN    *tok;             /* V2.2: Tokens of the current definition */
+   int      ntok,
+            maxtok;
+   SCANNER  *scanner;         /* V2.3: Scanner used by LexLine() and    */
+   SCANFUNC scan;             /* its function                           */
+   OUTBUF   out;              /* V2.4: Where the output goes            */
+   char     *msgs;            /* Messages from the last conversion      */
+   size_t   msglen,
+            msgsize;
+   INFILE   in;               /* V2.1: The input and its line arena     */
+   DEFLINES funcdef;          /* The definition being assembled         */
+   char     *scratch;         /* V2.1: Work space for conversions       */
+   size_t   scratchsize;
+   int      nthreads;         /* V2.6: Threads to split a large file    */
+   ANSIFUNC *funcs;           /* V2.8: Functions found so far and their */
+   int      nfuncs,           /* names, one after another, each with a  */
+            maxfuncs;         /* NUL                                    */
+   BOOL     keepfuncs;        /* V2.9: Only kept if this is set         */
+   char     *names;
+   size_t   namelen,
+            namesize;
+   ANSISTATS *stats,          /* V3.0: &stat if kept, else NULL         */
+            stat,
+            splitstat;        /* Pieces of a split file, added at end   */
+   double   statwait;         /* Time spent waiting for the pieces      */
+   PARAMDECL *decl;           /* V3.1: K&R declarations of the current  */
+   int      ndecl,            /* definition and the hash table of them  */
+            maxdecl,
+            *declhash,
+            hashsize;
+   PARAM    *param;           /* V3.2: Parameters of an ANSI definition */
+   int      maxparam;
+   BOOL     check;            /* V3.7: Only looking for a definition    */
+   long     checkat;          /* which would be converted, and where it
+                                 starts (-1 if none)                    */
+   BOOL     edits;            /* V3.9: Only definitions which change are
+                                 written, each noted as a function      */
+   BOOL     keepprotos;       /* V4.1: Prototypes made while converting */
+   OUTBUF   protos;           /* to ANSI, and where they're kept        */
+};
+
+#ifdef THREADS
+typedef struct                /* V2.6: A piece of a large file          */
+{
+   long     start,            /* Offsets of the piece in the input      */
+            end;
+   char     *out,             /* Its output and messages, from malloc() */
+            *msgs;
+   size_t   outlen,
+            msglen;
+   int      status;           /* How its conversion went                */
+   BOOL     done;             /* Set once it has been converted         */
+   ANSIFUNC *funcs;           /* V2.8: Its functions and their names    */
+   int      nfuncs;
+   char     *names;
+   ANSISTATS stats;           /* V3.0: What its conversion did          */
+   long     line;             /* V4.0: Lines in the input before it     */
+   char     *protos;          /* V4.1: Its prototypes, from malloc()    */
+   size_t   protolen;
+}  CHUNK;
+
+typedef struct                /* V2.6: A file split over threads        */
+{
+   ANSICTX  *ctx;             /* Context converting the whole file      */
+   INFILE   *in;
+   CHUNK    *chunks;          /* Pieces found so far by the pre-scan    */
+   int      nchunks,
+            next,             /* Next piece for a worker to convert     */
+            written,          /* Pieces written out so far              */
+            maxpending,       /* Most pieces to convert ahead of output */
+            status;           /* First error (main thread only)         */
+   BOOL     scanned,          /* Set once all the pieces are found      */
+            abort;            /* Set when there's no point going on     */
+   pthread_mutex_t lock;      /* Protects all but chunks' contents      */
+   pthread_cond_t  cond;      /* Signalled when any of it changes       */
+}  SPLIT;
+#endif
+
+typedef struct                /* V2.7: The conversion cache             */
+{
+   char     *dir;             /* Directory holding the entries          */
+   long     maxsize,          /* Bytes it may hold after eviction       */
+            hits,             /* Inputs found in it                     */
+            misses,           /* Inputs not found                       */
+            stored,           /* Conversions added                      */
+            evicted;          /* Entries removed to make room           */
+#ifdef THREADS
+   pthread_mutex_t lock;      /* Protects the counts                    */
+#endif
+}  CACHE;
+
+typedef struct                /* V2.7: A cache entry when evicting      */
+{
+   char     name[40];
+   double   mtime;            /* Time it was last used                  */
+   long     size;
+}  CACHEENTRY;
+
+typedef struct sigfunc        /* V2.8: A function in a signature store  */
+{
+   struct sigfunc *next;      /* Next with a name in the same bucket    */
+   struct sigfile *file;      /* File it's defined in                   */
+   char     *name,            /* Its name and prototype, in the file's  */
+            *proto;           /* text                                   */
+   size_t   protolen;
+   long     start,            /* Offsets of its definition in the file  */
+            end;
+}  SIGFUNC;
+
+typedef struct sigfile        /* V2.8: A file in the signature store    */
+{
+   struct sigfile *next;      /* Next with a path in the same bucket    */
+   char     *path,            /* Its path, messages and prototypes, all */
+            *msgs,            /* in one block from malloc() starting    */
+            *out;             /* with the path                          */
+   size_t   msglen,
+            outlen;
+   unsigned long long hash;   /* Hash and size of the file they're from */
+   long     size;
+   SIGFUNC  *funcs;           /* Its functions in order                 */
+   int      nfuncs;
+}  SIGFILE;
+
+typedef struct                /* V2.8: The signature store              */
+{
+   char     *path;            /* File it's kept in (NULL if none)       */
+   SIGFILE  **files;          /* Hash table of files by path            */
+   SIGFUNC  **funcs;          /* Hash table of functions by name        */
+   long     nfiles,
+            nfuncs,
+            filebuckets,      /* Sizes of the tables (powers of 2)      */
+            funcbuckets,
+            reused,           /* Files whose prototypes were reused     */
+            parsed;           /* Files which had to be converted        */
+   BOOL     changed;          /* Needs saving                           */
+#ifdef THREADS
+   pthread_mutex_t lock;      /* Protects all of it                     */
+#endif
+}  SIGDB;
+
+typedef struct                /* V3.3: A prototype going in a header    */
+{
+   SIGFUNC  *func;
+   const char *name;          /* Its name if sorting by name, else ""   */
+   int      section,          /* 1 if it's static                       */
+            group,            /* Its file if grouping by file, else 0   */
+            order;            /* Where it was found                     */
+}  HDRPROTO;
+
+typedef struct                /* V3.4: A connection to the -d server    */
+{
+   int      fd,
+            slot,             /* Where it is in SERVER conns            */
+            state;            /* CONN_IDLE, CONN_READY or CONN_BUSY     */
+   size_t   pos,              /* What's in buffer which hasn't been     */
+            len;              /* used                                   */
+   BOOL     broken;           /* Ended, or can't be used again          */
+   char     buffer[MAXREQUEST];
+}  CONN;
+
+typedef struct                /* V3.4: The -d server                    */
+{
+   CONN     **conns;          /* Open connections (NULL where closed)   */
+   int      listenfd,         /* Socket it accepts connections on       */
+            wake[2],          /* Pipe which wakes the polling thread    */
+            maxconns,
+            nready,           /* Connections with a request waiting     */
+            next;             /* Where ServerTake() looks first         */
+   BOOL     quit;             /* A quit request has been answered       */
+   double   started;          /* StatClock() time it started            */
+   unsigned long connections, /* Connections accepted                   */
+            requests,         /* Requests answered                      */
+            failed,           /* Of those, the ones which failed        */
+            bytesin,          /* Bytes of input converted               */
+            bytesout,         /* Bytes of output returned               */
+            latency[LATENCYBINS]; /* Requests taking up to 2^i us       */
+   double   busy;             /* Time spent answering requests          */
+#ifdef THREADS
+   pthread_mutex_t lock;      /* Protects the counts and connections    */
+   pthread_cond_t  ready;     /* Signalled when one has a request       */
+#endif
+}  SERVER;
+
+typedef struct                /* V3.5: A tree being watched             */
+{
+   char     *src,             /* The tree and where it's converted to   */
+            *dst,
+            **dirs,           /* Directory of each watch relative to 
+                                 src ("" for src), NULL if none         */
+            **pending;        /* Files to convert relative to src       */
+   int      fd,               /* From inotify_init()                    */
+            maxdirs,
+            npending,
+            maxpending;
+}  WATCHER;
+
+typedef struct                /* V3.9: A record from an edit script     */
+{
+   char     *file,            /* File to be edited                      */
+            *text;            /* What replaces the bytes (in the script)*/
+   long     start,            /* Offsets of the first byte replaced and */
+            end;              /* the byte after the last                */
+   size_t   len;              /* Length of text                         */
+   uint64_t hash;             /* XXH64 of the bytes replaced            */
+   char     *path;            /* file as a real path, from malloc()     */
+   int      order;            /* Where it was in the script             */
+   long     line;             /* V4.0: Line start is on, for a diff     */
+}  EDIT;
+
+typedef struct                /* V1.9: A pair of files for batch mode   */
+{
+   char     *in,              /* Input file name                        */
+            *out;             /* Output file name, - for stdout, NULL
+                                 for none (V2.8)                        */
+   FILE     *fp_out,          /* Holds output for stdout until its turn */
+            *fp_msg;          /* Holds messages until its turn          */
+   int      status;           /* 0 if all OK                            */
+   BOOL     done,             /* Set when the job has been run          */
+            atomic,           /* V3.5: Output written to a temporary
+                                 file which is renamed when complete    */
+            inplace,          /* V3.6: Input is rewritten if it changes */
+            changed,          /* V3.6: It did                           */
+            check,            /* V3.7: Input is only checked            */
+            edits,            /* V3.9: An edit script is written        */
+            diff;             /* V4.0: As a unified diff                */
+}  JOB;
+
+typedef struct                /* V3.0: Statistics for --stats           */
+{
+   ANSISTATS total;           /* All the files converted added up       */
+   long     files;            /* How many there were                    */
+#ifdef THREADS
+   pthread_mutex_t lock;      /* Protects both                          */
+#endif
+}  RUNSTATS;
+
+#ifdef THREADS
+typedef struct                /* V1.9: A batch mode worker's jobs       */
+{
+   pthread_mutex_t lock;
+   int      head,             /* Next job this worker will run          */
+            tail;             /* One beyond its last job                */
+}  DEQUE;
+#endif
+
+typedef struct                /* V1.9: The batch mode worker pool       */
+{
+   JOB      *jobs;            /* Files to be converted                  */
+   int      njobs,
+            mode,
+            nworkers,
+            nthreads;         /* V2.6: Threads to split a large file    */
+   CACHE    *cache;           /* V2.7: Conversion cache or NULL         */
+   SIGDB    *sigdb;           /* V2.8: Signature store or NULL          */
+   RUNSTATS *stats;           /* V3.0: Statistics or NULL               */
+#ifdef THREADS
+   DEQUE    *deque;           /* One range of jobs per worker           */
+   pthread_mutex_t lock;      /* Protects JOB.done                      */
+   pthread_cond_t  cond;      /* Signalled as each job is done          */
+#endif
+}  POOL;
 
-#define toggle(x) (x) = abs((x)-1)
+#ifdef THREADS
+typedef struct                /* V1.9: A batch mode worker thread       */
+{
+   POOL     *pool;
+   int      id;
+}  WORKER;
+#endif
 
 /************************************************************************/
 /* Prototypes
 */
+static int   process_file(ANSICTX *ctx, INFILE *in, OUTBUF *out);
+static int   LexLine(ANSICTX *ctx, char *line, long offset, int len,
+                     int tokens, LINEINFO *info);
+static int   Ansify(ANSICTX *ctx, OUTBUF *out, DEFLINES *funcdef, int ndef);
+static int   WriteANSI(ANSICTX *ctx, OUTBUF *out, char *varname, 
+                       char *definitions);
+static char  *FindVarName(char *buffer, char *string);
+static int   ParseDecls(ANSICTX *ctx, char *definitions);
+static PARAMDECL *FindDecl(ANSICTX *ctx, char *definitions, char *varname,
+                           PARAMDECL *found);
+static void  DeclType(char *definitions, int stmt, int *type, int *typelen);
+static void  DeclAt(char *definitions, int name, int namelen, PARAMDECL *decl);
+static unsigned long HashName(const char *name, int len);
+static int   isFunc(ANSICTX *ctx, LINEINFO *info);
+static BOOL  isKRDef(ANSICTX *ctx);
+static BOOL  NeedsConverting(ANSICTX *ctx, int ndef);
+static int   DeAnsify(ANSICTX *ctx, OUTBUF *out, DEFLINES *funcdef, int ndef);
+static void  WriteKR(OUTBUF *out, char *buffer, PARAM *param);
+static BOOL  GrowParams(ANSICTX *ctx);
+static BOOL  OpenInput(INFILE *in, FILE *fp);
+#ifdef POSIX_IO
+static BOOL  InputWaiting(INFILE *in);
+#endif
+static void  OpenBuffer(INFILE *in, const char *buffer, size_t len);
+static BOOL  GetLine(INFILE *in, long *start, int *len);
+static void  ResetArena(INFILE *in);
+static void  CloseInput(INFILE *in);
+static BOOL  GrowDefLines(DEFLINES *funcdef);
+static BOOL  AddDefLine(ANSICTX *ctx, INFILE *in, int n, LINEINFO *info,
+                        int *status);
+static int   StripComments(ANSICTX *ctx, DEFLINES *funcdef, int ndef,
+                           char *buffer);
+static char  *GetScratch(ANSICTX *ctx, size_t size);
+static void  WriteLine(OUTBUF *out, char *line, int len);
+static BOOL  OutOpen(OUTBUF *out, FILE *fp, size_t size);
+static void  OutWrite(OUTBUF *out, const char *data, size_t len);
+static void  OutPad(OUTBUF *out, int c, size_t n);
+static BOOL  OutSend(OUTBUF *out, const char *data, size_t len);
+static BOOL  OutGrow(OUTBUF *out, size_t len);
+static BOOL  OutFlush(OUTBUF *out);
+static void  OutSpan(OUTBUF *out, const char *data, size_t len, int fd, 
+                     long offset);
+static void  OutSendSpan(OUTBUF *out);
+static void  PassLine(INFILE *in, OUTBUF *out, long start, int len);
+static int   ScanScalar(const char *buffer, int len, int set);
+#ifdef SIMD_X86
+static int   ScanSSE2(const char *buffer, int len, int set);
+static int   ScanAVX2(const char *buffer, int len, int set);
+#endif
+static SCANNER *FindScanner(const char *name);
+static void  Message(ANSICTX *ctx, char *format, ...);
+static BOOL  NoteFunction(ANSICTX *ctx, INFILE *in, DEFLINES *funcdef, 
+                          int ndef, size_t outpos, size_t outend, 
+                          size_t protopos, size_t protoend);
+static BOOL  AddFunction(ANSICTX *ctx, const char *name, size_t namelen, 
+                         long start, long end, long line, size_t outpos, 
+                         size_t outlen, size_t protopos, size_t protolen);
+static void  ResetContext(ANSICTX *ctx);
+static void  StatClock(double *wall, double *cpu);
+static void  StatStage(ANSISTATS *stats, int stage, double wall, double cpu);
+static void  StatEnd(ANSICTX *ctx, double wall, double cpu);
+static void  StatMerge(ANSISTATS *to, const ANSISTATS *from);
+#ifdef THREADS
+static BOOL  SplitFile(ANSICTX *ctx, INFILE *in, OUTBUF *out, int *status);
+static void  AddChunk(SPLIT *split, long start, long end, long line);
+static void  WriteChunks(SPLIT *split, OUTBUF *out, BOOL wait);
+static void  *ChunkWorker(void *arg);
+static void  AddMessages(ANSICTX *ctx, const char *msgs, size_t len);
+#endif
+#ifndef ANSI_LIBRARY
 int   main(int argc, char **argv);
-int   GetVarName(char *buffer, char *strparam);
-void  process_file(FILE *fp_in, FILE *fp_out, int mode);
-int   isInteresting(char *buffer);
-void  Ansify(FILE *fp, char funcdef[MAXLINES][MAXBUFF], 
-             int ndef, int mode);
-int   WriteANSI(FILE *fp, char *varname, char *definitions);
-char  *FindString(char *buffer, char *string);
-char  *FindVarName(char *buffer, char *string);
-int   isFunc(char funcdef[MAXLINES][MAXBUFF], int ndef);
-void  terminate(char *string);
-void  DeAnsify(FILE *fp_out, char funcdef[MAXLINES][MAXBUFF], 
-               int  ndef);
-void  WriteKR(FILE *fp, char *varname, char *definitions);
-void  KillComments(char *buffer);
+static void  Banner(FILE *fp, int mode, char *file, int nfiles);
+static int   RunBatch(JOB *jobs, int njobs, int mode, int nworkers, 
+                      CACHE *cache, SIGDB *sigdb, RUNSTATS *stats);
+static int   RunJob(JOB *job, int mode, int nthreads, CACHE *cache, 
+                    SIGDB *sigdb, RUNSTATS *stats, BOOL hold);
+static void  JobStats(RUNSTATS *stats, ANSICTX *ctx, FILE *fp, char *file);
+static void  WriteStats(FILE *fp, char *file, const ANSISTATS *stats);
+static JOB   *ReadJobList(FILE *fp, int *njobs, BOOL pairs);
+#  ifdef THREADS
+static void  ReleaseJob(JOB *job);
+static void  *Worker(void *arg);
+static BOOL  NextJob(POOL *pool, int id, int *job);
+#  endif
+#  ifdef POSIX_IO
+static uint64_t XXHash64(const char *data, size_t len, uint64_t seed);
+static BOOL  CacheOpen(CACHE *cache, char *dir, long maxmb);
+static void  CacheClose(CACHE *cache, FILE *fp);
+static char  *CacheName(CACHE *cache, FILE *fp, int mode);
+static BOOL  CacheGet(CACHE *cache, char *name, char *out, FILE *msg, 
+                      int *status);
+static void  CachePut(CACHE *cache, char *name, char *out, const char *msgs);
+static void  CacheEvict(CACHE *cache);
+static int   CompareEntries(const void *a, const void *b);
+static BOOL  SameContents(char *file, const char *data, size_t len);
+static BOOL  WriteAll(int fd, const char *data, size_t len);
+static BOOL  SigOpen(SIGDB *db, char *path);
+static void  SigClose(SIGDB *db, FILE *fp);
+static BOOL  SigSave(SIGDB *db);
+static int   SigJob(JOB *job, SIGDB *db, int mode, int nthreads, 
+                    RUNSTATS *stats, FILE *msg, BOOL hold);
+static uint64_t SigHash(const char *map, size_t size);
+static BOOL  SigKeep(SIGDB *db, const char *path, uint64_t hash, long size,
+                     ANSICTX *ctx, const char *out, size_t outlen, 
+                     BOOL written);
+static BOOL  SigHeader(SIGDB *db, JOB *jobs, int njobs, char *header, 
+                       int layout);
+static BOOL  IsStatic(const char *proto, size_t len);
+static int   CompareProtos(const void *a, const void *b);
+static int   SigQuery(SIGDB *db, char *name, FILE *fp);
+static BOOL  SigAddFile(SIGDB *db, const char *path, uint64_t hash, long size,
+                        const char *msgs, size_t msglen, const char *out,
+                        size_t outlen, const ANSIFUNC *funcs, int nfuncs);
+static void  SigRemoveFile(SIGDB *db, SIGFILE *file);
+static SIGFILE *SigFindFile(SIGDB *db, const char *path);
+static BOOL  SigGrow(SIGDB *db, int nfuncs);
+static long  SigBucket(const char *key, long nbuckets);
+static int   ServerRun(char *path, int nworkers, FILE *msg);
+#     ifdef THREADS
+static void  *ServerWorker(void *arg);
+#     endif
+static void  ServerAccept(SERVER *server);
+static CONN  *ServerTake(SERVER *server, BOOL wait);
+static void  ServerGive(SERVER *server, CONN *conn);
+static void  ServerAnswer(SERVER *server, CONN *conn, ANSICTX **ctx);
+static int   ServerLine(CONN *conn, char *line, size_t size);
+static BOOL  ServerRead(CONN *conn, char *data, size_t len);
+static BOOL  ServerFill(CONN *conn);
+static int   ServerRequest(SERVER *server, CONN *conn, char *line, 
+                           ANSICTX **ctx, char **out, size_t *outlen, 
+                           const char **msgs);
+static char  *ServerStats(SERVER *server, size_t *len);
+static FILE  *OpenAtomic(char *file, int like, char **tmp);
+static int   CheckJob(JOB *job, int mode, FILE *msg);
+static BOOL  CopyJob(JOB *job, int mode, RUNSTATS *stats, FILE *msg);
+static BOOL  AlreadyConverted(ANSICTX *ctx, const char *map, size_t size);
+static BOOL  CopyData(int from, int to, const char *map, size_t size);
+static int   InPlaceJob(JOB *job, int mode, int nthreads, SIGDB *sigdb,
+                        RUNSTATS *stats, FILE *msg);
+static int   EditJob(JOB *job, int mode, int nthreads, RUNSTATS *stats, 
+                     FILE *msg, BOOL hold);
+static void  WriteEdit(FILE *fp, const char *file, const char *map, 
+                       long start, long end, const char *text, size_t len);
+static void  WriteJSON(FILE *fp, const char *str, size_t len);
+static void  WriteDiff(FILE *fp, const char *file, const char *map, long size,
+                       EDIT *edits, int nedits);
+static BOOL  TrimEdit(EDIT *edit, const char *map);
+static void  DiffLines(FILE *fp, int mark, const char *from, const char *to);
+static long  CountLines(const char *from, const char *to);
+static char  *ReadAll(FILE *fp, size_t *len);
+static char  *ParseJSON(char *ptr, char **str, size_t *len);
+static BOOL  ParseEdit(char *line, EDIT *edit);
+static int   CompareEdits(const void *a, const void *b);
+static BOOL  ApplyEdits(EDIT *edits, int nedits, FILE *msg);
+static int   ApplyRun(int nscripts, char **scripts, BOOL noisy);
+static BOOL  MakeParents(char *path);
+static char  *JoinPath(const char *dir, const char *name);
+#     ifdef WATCH
+static int   WatchRun(char *src, char *dst, int mode, int nworkers, 
+                      RUNSTATS *stats, BOOL noisy);
+static BOOL  WatchDir(WATCHER *watch, const char *rel);
+static void  WatchForget(WATCHER *watch, const char *rel);
+static BOOL  WatchQueue(WATCHER *watch, char *rel);
+static int   WatchFlush(WATCHER *watch, int mode, int nworkers, 
+                        RUNSTATS *stats);
+static BOOL  IsSource(const char *name);
+static int   ComparePaths(const void *a, const void *b);
+#     endif
+#  endif
+#endif
+
+/************************************************************************/
+/* V2.3: Byte classes for ScanScalar(). Bit n is set if the byte is in 
+   scanner set n
+*/
+static const unsigned char ScanClass[256] =
+{
+   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+   0, 0, 5, 0, 0, 0, 0, 9, 0, 0, 2, 0, 0, 0, 0, 1,    /*  " ' * /     */
+   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,12, 0, 0, 0,    /*  \           */
+   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 0, 0     /*  { }         */
+};
+
+#ifdef SIMD_X86
+/* The same sets as lists of bytes for the SIMD scanners                */
+static const char *ScanSet[]    = {"/\"'{}", "*", "\\\"", "\\'"};
+static const int  ScanSetLen[]  = {5,        1,   2,      2};
+#endif
+
+/* Scanners in order of preference                                      */
+static SCANNER Scanners[] =
+{
+#ifdef SIMD_X86
+   {"avx2",    ScanAVX2},
+   {"sse2",    ScanSSE2},
+#endif
+   {"scalar",  ScanScalar},
+   {NULL,      NULL}
+};
 
 /************************************************************************/
 /* Version string
 */
 #ifdef AMIGA
-UBYTE *vers="\0$VER: ansi 1.7";
+UBYTE *vers="\0$VER: ansi " VERSION;
 #endif
 
+#ifndef ANSI_LIBRARY
 /************************************************************************/
 /*>int main(int argc, char **argv)
    ---------------------------
@@ -161,147 +1194,714 @@ UBYTE *vers="\0$VER: ansi 1.7";
    17.12.91 Original    By: ACRM
    21.01.92 Added exit() for VAX
    02.03.94 Correctly defined as int type routine
+   16.10.26 Added batch mode. Switches are now read up to the first
+            argument not starting with a -
+   16.10.26 Uses the library interface
+   16.10.26 -j also sets the threads a large file is split over
+   16.10.26 A single pair of files is run as a batch of one. Added -c 
+            and -m
+   16.10.26 Added -s, -h and -f
+   16.10.26 With no files, filters stdin to stdout. An input of - is
+            stdin
+   16.10.26 Added --stats
+   16.10.26 Added -g, -n and -x
+   16.10.26 Added -d
+   16.10.26 Added --watch
+   16.10.26 Added -i
+   16.10.26 Added --check
+   16.10.26 Added -e and --apply
+   16.10.26 Added -u
+   16.10.26 -h and -s may be used without -p
+   16.10.26 Exits with 1 after a usage error, so a script can tell
 */
 int main(int argc, char **argv)
 {
-   int   mode        = MakeANSI;
-   BOOL  noisy       = TRUE;
-   FILE  *fp_in      = NULL,
-         *fp_out     = NULL;
-   
-   if(argc < 3)
-   {
-      printf("\nUsage: ansi [-k -p -q] <in.c> <out.c>\n");
-      printf("       Converts a K&R style C file to ANSI or vice versa\n");
-      printf("       -k generates K&R form code from ANSI\n");
-      printf("       -p generates a set of prototypes\n");
-      printf("       -q quiet mode\n\n");
-      
-      exit(0);
-   }
+   int      mode        = MakeANSI,
+            nworkers    = 0,
+            njobs       = 0,
+            nstdin,
+            nchanged,
+            status      = 0,
+            i;
+   long     cachemax    = CACHEMAX;
+   BOOL     noisy       = TRUE,
+            batch       = FALSE,
+            nullist     = FALSE,
+            filter      = FALSE,
+            watch       = FALSE,
+            inplace     = FALSE,
+            check       = FALSE,
+            edits       = FALSE,
+            diff        = FALSE,
+            apply       = FALSE,
+            bare,
+            pairs;
+   int      layout      = 0;
+   FILE     *fp_msg     = stdout;
+   JOB      *jobs       = NULL;
+   char     *cachedir   = NULL,
+            *sigpath    = NULL,
+            *header     = NULL,
+            *query      = NULL,
+            *socketpath = NULL;
+   CACHE    *pcache     = NULL;
+   SIGDB    *psigdb     = NULL;
+   RUNSTATS *pstats     = NULL;
+#ifndef NOSTATS
+   RUNSTATS runstats;
+#endif
+#ifdef POSIX_IO
+   CACHE    cache;
+   SIGDB    sigdb;
+#endif
    
    /* Parse the command line                                            */
+   argc--;
    argv++;
-   while(--argc > 2)
+   bare = (BOOL)(argc == 0);
+   while(argc && argv[0][0] == '-' && argv[0][1])
    {
-      if(argv[0][0] == '-')
+      switch(argv[0][1])
       {
-         switch(argv[0][1])
+      case 'k':
+      case 'K':
+         mode = MakeKR;
+         break;
+      case 'p':
+      case 'P':
+         mode = MakeProtos;
+         break;
+      case 'q':
+      case 'Q':
+         noisy = FALSE;
+         break;
+      case 'b':
+      case 'B':
+         batch = TRUE;
+         break;
+      case '0':
+         nullist = TRUE;
+         break;
+      case 'j':
+      case 'J':
+         if(argc < 2 || (nworkers = atoi(argv[1])) < 1)
+         {
+            printf("-j must be followed by a number of workers\n");
+            exit(1);
+         }
+         argc--;
+         argv++;
+         break;
+      case 'c':
+      case 'C':
+         if(argc < 2)
+         {
+            printf("-c must be followed by a cache directory\n");
+            exit(1);
+         }
+         cachedir = argv[1];
+         argc--;
+         argv++;
+         break;
+      case 'm':
+      case 'M':
+         if(argc < 2 || (cachemax = atol(argv[1])) < 1)
+         {
+            printf("-m must be followed by a cache size in MB\n");
+            exit(1);
+         }
+         argc--;
+         argv++;
+         break;
+      case 's':
+      case 'S':
+         if(argc < 2)
+         {
+            printf("-s must be followed by a signature store\n");
+            exit(1);
+         }
+         sigpath = argv[1];
+         argc--;
+         argv++;
+         break;
+      case 'h':
+      case 'H':
+         if(argc < 2)
          {
-         case 'k':
-         case 'K':
-            mode = MakeKR;
+            printf("-h must be followed by a header file\n");
+            exit(1);
+         }
+         header = argv[1];
+         argc--;
+         argv++;
+         break;
+      case 'd':
+      case 'D':
+         if(argc < 2)
+         {
+            printf("-d must be followed by a socket name\n");
+            exit(1);
+         }
+         socketpath = argv[1];
+         argc--;
+         argv++;
+         break;
+      case 'i':
+      case 'I':
+         inplace = TRUE;
+         break;
+      case 'e':
+      case 'E':
+         edits = TRUE;
+         break;
+      case 'u':
+      case 'U':
+         edits = diff = TRUE;
+         break;
+      case 'g':
+      case 'G':
+         layout |= HDR_GROUP;
+         break;
+      case 'n':
+      case 'N':
+         layout |= HDR_SORT;
+         break;
+      case 'x':
+      case 'X':
+         layout |= HDR_NOSTATIC;
+         break;
+      case 'f':
+      case 'F':
+         if(argc < 2)
+         {
+            printf("-f must be followed by a function name\n");
+            exit(1);
+         }
+         query = argv[1];
+         argc--;
+         argv++;
+         break;
+      case '-':
+         if(!strcmp(argv[0], "--watch"))
+         {
+            watch = TRUE;
             break;
-         case 'p':
-         case 'P':
-            mode = MakeProtos;
+         }
+         if(!strcmp(argv[0], "--check"))
+         {
+            check = TRUE;
             break;
-         case 'q':
-         case 'Q':
-            noisy = FALSE;
+         }
+         if(!strcmp(argv[0], "--apply"))
+         {
+            apply = TRUE;
             break;
-         default:
+         }
+         if(strcmp(argv[0], "--stats"))
+         {
             printf("Unknown switch %s\n",argv[0]);
-            exit(0);
+            exit(1);
          }
+#ifdef NOSTATS
+         printf("--stats is not available in this build\n");
+         exit(1);
+#else
+         pstats = &runstats;
+#endif
+         break;
+      default:
+         printf("Unknown switch %s\n",argv[0]);
+         exit(1);
       }
-      else
-      {
-         printf("Invalid switch %s\n",argv[0]);
-         exit(0);
-      }
+      argc--;
       argv++;
    }
    
-   /* Open files                                                        */
-   if((fp_in = fopen(argv[0],"r")) == NULL)
+   /* V2.8: Look up a function in the signature store                   */
+   if(query != NULL)
    {
-      printf("Unable to open input file %s\n",argv[0]);
-      exit(1);
+#ifdef POSIX_IO
+      if(sigpath == NULL || argc)
+      {
+         printf("-f needs a signature store from -s and no files\n");
+         exit(1);
+      }
+      if(!SigOpen(&sigdb, sigpath))
+      {
+         printf("No memory to read signature store %s\n", sigpath);
+         exit(1);
+      }
+      status = SigQuery(&sigdb, query, stdout);
+      SigClose(&sigdb, NULL);
+#else
+      printf("-f is not available on this system\n");
+      status = 1;
+#endif
+      exit(status);
    }
-   if((fp_out = fopen(argv[1],"w")) == NULL)
+   /* V3.4: Run as a server                                           */
+   if(socketpath != NULL)
    {
-      printf("Unable to open output file %s\n",argv[1]);
-      exit(1);
+#ifdef POSIX_IO
+      if(argc || batch || nullist || cachedir != NULL || sigpath != NULL ||
+         header != NULL)
+      {
+         printf("-d takes no files and only -q and -j\n");
+         exit(1);
+      }
+      if(noisy) 
+         printf("SciTech Software ansi C converter V%s serving on %s\n",
+                VERSION, socketpath);
+      fflush(stdout);
+      status = ServerRun(socketpath, nworkers, stderr);
+#else
+      printf("-d is not available on this system\n");
+      status = 1;
+#endif
+      exit(status);
    }
-
-   /* Give a message                                                    */
-   if(noisy)
+   /* V3.9: Make the edits in edit scripts                            */
+   if(apply)
    {
-      printf("SciTech Software ansi C converter V1.7\n");
-      printf("Copyright (C) 1991 SciTech Software. All Rights Reserved.\n");
-      printf("This program is freely distributable providing no profit is made in so doing.\n\n");
-      switch(mode)
+#ifdef POSIX_IO
+      if(mode != MakeANSI || batch || nullist || inplace || check || 
+         edits || cachedir != NULL || sigpath != NULL || header != NULL ||
+         pstats != NULL)
       {
-      case MakeANSI:
-         printf("Converting file %s to ANSI\n",argv[0]);
-         break;
-      case MakeKR:
-         printf("Converting file %s to Kernighan and Ritchie\n",argv[0]);
-         break;
-      case MakeProtos:
-         printf("Generating prototypes for file %s\n",argv[0]);
-         break;
-      default:
-         break;
+         printf("--apply takes edit scripts (or reads one from stdin) and "
+                "only -q\n");
+         exit(1);
       }
+      status = ApplyRun(argc, argv, noisy);
+#else
+      printf("--apply is not available on this system\n");
+      status = 1;
+#endif
+      exit(status);
    }
-
-   /* Now process the files as required by the flags                    */
-   process_file(fp_in, fp_out, mode);
-   
-   exit(0);    /* V1.1, for VAX clean-ness                              */
-   return(0);
-}
-
-/************************************************************************/
-/*>int GetVarName(buffer, strparam)
-   --------------------------------
-   Input:   char     *buffer        A character string
-   Output:  char     *strparam      Returned character string
-   Returns: int                     Number of characters pulled out
-                                    of the buffer string
-
-   This routine returns the first , or ) delimited group of characters
-   from character string `buffer'
-
-   17.12.91 Original    By: ACRM
-*/
-int GetVarName(char *buffer, char *strparam)
-{
-   int   i,
-         j  = 0;
-
-   for(i=0;buffer[i];i++)
+   /* V3.5: Keep a tree converted                                     */
+   if(watch)
    {
-      /* Break out if we've got a , or )                                */
-      if(buffer[i]==',' || buffer[i]==')') break;
-
-      /* Otherwise copy the character                                   */
-      strparam[j++] = buffer[i];
+#ifdef WATCH
+      if(argc != 2 || batch || nullist || cachedir != NULL || 
+         sigpath != NULL || header != NULL)
+      {
+         printf("--watch takes a source and an output directory and no "
+                "-b, -0, -c, -s or -h\n");
+         exit(1);
+      }
+      if(noisy) Banner(stdout, mode, argv[0], 0);
+      status = WatchRun(argv[0], argv[1], mode, nworkers, pstats, noisy);
+#else
+      printf("--watch is not available on this system\n");
+      status = 1;
+#endif
+      exit(status);
+   }
+   if((sigpath != NULL || header != NULL) && mode == MakeKR)
+   {
+      printf("-s and -h may not be used with -k\n");
+      exit(1);
+   }
+   if(inplace && (mode == MakeProtos || batch || cachedir != NULL || 
+                  (!argc && !nullist)))
+   {
+      printf("-i needs files, or -0, and no -p, -b or -c\n");
+      exit(1);
+   }
+#ifndef POSIX_IO
+   if(inplace)
+   {
+      printf("-i is not available on this system\n");
+      exit(1);
+   }
+#endif
+   if(layout && header == NULL)
+   {
+      printf("-g, -n and -x may only be used with -h\n");
+      exit(1);
+   }
+   if(check && (mode == MakeProtos || batch || inplace || edits ||
+                cachedir != NULL || sigpath != NULL || header != NULL ||
+                pstats != NULL || (!argc && !nullist)))
+   {
+      printf("--check needs files, or -0, and no -p, -b, -i, -e, -c, -s, "
+             "-h or --stats\n");
+      exit(1);
+   }
+   if(edits && (mode == MakeProtos || batch || inplace || 
+                cachedir != NULL || sigpath != NULL || header != NULL ||
+                (!argc && !nullist)))
+   {
+      printf("-e and -u need files, or -0, and no -p, -b, -i, -c, -s or "
+             "-h\n");
+      exit(1);
    }
-   strparam[j]='\0';
+#ifndef POSIX_IO
+   if(check || edits)
+   {
+      printf("--check, -e and -u are not available on this system\n");
+      exit(1);
+   }
+#endif
    
-   /* Strip any trailing spaces                                         */
-   for(j=strlen(strparam) - 1 ;
-       j >= 0 && (strparam[j] == ' ' || strparam[j] == '\t');
-       j--)
-      strparam[j] = '\0';
-
-   return(i);
-}
+#ifdef POSIX_IO
+   /* V2.9: With no files, and something other than a terminal on stdin,
+      we're a filter
+   */
+   filter = (BOOL)(argc == 0 && !batch && !nullist && header == NULL &&
+                   !isatty(fileno(stdin)));
+#endif
 
+   /* Files come in pairs of input and output unless only the inputs are
+      needed. V4.1: A header from converting to ANSI still has outputs
+   */
+   pairs = (BOOL)(!(header != NULL && mode == MakeProtos) && !inplace &&
+                  !check && !edits);
 
-/************************************************************************/
-/*>void process_file(fp_in, fp_out, mode)
-   --------------------------------------
-   Input:   FILE     *fp_in         File to be processed
-            FILE     *fp_out        Output file being created
-            int      mode           Processing mode.
+   if(nullist)
+   {
+      if(argc || (jobs = ReadJobList(stdin, &njobs, pairs)) == NULL) 
+      {
+         printf("-0 needs %s file names on stdin\n",
+                pairs ? "an even number of" : "some");
+         exit(1);
+      }
+   }
+   else if(!pairs && argc >= 1)
+   {
+      /* V2.8: Just the inputs, whose prototypes go in the header 
+         (V3.6: or which are rewritten, V3.7: or checked, V3.9: or 
+         edited)
+      */
+      njobs = argc;
+      if((jobs = (JOB *)calloc(njobs, sizeof(JOB))) == NULL)
+      {
+         printf("No memory for file list\n");
+         exit(1);
+      }
+      for(i=0; i<njobs; i++)
+         jobs[i].in = argv[i];
+   }
+   else if(pairs && batch && argc >= 2 && !(argc%2))
+   {
+      njobs = argc/2;
+      if((jobs = (JOB *)calloc(njobs, sizeof(JOB))) == NULL)
+      {
+         printf("No memory for file list\n");
+         exit(1);
+      }
+      for(i=0; i<njobs; i++)
+      {
+         jobs[i].in  = argv[2*i];
+         jobs[i].out = argv[2*i+1];
+      }
+   }
+   else if(filter)
+   {
+      /* V2.9: Quietly, as a batch of one                               */
+      noisy = FALSE;
+      njobs = 1;
+      if((jobs = (JOB *)calloc(1, sizeof(JOB))) == NULL)
+      {
+         fprintf(stderr,"No memory for file list\n");
+         exit(1);
+      }
+      jobs[0].in  = "-";
+      jobs[0].out = "-";
+   }
+   else if(!pairs || batch || argc != 2)
+   {
+      printf("\nUsage: ansi [-k -p -q] [-j n] [-c dir [-m MB]] <in.c> "
+             "<out.c>\n");
+      printf("       ansi [-k -p] < in.c > out.c\n");
+      printf("       ansi [-k -p -q] [-j n] [-c dir [-m MB]] -b <in.c> "
+             "<out.c> [...]\n");
+      printf("       ansi [-k -p -q] [-j n] [-c dir [-m MB]] -0 < list\n");
+      printf("       ansi [-k -q] [-j n] -i <file.c> [...]\n");
+      printf("       ansi [-k -q] [-j n] -i -0 < list\n");
+      printf("       ansi [-k] [-j n] --check <file.c> [...]\n");
+      printf("       ansi [-k] [-j n] --check -0 < list\n");
+      printf("       ansi [-k -q] [-j n] -e <file.c> [...] > edits\n");
+      printf("       ansi [-k -q] [-j n] -u <file.c> [...] > patch\n");
+      printf("       ansi [-q] --apply [edits ...]\n");
+      printf("       ansi -p [-q -g -n -x] [-j n] [-s db] -h <protos.h> "
+             "<in.c> [...]\n");
+      printf("       ansi -p [-q -g -n -x] [-j n] [-s db] -h <protos.h> "
+             "-0 < list\n");
+      printf("       ansi [-q -g -n -x] [-j n] [-s db] -h <protos.h> [-b] "
+             "<in.c> <out.c> [...]\n");
+      printf("       ansi [-q -g -n -x] [-j n] [-s db] -h <protos.h> -i "
+             "<file.c> [...]\n");
+      printf("       ansi -s db -f <name>\n");
+      printf("       ansi [-q] [-j n] -d <socket>\n");
+      printf("       ansi [-k -p -q] [-j n] --watch <srcdir> <outdir>\n");
+      printf("       Converts a K&R style C file to ANSI or vice versa\n");
+      printf("       -k generates K&R form code from ANSI\n");
+      printf("       -p generates a set of prototypes\n");
+      printf("       -q quiet mode\n");
+      printf("       -b converts each pair of files in turn\n");
+      printf("       -0 reads NUL terminated pairs of file names from "
+             "stdin\n");
+      printf("       -i converts each file in place, only writing those "
+             "which change\n");
+      printf("       -e writes an edit script replacing just the "
+             "definitions which change\n");
+      printf("       -u writes the same changes as a unified diff\n");
+      printf("       -j number of threads; with -b and -0 this is the "
+             "number of files\n");
+      printf("          converted at once. Large files are also split "
+             "between them\n");
+      printf("       -c keeps conversions in dir and reuses them when the "
+             "input is the same\n");
+      printf("       -m evicts the least recently used when the cache "
+             "is over MB (default %d)\n", CACHEMAX);
+      printf("       -s with -p keeps each file's prototypes in db and "
+             "only converts files\n");
+      printf("          which have changed since\n");
+      printf("       -h with -p writes the prototypes of all the input "
+             "files to one header,\n");
+      printf("          each once and with static functions last. "
+             "Without -p, the files are\n");
+      printf("          converted and the header made from the same "
+             "reading of them\n");
+      printf("       -g groups them by file, -n sorts them by name and "
+             "-x leaves out static\n");
+      printf("       -f lists the definitions of a function kept in "
+             "db\n");
+      printf("       -d serves requests to convert buffers or files on a "
+             "Unix domain socket\n");
+      printf("       --stats reports the work done and time taken for "
+             "each file and in total\n");
+      printf("       --watch converts each .c file in srcdir to outdir "
+             "whenever it's saved\n");
+      printf("       --check lists the first definition in each file "
+             "which would be converted\n");
+      printf("       --apply makes the edits in scripts from -e (or one "
+             "on stdin)\n");
+      printf("       An input file of - means stdin and an output file "
+             "of - means stdout\n\n");
+      
+      /* Only asking for it (giving no arguments at all) isn't an error */
+      exit(bare ? 0 : 1);
+   }
+   else
+   {
+      /* V2.7: A single pair of files is a batch of one                 */
+      njobs = 1;
+      if((jobs = (JOB *)calloc(1, sizeof(JOB))) == NULL)
+      {
+         printf("No memory for file list\n");
+         exit(1);
+      }
+      jobs[0].in  = argv[0];
+      jobs[0].out = argv[1];
+   }
+
+   /* V2.9: Only one file can be read from stdin, and not if that's 
+      where the list came from. The signature store needs real files
+   */
+   for(i=0, nstdin=0; i<njobs; i++)
+   {
+      if(!strcmp(jobs[i].in, "-")) nstdin++;
+      if(inplace)
+      {
+         jobs[i].out     = jobs[i].in;
+         jobs[i].inplace = TRUE;
+      }
+      jobs[i].check = check;
+      if(edits)
+      {
+         jobs[i].out   = "-";
+         jobs[i].edits = TRUE;
+         jobs[i].diff  = diff;
+      }
+   }
+   if(nstdin > 1 || (nstdin && (nullist || sigpath != NULL || 
+                                header != NULL || inplace || check ||
+                                edits)))
+   {
+      printf("Only one input may be -, and not with -0, -s, -h, -i, -e, "
+             "-u or --check\n");
+      exit(1);
+   }
+   
+   /* V3.7: A check only lists what needs converting                    */
+   if(check) noisy = FALSE;
+
+   /* If anything is going to stdout, send the banner and cache 
+      statistics elsewhere
+   */
+   for(i=0; i<njobs; i++)
+   {
+      if(jobs[i].out != NULL && !strcmp(jobs[i].out, "-"))
+      {
+         fp_msg = stderr;
+         break;
+      }
+   }
+   if(noisy) 
+      Banner(fp_msg, mode, (batch || nullist) ? NULL : argv[0], njobs);
+
+   /* V2.7: Get the conversion cache ready                              */
+   if(cachedir != NULL)
+   {
+#ifdef POSIX_IO
+      if(!CacheOpen(&cache, cachedir, cachemax))
+      {
+         printf("Unable to use cache directory %s\n", cachedir);
+         exit(1);
+      }
+      pcache = &cache;
+#else
+      printf("-c is not available on this system\n");
+      exit(1);
+#endif
+   }
+
+   /* V2.8: Load the signature store                                    */
+   if(sigpath != NULL || header != NULL)
+   {
+#ifdef POSIX_IO
+      if(!SigOpen(&sigdb, sigpath))
+      {
+         printf("No memory to read signature store %s\n", sigpath);
+         exit(1);
+      }
+      psigdb = &sigdb;
+#else
+      printf("-s and -h are not available on this system\n");
+      exit(1);
+#endif
+   }
+
+   /* V3.0: Get ready to add up the statistics                         */
+   if(pstats != NULL)
+   {
+      memset(pstats, 0, sizeof(RUNSTATS));
+#ifdef THREADS
+      pthread_mutex_init(&pstats->lock, NULL);
+#endif
+   }
+
+   status = RunBatch(jobs, njobs, mode, nworkers, pcache, psigdb, pstats);
+   
+   /* V3.6: Say how many files were rewritten                           */
+   if(inplace && noisy)
+   {
+      for(i=0, nchanged=0; i<njobs; i++)
+      {
+         if(jobs[i].changed) nchanged++;
+      }
+      fprintf(fp_msg,"%d of %d files changed\n", nchanged, njobs);
+   }
+   
+   if(pstats != NULL)
+   {
+      if(pstats->files > 1) 
+         WriteStats(fp_msg, "Total", &pstats->total);
+#ifdef THREADS
+      pthread_mutex_destroy(&pstats->lock);
+#endif
+   }
+   
+#ifdef POSIX_IO
+   if(pcache != NULL) CacheClose(pcache, noisy ? fp_msg : NULL);
+   if(psigdb != NULL)
+   {
+      if(header != NULL && !SigHeader(psigdb, jobs, njobs, header, layout))
+      {
+         fprintf(fp_msg,"Error writing header %s\n", header);
+         status = 1;
+      }
+      if(!SigSave(psigdb))
+      {
+         fprintf(fp_msg,"Error writing signature store %s\n", sigpath);
+         status = 1;
+      }
+      SigClose(psigdb, noisy ? fp_msg : NULL);
+   }
+#endif
+   
+   exit(status);  /* V1.1, for VAX clean-ness                           */
+   return(0);
+}
+
+/************************************************************************/
+/*>void Banner(FILE *fp, int mode, char *file, int nfiles)
+   -------------------------------------------------------
+   Input:   FILE     *fp         Where to write the banner
+            int      mode        Processing mode
+            char     *file       File being processed (if only one), or
+                                 directory being watched
+            int      nfiles      Number of files being processed (0 if
+                                 watching)
+
+   Writes the program banner and says what we're about to do.
+
+   16.10.26 Original, split out of main()
+   16.10.26 Version number from VERSION
+   16.10.26 Says which directory is being watched
+*/
+void Banner(FILE *fp, int mode, char *file, int nfiles)
+{
+   fprintf(fp,"SciTech Software ansi C converter V%s\n", VERSION);
+   fprintf(fp,"Copyright (C) 1991 SciTech Software. All Rights Reserved.\n");
+   fprintf(fp,"This program is freely distributable providing no profit is made in so doing.\n\n");
+
+   if(nfiles == 0 && file != NULL)
+   {
+      fprintf(fp,"Watching %s\n",file);
+   }
+   else if(nfiles == 1 && file != NULL)
+   {
+      switch(mode)
+      {
+      case MakeANSI:
+         fprintf(fp,"Converting file %s to ANSI\n",file);
+         break;
+      case MakeKR:
+         fprintf(fp,"Converting file %s to Kernighan and Ritchie\n",file);
+         break;
+      case MakeProtos:
+         fprintf(fp,"Generating prototypes for file %s\n",file);
+         break;
+      default:
+         break;
+      }
+   }
+   else
+   {
+      switch(mode)
+      {
+      case MakeANSI:
+         fprintf(fp,"Converting %d files to ANSI\n",nfiles);
+         break;
+      case MakeKR:
+         fprintf(fp,"Converting %d files to Kernighan and Ritchie\n",
+                 nfiles);
+         break;
+      case MakeProtos:
+         fprintf(fp,"Generating prototypes for %d files\n",nfiles);
+         break;
+      default:
+         break;
+      }
+   }
+}
+#endif
+
+/************************************************************************/
+/*>int process_file(ctx, in, out)
+   -------------------------------
+   I/O:     ANSICTX  *ctx           Conversion context. ctx->mode gives
+                                    the processing mode.
                                     MakeANSI:   Create ANSI
                                     MakeKR:     Create K&R
                                     MakeProtos: Create prototypes
-   Returns: void
+            INFILE   *in            File to be processed
+            OUTBUF   *out           Output being created
+   Returns: int                     ANSI_OK or an error code
 
    Does the work of processing the file. Calls routines to see if this line is
    interesting. If so assembles the function or prototype definition. Calls
@@ -310,25 +1910,78 @@ int GetVarName(char *buffer, char *strparam)
 
    17.12.91 Original    By: ACRM
    18.03.92 Added buffer2 & call to KillComments()
+   16.10.26 Lines now come from GetLine() and are used in place when the
+            file is mapped. funcdef is a DEFLINES pointing at the lines.
+            Replaced buffer2/KillComments() with CodeHasChar()
+   16.10.26 The buffers and mode are now in the context
+   16.10.26 Takes an INFILE opened by the caller. Returns an error code
+            rather than calling exit()
+   16.10.26 No limit on the number of lines in a definition. Lines are
+            read with AddDefLine() and referenced as offsets so that 
+            the arena can grow
+   16.10.26 Each line is scanned once by LexLine() and the ( ; and { it
+            found are used rather than searching the line again
+   16.10.26 Writes to an OUTBUF
+   16.10.26 Unchanged lines are copied with PassLine()
+   16.10.26 Large files may be handed to SplitFile()
+   16.10.26 Notes each function converted with NoteFunction()
+   16.10.26 Sends the output at the end of each top-level construct 
+            when filtering
+   16.10.26 Counts lines, definitions, etc. and times conversions if 
+            statistics are being kept
+   16.10.26 When checking, writes nothing and stops at the first 
+            definition which would be converted, noting where it is
+   16.10.26 When writing edits, only writes and notes the definitions 
+            which change
 */
-void process_file(FILE *fp_in, FILE *fp_out, int mode)
+int process_file(ANSICTX *ctx, INFILE *in, OUTBUF *out)
 {
-   /* These are static so they're not placed on the stack. This lets
-      us run with the default stack size on the Amiga
-   */
-   static char buffer[MAXBUFF],
-               buffer2[MAXBUFF],             /* V1.4                    */
-               funcdef[MAXLINES][MAXBUFF];
-   int  i,
-        ndef;
+   DEFLINES *funcdef = &ctx->funcdef;
+   LINEINFO info;
+   int      mode     = ctx->mode;
+   BOOL     copy     = (BOOL)(mode != MakeProtos && !ctx->check && 
+                                 !ctx->edits);
+   OUTBUF   *protos   = (mode == MakeProtos) ? out :
+                        ctx->keepprotos ? &ctx->protos : NULL;
+   char     *line;
+   long     start;
+   size_t   outpos,
+            protopos  = 0;
+   double   wall     = 0.0,
+            cpu      = 0.0;
+   int      i,
+            len,
+            ndef,
+            status   = ANSI_OK;
    
-   while(fgets(buffer,MAXBUFF,fp_in))
-   {
-      terminate(buffer);
+#ifdef THREADS
+   /* V2.6: Convert a large file in pieces on several threads           */
+   if(ctx->nthreads > 1 && !in->streaming && !ctx->check &&
+      in->size - in->pos >= SPLITMIN && SplitFile(ctx, in, out, &status))
+      return(status);
+#endif
 
+   while(!out->error)
+   {
+      /* Anything read into the arena has been dealt with               */
+      ResetArena(in);
+      if(!GetLine(in, &start, &len)) break;
+      line = in->map + start;
+      StatCount(ctx, lines);
+      
+      /* Scan the line. This also starts a new set of tokens            */
+      ctx->ntok       = 0;
+      ctx->lastcode   = 0;
+      ctx->beforesemi = -1;
+      if((status = LexLine(ctx, line, start, len, LEX_AUTO, &info))
+         != ANSI_OK)
+         return(status);
+      
       /* See if this line is possibly a function definition             */
-      if(isInteresting(buffer))
+      if(info.interesting)
       {
+         StatCount(ctx, interesting);
+         
          /* It's one of:
             (a)   A function definition
             (b)   A prototype
@@ -338,98 +1991,110 @@ void process_file(FILE *fp_in, FILE *fp_out, int mode)
             a prototype.
          */
 
-         /* V1.4+: Previously would think the line was a function or
+         /* V1.4: Previously would think the line was a function or
             prototype if there was a ( in a comment on the same line
          */
-         strcpy(buffer2,buffer);
-         KillComments(buffer2);
-         /* V1.4-                                                       */
-         
-         if(strchr(buffer2,'(') != NULL)  /* V1.4 Test buffer2          */
+         if(info.paren >= 0)
          {
-            /* It's a function or a prototype. Copy it into funcdef
-               assembling additional strings up to the first ; or {
+            /* It's a function or a prototype. Assemble additional lines 
+               into funcdef up to the first ; or {
             */
-            strcpy(funcdef[0], buffer);
+            StatCount(ctx, candidates);
+            if((funcdef->maxlines == 0) && !GrowDefLines(funcdef))
+               return(ANSI_ENOMEM);
+            funcdef->base     = in->map;
+            funcdef->start[0] = start;
+            funcdef->len[0]   = len;
             ndef=0;
-            while(strchr(funcdef[ndef],';') == NULL  &&
-                  strchr(funcdef[ndef],'{') == NULL)
+            while(info.semi < 0 && info.brace < 0)
             {
-               if(!fgets(funcdef[++ndef],MAXBUFF,fp_in)) break;
-               terminate(funcdef[ndef]);
-               if(ndef >= MAXLINES)
-               {
-                  printf("Too many lines in function definition:\n");
-                  for(i=0; i<MAXLINES; i++)
-                     printf("%s\n",funcdef[i]);
-                  exit(1);
-               }
-               /* Pass the string to isInteresting() to update internal
-                  count of comments, brackets, etc. We don't care about
-                  the return value.
-               */
-               isInteresting(funcdef[ndef]);
+               if(!AddDefLine(ctx, in, ndef+1, &info, &status)) break;
+               ndef++;
             }
+            if(status != ANSI_OK) return(status);
 
-            if(isFunc(funcdef,ndef))
+            if(isFunc(ctx, &info))
             {
+               StatCount(ctx, accepted);
+               
                /* It's actually a function.
                   If it was terminated by a ; we must assemble up to
                   a {
                */
-               if(strchr(funcdef[ndef],';') != NULL  &&
-                  strchr(funcdef[ndef],'{') == NULL)
+               while(info.brace < 0)
+               {
+                  if(!AddDefLine(ctx, in, ndef+1, &info, &status)) break;
+                  ndef++;
+               }
+               if(status != ANSI_OK) return(status);
+               
+               /* V3.7: Checking, that's all we need. V3.9: Edits are 
+                  only wanted for definitions which change
+               */
+               if(ctx->check || ctx->edits)
                {
-                  while(strchr(funcdef[ndef],'{') == NULL)
+                  if(!NeedsConverting(ctx, ndef)) continue;
+                  if(ctx->check)
                   {
-                     if(!fgets(funcdef[++ndef],MAXBUFF,fp_in)) break;
-                     if(ndef >= MAXLINES)
-                     {
-                        printf("Too many lines in function definition:\n");
-                        for(i=0; i<MAXLINES; i++)
-                           printf("%s\n",funcdef[i]);
-                        exit(1);
-                     }
-                     terminate(funcdef[ndef]);
-                     /* Pass the string to isInteresting() to update 
-                        internal count of comments, brackets, etc. We 
-                        don't care about the return value.
-                     */
-                     isInteresting(funcdef[ndef]);
+                     ctx->checkat = start;
+                     break;
                   }
                }
                
                /* Now actually ANSIfy, deANSIfy, or generate prototypes.
-                  Output to fp_out
+                  Output to out. V3.0: Anything written meanwhile is 
+                  timed as writing, not converting
                */
+               if(Stats(ctx) != NULL)
+               {
+                  StatClock(&wall, &cpu);
+                  wall -= Stats(ctx)->stagewall[ANSI_STAGE_WRITE];
+                  cpu  -= Stats(ctx)->stagecpu[ANSI_STAGE_WRITE];
+               }
+               outpos = OutPos(out);
+               if(protos != NULL) protopos = OutPos(protos);
                switch(mode)
                {
                case MakeKR:
-                  DeAnsify(fp_out, funcdef, ndef);
+                  status = DeAnsify(ctx, out, funcdef, ndef);
                   break;
                case MakeANSI:
                case MakeProtos:
-                  Ansify(fp_out, funcdef, ndef, mode);
+                  status = Ansify(ctx, out, funcdef, ndef);
                   break;
                default:
-                  printf("Internal confusion!!!\n");
+                  Message(ctx,"Internal confusion!!!\n");
+                  status = ANSI_EMODE;
                   break;
                }
+               if(Stats(ctx) != NULL)
+                  StatStage(Stats(ctx), ANSI_STAGE_CONVERT, 
+                            wall + Stats(ctx)->stagewall[ANSI_STAGE_WRITE],
+                            cpu  + Stats(ctx)->stagecpu[ANSI_STAGE_WRITE]);
+               if(status != ANSI_OK) return(status);
+               
+               /* V2.8: Keep a note of it for AnsiFunctions()           */
+               if((ctx->keepfuncs || ctx->edits) &&
+                  !NoteFunction(ctx, in, funcdef, ndef, outpos, 
+                                OutPos(out), protopos, 
+                                (protos != NULL) ? OutPos(protos) : 0))
+                  return(ANSI_ENOMEM);
             }
             else
             {
                /* It's a prototype, so copy each line out               */
-               if(mode != MakeProtos)
+               StatCount(ctx, rejected);
+               if(copy)
                {
                   for(i=0; i<=ndef; i++)
-                     fprintf(fp_out,"%s\n",funcdef[i]);
+                     PassLine(in, out, funcdef->start[i], funcdef->len[i]);
                }
             }
          }
          else
          {
             /* It's an extern, so just copy it                          */
-            if(mode != MakeProtos) fprintf(fp_out,"%s\n",buffer);
+            if(copy) PassLine(in, out, start, len);
          }
       }
       else
@@ -437,240 +2102,1018 @@ void process_file(FILE *fp_in, FILE *fp_out, int mode)
          /* We're in a #, comment, string, function or blank line.
             Simply copy the line to the output file.
          */
-         if(mode != MakeProtos) fprintf(fp_out,"%s\n",buffer);
+         if(copy) PassLine(in, out, start, len);
       }
+
+#ifdef POSIX_IO
+      /* V2.9: Filtering from one pipe to another, send what we have at
+         the end of each top-level construct so the next program can get
+         on with it. If more input is already waiting, it waits too.
+      */
+      if(in->streaming && out->flush && out->len && !ctx->bra_count && 
+         !ctx->inComment && !ctx->quote && !ctx->inDirective && 
+         !InputWaiting(in))
+         OutSend(out, NULL, 0);
+#endif
    }
+   
+   if(in->nomem)                          return(ANSI_ENOMEM);
+   if(in->fp != NULL && ferror(in->fp))   return(ANSI_EREAD);
+   if(out->error)
+      return(out->memory ? ANSI_ENOMEM : ANSI_EWRITE);
+   return(status);
 }
 
+#ifdef THREADS
 /************************************************************************/
-/*>int isInteresting(char *buffer)
-   -------------------------------
-   Input:   char     *buffer     Line from file
-   Returns: int                  1: Line is interesting-may be a function
-                                 0: Line not interesting
+/*>BOOL SplitFile(ANSICTX *ctx, INFILE *in, OUTBUF *out, int *status)
+   ------------------------------------------------------------------
+   I/O:     ANSICTX  *ctx        Conversion context
+            INFILE   *in         Input, which must be mapped or in memory
+            OUTBUF   *out        Where the output goes
+   Output:  int      *status     ANSI_OK or an error code
+   Returns: BOOL                 FALSE if no threads could be started, in
+                                 which case nothing has been done
+
+   Converts a large file in pieces on up to ctx->nthreads threads, giving
+   exactly the output process_file() would.
+
+   This thread pre-scans the file with LexLine() keeping only the brace
+   count, etc. A piece may end after any line which closes the last open
+   brace outside a comment, string or # line. process_file() can't be 
+   part way through a definition there and it would start on the next 
+   line in the same state as a new context. As each piece of at least
+   CHUNKSIZE bytes is found it's handed to the workers, which convert it
+   just as though it were a file. Meanwhile the pieces which are ready 
+   are written out in order with their messages. Workers only get a few
+   pieces ahead of the output, so memory use doesn't grow with the file.
 
-   Tries to determine whether a line is possibly a function definition.
-   Does this by checking, on entry, that we're not a blank line, not in a 
-   comment, between double or single inverted commas and not already in a 
-   function definition.
+   16.10.26 Original
+   16.10.26 Notes how long it waits for the workers at the end
 */
-int isInteresting(char *buffer)
+BOOL SplitFile(ANSICTX *ctx, INFILE *in, OUTBUF *out, int *status)
 {
-   static int  comment_count  = 0,
-               bra_count      = 0,
-               inSIC          = 0,
-               inDIC          = 0;
+   SPLIT     split;
+   INFILE    view;
+   LINEINFO  info;
+   pthread_t *threads;
+   long      start,
+             last,
+             lastline;
+   double    wall = 0.0,
+             now,
+             cpu;
+   int       i,
+             len,
+             before,
+             nthreads = ctx->nthreads;
+   
+   /* Every piece but the last has at least CHUNKSIZE bytes             */
+   if(nthreads > (in->size - in->pos) / CHUNKSIZE)
+      nthreads = (int)((in->size - in->pos) / CHUNKSIZE);
+   
+   memset(&split, 0, sizeof(SPLIT));
+   split.ctx        = ctx;
+   split.in         = in;
+   split.maxpending = 2 * nthreads;
+   split.chunks     = (CHUNK *)calloc((in->size - in->pos) / CHUNKSIZE + 1,
+                                      sizeof(CHUNK));
+   threads          = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+   if(split.chunks == NULL || threads == NULL)
+   {
+      free(split.chunks);
+      free(threads);
+      return(FALSE);
+   }
    
-   int i,
-       retval  = 0,
-       isBlank = TRUE;
+   pthread_mutex_init(&split.lock, NULL);
+   pthread_cond_init(&split.cond, NULL);
+   for(i=0; i<nthreads; i++)
+   {
+      if(pthread_create(&threads[i], NULL, ChunkWorker, &split))
+         break;
+   }
+   
+   /* If we couldn't start any, the caller must do it all               */
+   if((nthreads = i) != 0)
+   {
+      /* Find the pieces, writing out any that are ready as we go       */
+      OpenBuffer(&view, in->map, (size_t)in->size);
+      view.pos  = last     = in->pos;
+      view.line = lastline = in->line;
+      while(split.status == ANSI_OK && GetLine(&view, &start, &len))
+      {
+         before = ctx->bra_count;
+         LexLine(ctx, view.map + start, start, len, LEX_STATE, &info);
+         
+         if(before > 0 && ctx->bra_count == 0 && !ctx->inComment &&
+            !ctx->quote && !ctx->inDirective && 
+            view.pos - last >= CHUNKSIZE && view.pos < view.size)
+         {
+            AddChunk(&split, last, view.pos, lastline);
+            last     = view.pos;
+            lastline = view.line;
+            WriteChunks(&split, out, FALSE);
+         }
+      }
+      if(split.status == ANSI_OK) 
+         AddChunk(&split, last, view.size, lastline);
+      
+      pthread_mutex_lock(&split.lock);
+      split.scanned = TRUE;
+      pthread_cond_broadcast(&split.cond);
+      pthread_mutex_unlock(&split.lock);
+      
+      /* Write out the rest and wait for the workers to finish. V3.0: 
+         The time this takes, less writing, is spent waiting
+      */
+      if(Stats(ctx) != NULL)
+      {
+         StatClock(&wall, &cpu);
+         wall -= Stats(ctx)->stagewall[ANSI_STAGE_WRITE];
+      }
+      WriteChunks(&split, out, TRUE);
+      for(i=0; i<nthreads; i++)
+         pthread_join(threads[i], NULL);
+      if(Stats(ctx) != NULL)
+      {
+         StatClock(&now, &cpu);
+         ctx->statwait = now - wall - 
+                         Stats(ctx)->stagewall[ANSI_STAGE_WRITE];
+      }
+      
+      in->pos  = in->size;
+      in->line = view.line;
+      *status  = split.status;
+   }
+   
+   pthread_mutex_destroy(&split.lock);
+   pthread_cond_destroy(&split.cond);
+   free(split.chunks);
+   free(threads);
+   
+   return((BOOL)(nthreads != 0));
+}
 
-   /* Not interested if it's a #define, etc.                            */
-   if(buffer[0] == '#') return(0);
+/************************************************************************/
+/*>void AddChunk(SPLIT *split, long start, long end, long line)
+   ------------------------------------------------------------
+   I/O:     SPLIT    *split      The file being converted
+   Input:   long     start       Offset of the start of the piece
+            long     end         Offset of the byte after it
+            long     line        Lines before it
 
-   /* If all of these are unset when we enter, we're interested         */
-   if(!bra_count && !inDIC && !inSIC && !comment_count) retval = 1;
+   Hands the next piece of the file to the workers.
 
-   /* If the first thing in this string was a comment we're no longer
-      interested.
-   */
-   for(i=0; buffer[i] && (buffer[i] == ' ' || buffer[i] == '\t'); i++);
-   if(buffer[i] == '/' && buffer[i+1] == '*') retval = 0;
+   16.10.26 Original
+   16.10.26 Added line
+*/
+void AddChunk(SPLIT *split, long start, long end, long line)
+{
+   CHUNK *chunk = &split->chunks[split->nchunks];
+   
+   /* Nobody looks at it until it's counted                             */
+   chunk->start = start;
+   chunk->end   = end;
+   chunk->line  = line;
+   
+   pthread_mutex_lock(&split->lock);
+   split->nchunks++;
+   pthread_cond_broadcast(&split->cond);
+   pthread_mutex_unlock(&split->lock);
+}
 
-   /* Step along the line                                               */
-   for(i=0; i<strlen(buffer); i++)
-   {
-      /* We're not interested in anything else if this is a
-         C++ style comment
-      */
-      if(buffer[i] == '/' && buffer[i+1] == '/') return(0);
+/************************************************************************/
+/*>void WriteChunks(SPLIT *split, OUTBUF *out, BOOL wait)
+   ------------------------------------------------------
+   I/O:     SPLIT    *split      The file being converted
+            OUTBUF   *out        Where the output goes
+   Input:   BOOL     wait        Wait for every piece found so far rather
+                                 than stopping at the first not ready
 
-      if(buffer[i] != ' ' && buffer[i] != '\t') isBlank = FALSE;
-      
-      /* See if we're moving into a string                              */
-      if((buffer[i] == DIC) && (comment_count==0) && !inSIC) toggle(inDIC);
-      if((buffer[i] == SIC) && (comment_count==0) && !inDIC) 
+   Writes out the converted pieces of a file in order, and adds their
+   messages and functions to the file's context. Once anything has 
+   failed, the rest are thrown away and the workers are told not to 
+   bother with them.
+
+   16.10.26 Original
+   16.10.26 Adds the functions, moved to where they are in the file
+   16.10.26 Adds the statistics
+   16.10.26 Moves the functions' lines too
+   16.10.26 Adds the prototypes kept
+*/
+void WriteChunks(SPLIT *split, OUTBUF *out, BOOL wait)
+{
+   OUTBUF   *protos = &split->ctx->protos;
+   CHUNK    *chunk;
+   char     *name;
+   size_t   base,
+            protobase,
+            len;
+   int      i;
+   
+   pthread_mutex_lock(&split->lock);
+   while(split->written < split->nchunks)
+   {
+      chunk = &split->chunks[split->written];
+      if(!chunk->done)
       {
-         toggle(inSIC);
+         if(!wait) break;
+         pthread_cond_wait(&split->cond, &split->lock);
+         continue;
       }
+      pthread_mutex_unlock(&split->lock);
       
-      /* If we're not in a string                                       */
-      if(!inDIC && !inSIC)
+      if(split->status == ANSI_OK && 
+         (split->status = chunk->status) == ANSI_OK)
       {
-         /* See if we're moving into a comment                          */
-         if((buffer[i] == '/') && (buffer[i+1] == '*')) comment_count++;
-         /* See if we're moving out of a comment                        */
-         if((buffer[i] == '*') && (buffer[i+1] == '/')) comment_count--;
-         
-         /* If we're not in a comment we must be in code.
-            Update the curly bracket count
-         */
-         if(!comment_count)
+         base      = OutPos(out);
+         protobase = (split->ctx->mode == MakeProtos) ? base 
+                                                      : OutPos(protos);
+         for(i=0, name=chunk->names; i<chunk->nfuncs; i++, name+=len+1)
          {
-            if(buffer[i] == '{') bra_count++;
-            if(buffer[i] == '}') bra_count--;
+            ANSIFUNC *func = &chunk->funcs[i];
+            
+            len = strlen(name);
+            if(!AddFunction(split->ctx, name, len, 
+                            (func->start < 0) ? -1 : func->start + 
+                                                     chunk->start,
+                            (func->end < 0)   ? -1 : func->end + 
+                                                     chunk->start,
+                            func->line + chunk->line,
+                            func->outpos + base, func->outlen,
+                            func->protolen ? func->protopos + protobase 
+                                           : 0, 
+                            func->protolen))
+            {
+               split->status = ANSI_ENOMEM;
+               break;
+            }
          }
+         
+         OutWrite(out, chunk->out, chunk->outlen);
+         if(chunk->protolen) 
+            OutWrite(protos, chunk->protos, chunk->protolen);
+         AddMessages(split->ctx, chunk->msgs, chunk->msglen);
+         if(out->error)
+            split->status = out->memory ? ANSI_ENOMEM : ANSI_EWRITE;
+         else if(protos->error)
+            split->status = ANSI_ENOMEM;
       }
+      if(Stats(split->ctx) != NULL)
+         StatMerge(&split->ctx->splitstat, &chunk->stats);
+      free(chunk->out);
+      free(chunk->msgs);
+      free(chunk->funcs);
+      free(chunk->names);
+      free(chunk->protos);
+      chunk->out = chunk->msgs = chunk->names = chunk->protos = NULL;
+      chunk->funcs = NULL;
+      
+      pthread_mutex_lock(&split->lock);
+      split->written++;
+      if(split->status != ANSI_OK) split->abort = TRUE;
+      pthread_cond_broadcast(&split->cond);
    }
-   
-   /* If it's a blank line, we're not interested                        */
-   if(isBlank) retval = 0;
-
-   return(retval);
+   pthread_mutex_unlock(&split->lock);
 }
-         
 
 /************************************************************************/
-/*>void Ansify(FILE *fp, char funcdef[][], int ndef, int mode)
-   -----------------------------------------------------------
-   Input:   FILE     *fp            File to create
-            char     funcdef[][]    Function definition lines
-            int      ndef           Number of definition lines
-            int      mode           Processing mode-generate ANSI or prototypes
-                                    MakeANSI:   Create ANSI
-                                    MakeProtos: Create prototypes
+/*>void *ChunkWorker(void *arg)
+   ----------------------------
+   Input:   void     *arg        The SPLIT for the file
 
-   If it's already ANSI, just writes it; otherwise assembles function into
-   a single buffer line, writes the function name and calls WriteANSI() to
-   write the definition of each variable.
+   Thread routine for SplitFile(). Converts pieces of the file with a 
+   context of its own until the pre-scan has finished and there are none
+   left, flagging each one as done.
 
-   17.12.91 Original    By: ACRM
-   21.01.92 Fixed call to WriteANSI()
-   19.02.92 Added call to KillComments()
+   16.10.26 Original
+   16.10.26 Keeps the functions found in each piece
+   16.10.26 Keeps the statistics for each piece
+   16.10.26 Keeps the prototypes for each piece
 */
-void Ansify(FILE *fp,
-            char funcdef[MAXLINES][MAXBUFF],
-            int ndef,
-            int mode)
+void *ChunkWorker(void *arg)
 {
-   int   i,
-         j,
-         width,
-         isANSI   = TRUE,
-         bufflen  = 0,
-         first    = TRUE;
-   char  *buffer  = NULL,
-         *bufptr,
-         *funptr,
-         temp[MAXBUFF],
-         func[MAXBUFF],
-         varname[80];
-   
-   ndef++;
+   SPLIT    *split = (SPLIT *)arg;
+   ANSICTX  *ctx;
+   CHUNK    *chunk;
+   BOOL     abort;
    
-   /* If none of the lines contains a ;, it's already ANSI              */
-   for(i=0; i<ndef; i++)
+   if((ctx = AnsiCreate(split->ctx->mode)) != NULL)
    {
-      if(strchr(funcdef[i], ';') != NULL)
-      {
-         isANSI = FALSE;
-         break;
-      }
+      ctx->scanner   = split->ctx->scanner;
+      ctx->scan      = split->ctx->scan;
+      ctx->keepfuncs = split->ctx->keepfuncs;
+      ctx->edits     = split->ctx->edits;
+      ctx->keepprotos = split->ctx->keepprotos;
+      AnsiKeepStats(ctx, Stats(split->ctx) != NULL);
    }
    
-   if(isANSI)
+   pthread_mutex_lock(&split->lock);
+   for(;;)
    {
-      /* It's already ANSI                                              */
-      if(mode == MakeANSI)
+      if(split->next < split->nchunks &&
+         split->next < split->written + split->maxpending)
       {
-         /* We're making ANSI, so just output it                        */
-         for(i=0; i<ndef; i++) fprintf(fp, "%s\n", funcdef[i]);
-      }
-      else  /* mode == makeProtos                                       */
-      {
-         /* We're making prototypes, just output, but put a ; instead
-            of a {
-         */
-         for(i=0; i<ndef; i++)
+         chunk = &split->chunks[split->next++];
+         abort = split->abort;
+         pthread_mutex_unlock(&split->lock);
+         
+         if(ctx == NULL)
          {
-            for(j=0; j<strlen(funcdef[i]); j++)
+            chunk->status = ANSI_ENOMEM;
+         }
+         else if(!abort)
+         {
+            chunk->status = AnsiConvertBuffer(ctx, 
+                                              split->in->map + chunk->start,
+                                              chunk->end - chunk->start,
+                                              &chunk->out, &chunk->outlen);
+            
+            /* Keep the messages and functions, since the context is 
+               used again
+            */
+            if((chunk->msglen = ctx->msglen) != 0)
             {
-               if(funcdef[i][j] != '{')
+               if((chunk->msgs = (char *)malloc(ctx->msglen)) == NULL)
+                  chunk->status = ANSI_ENOMEM;
+               else
+                  memcpy(chunk->msgs, ctx->msgs, ctx->msglen);
+            }
+            if((chunk->nfuncs = ctx->nfuncs) != 0)
+            {
+               chunk->funcs = (ANSIFUNC *)malloc(ctx->nfuncs * 
+                                                 sizeof(ANSIFUNC));
+               chunk->names = (char *)malloc(ctx->namelen);
+               if(chunk->funcs == NULL || chunk->names == NULL)
                {
-                  putc(funcdef[i][j], fp);
+                  chunk->nfuncs = 0;
+                  chunk->status = ANSI_ENOMEM;
                }
                else
                {
-                  putc(';', fp);
-                  i = ndef;
-                  break;
+                  memcpy(chunk->funcs, ctx->funcs, 
+                         ctx->nfuncs * sizeof(ANSIFUNC));
+                  memcpy(chunk->names, ctx->names, ctx->namelen);
                }
             }
-            putc('\n', fp);
+            if(ctx->keepprotos && (chunk->protolen = ctx->protos.len) != 0)
+            {
+               if((chunk->protos = (char *)malloc(ctx->protos.len)) 
+                  == NULL)
+               {
+                  chunk->protolen = 0;
+                  chunk->status   = ANSI_ENOMEM;
+               }
+               else
+               {
+                  memcpy(chunk->protos, ctx->protos.buffer, 
+                         ctx->protos.len);
+               }
+            }
+            if(Stats(ctx) != NULL) chunk->stats = *Stats(ctx);
          }
+         
+         pthread_mutex_lock(&split->lock);
+         chunk->done = TRUE;
+         pthread_cond_broadcast(&split->cond);
+      }
+      else if(split->scanned && split->next == split->nchunks)
+      {
+         break;
+      }
+      else
+      {
+         pthread_cond_wait(&split->cond, &split->lock);
       }
    }
-   else     /* It's not ANSI, so we convert it.                         */
+   pthread_mutex_unlock(&split->lock);
+   
+   AnsiDestroy(ctx);
+   return(NULL);
+}
+#endif
+
+/************************************************************************/
+/*>int LexLine(ANSICTX *ctx, char *line, long offset, int len, 
+               int tokens, LINEINFO *info)
+   -------------------------------------------------------------
+   I/O:     ANSICTX  *ctx        Context holding the brace count, whether
+                                 we are in a comment, etc. between lines,
+                                 and the tokens of the current definition
+   Input:   char     *line       Line from file (need not be terminated)
+            long     offset      Offset of the line in the input
+            int      len         Length of the line
+            int      tokens      LEX_TOKENS: Add the line's tokens to
+                                 ctx->tok
+                                 LEX_AUTO: Only if the line starts
+                                 outside any braces, comment, etc.
+                                 LEX_STATE: Never
+   Output:  LINEINFO *info       Where the first ( ; and { are in code and
+                                 whether the line is interesting
+   Returns: int                  ANSI_OK or ANSI_ENOMEM
+
+   Steps along a line once, keeping track of comments, strings, character
+   constants and braces. A line is interesting-may be a function 
+   definition-if, on entry, we're not in a comment, between double or 
+   single inverted commas, in a # line or already in a function 
+   definition, and it's not blank and doesn't start with a # or comment.
+
+   Tokens are identifiers, comments, string and character constants, and 
+   the punctuation ( ) { } ; , * [ ]. Anything else (numbers, operators,
+   etc.) is skipped. Tokens are kept for lines which might start a 
+   definition and the lines which follow while it's assembled, so the 
+   bodies of functions are never tokenised.
+
+   Strings and character constants end at the end of the line unless
+   it's continued with a \. Braces in # lines aren't counted.
+
+   Comments and strings, and code when we don't want the tokens, are
+   skipped a block at a time with the context's scanner. When we don't 
+   want the tokens only the brace count is kept up to date; the ( and ;
+   in info, and lastcode, are only needed for a definition.
+
+   16.10.26 Original
+   16.10.26 Skips runs of bytes which don't matter with ctx->scan
+   16.10.26 tokens may be LEX_STATE for SplitFile()'s pre-scan
+*/
+int LexLine(ANSICTX *ctx, char *line, long offset, int len, 
+            int tokens, LINEINFO *info)
+{
+   int   i,
+         j,
+         c,
+         from      = 0,
+         bra_count = ctx->bra_count,
+         quote     = ctx->quote,
+         lastcode  = ctx->lastcode;
+   BOOL  inComment = ctx->inComment,
+         directive = ctx->inDirective,
+         escaped   = FALSE;
+   TOKEN *tok      = NULL,
+         *ptr;
+   SCANFUNC scan   = ctx->scan;
+   
+   info->paren = info->semi = info->brace = -1;
+
+   /* If all of these are unset when we enter, we're interested         */
+   info->interesting = (!bra_count && !quote && !inComment && !directive);
+   if(tokens == LEX_STATE)
+      tokens = FALSE;
+   else if(info->interesting)
+      tokens = TRUE;
+   
+   /* Make sure there's room for every token the line could have        */
+   if(tokens)
    {
-      /* First allocate some memory                                     */
-      for(i=0; i<ndef; i++) bufflen += strlen(funcdef[i]);
-      bufflen += 2;
-      buffer = (char *)malloc(bufflen * sizeof(char));
-      buffer[0] = '\0';
+      if(ctx->ntok + len + 2 > ctx->maxtok)
+      {
+         int n = ctx->maxtok ? 2*ctx->maxtok : TOKENS0;
+         if(n < ctx->ntok + len + 2) n = ctx->ntok + len + 2;
+         if((ptr = (TOKEN *)realloc(ctx->tok, n*sizeof(TOKEN))) == NULL)
+            return(ANSI_ENOMEM);
+         ctx->tok    = ptr;
+         ctx->maxtok = n;
+      }
+      tok = ctx->tok + ctx->ntok;
+   }
+
+   /* Find the first non-blank character. If there isn't one, or it's a 
+      # or a comment, we're not interested
+   */
+   for(i=0; i<len && isSpace(line[i]); i++) ;
+   if(i == len)
+   {
+      info->interesting = FALSE;
+   }
+   else if(!inComment && !quote)
+   {
+      if(line[i] == '#')
+      {
+         directive         = TRUE;
+         info->interesting = FALSE;
+      }
+      else if(line[i] == '/' && i+1<len && 
+              (line[i+1] == '*' || line[i+1] == '/'))
+      {
+         info->interesting = FALSE;
+      }
+   }
+
+   /* Step along the line                                               */
+   for( ; i<len; i++)
+   {
+      /* In a comment, only the end of it matters                       */
+      if(inComment)
+      {
+         if((i += (*scan)(line+i, len-i, SC_COMMENT)) >= len) break;
+         if(i+1<len && line[i+1] == '/')
+         {
+            inComment = FALSE;
+            i++;
+            if(tokens)
+            {
+               tok->start = offset + from;
+               tok->len   = i + 1 - from;
+               (tok++)->type = TK_COMMENT;
+            }
+            from = i + 1;
+         }
+         continue;
+      }
+
+      /* In a string, skip escaped characters and look for the end      */
+      if(quote)
+      {
+         if((i += (*scan)(line+i, len-i, (quote == DIC) ? SC_DIC : SC_SIC))
+            >= len) break;
+         if(line[i] == '\\')
+         {
+            if(i+1 == len) escaped = TRUE;
+            i++;
+         }
+         else
+         {
+            if(tokens)
+            {
+               tok->start = offset + from;
+               tok->len   = i + 1 - from;
+               (tok++)->type = (quote == DIC) ? TK_STRING : TK_CHAR;
+            }
+            lastcode = quote;
+            quote    = 0;
+         }
+         continue;
+      }
+
+      /* Unless we want the tokens, skip to the next byte which matters */
+      if(!tokens && (i += (*scan)(line+i, len-i, SC_CODE)) >= len) break;
+      c = line[i];
+
+      switch(c)
+      {
+      case '/':
+         if(i+1<len && line[i+1] == '*')
+         {
+            /* Start of a comment                                       */
+            inComment = TRUE;
+            from      = i++;
+            continue;
+         }
+         if(i+1<len && line[i+1] == '/')
+         {
+            /* C++ comment to the end of the line                       */
+            if(tokens)
+            {
+               tok->start = offset + i;
+               tok->len   = len - i;
+               (tok++)->type = TK_COMMENT;
+            }
+            i = len;
+            continue;
+         }
+         lastcode = c;
+         continue;
+      case DIC:
+      case SIC:
+         quote = c;
+         from  = i;
+         continue;
+      case '{':
+         if(!directive)
+         {
+            bra_count++;
+            if(info->brace < 0) info->brace = i;
+         }
+         break;
+      case '}':
+         if(!directive) bra_count--;
+         break;
+      case '(':
+         if(info->paren < 0) info->paren = i;
+         break;
+      case ';':
+         if(info->semi < 0) info->semi = i;
+         if(ctx->beforesemi < 0) ctx->beforesemi = lastcode;
+         break;
+      case ')':
+      case ',':
+      case '*':
+      case '[':
+      case ']':
+         break;
+      default:
+         if(isSpace(c)) continue;
+         if(isIdentStart(c))
+         {
+            for(j=i+1; j<len && isIdentChar(line[j]); j++) ;
+            if(tokens)
+            {
+               tok->start = offset + i;
+               tok->len   = j - i;
+               (tok++)->type = TK_IDENT;
+            }
+            i = j - 1;
+         }
+         else if(isdigit((unsigned char)c))
+         {
+            /* Skip the rest of a number so it doesn't look like an
+               identifier
+            */
+            while(i+1<len && (isIdentChar(line[i+1]) || line[i+1] == '.'))
+               i++;
+         }
+         lastcode = line[i];
+         continue;
+      }
+
+      /* Punctuation token                                              */
+      if(tokens)
+      {
+         tok->start = offset + i;
+         tok->len   = 1;
+         (tok++)->type = c;
+      }
+      lastcode = c;
+   }
+
+   /* Keep the part of a comment or string which runs on to the next 
+      line. A string only does so if the line ends with a \
+   */
+   if(tokens && (inComment || quote) && from < len)
+   {
+      tok->start = offset + from;
+      tok->len   = len - from;
+      (tok++)->type = inComment ? TK_COMMENT : 
+                      ((quote == DIC) ? TK_STRING : TK_CHAR);
+   }
+   if(!escaped) quote = 0;
+   
+   if(tokens) ctx->ntok = tok - ctx->tok;
+   ctx->bra_count   = bra_count;
+   ctx->quote       = quote;
+   ctx->lastcode    = lastcode;
+   ctx->inComment   = inComment;
+   ctx->inDirective = directive && len && line[len-1] == '\\';
+
+   return(ANSI_OK);
+}
+
+/************************************************************************/
+/*>int ScanScalar(const char *buffer, int len, int set)
+   ----------------------------------------------------
+   Input:   const char *buffer   Bytes to scan
+            int        len       Number of bytes
+            int        set       SC_CODE, SC_COMMENT, SC_DIC or SC_SIC
+   Returns: int                  Offset of the first byte in the set, or
+                                 len if there isn't one
+
+   Finds the next byte which LexLine() must look at, a byte at a time.
+   Used where there is no SIMD scanner and for the ends of short lines.
+
+   16.10.26 Original
+*/
+int ScanScalar(const char *buffer, int len, int set)
+{
+   int   i,
+         bit = 1 << set;
+   
+   for(i=0; i<len && !(ScanClass[(unsigned char)buffer[i]] & bit); i++) ;
+   
+   return(i);
+}
+
+#ifdef SIMD_X86
+/************************************************************************/
+/*>int ScanSSE2(const char *buffer, int len, int set)
+   --------------------------------------------------
+   Input:   const char *buffer   Bytes to scan
+            int        len       Number of bytes
+            int        set       SC_CODE, SC_COMMENT, SC_DIC or SC_SIC
+   Returns: int                  Offset of the first byte in the set, or
+                                 len if there isn't one
+
+   As ScanScalar() but compares 16 bytes at a time with each byte in the 
+   set. The last block overlaps the one before rather than finishing a 
+   byte at a time.
+
+   16.10.26 Original
+*/
+__attribute__((target("sse2")))
+int ScanSSE2(const char *buffer, int len, int set)
+{
+   const char  *chars = ScanSet[set];
+   int         nchars = ScanSetLen[set],
+               i,
+               k;
+   unsigned    mask;
+   __m128i     want[8],
+               data,
+               hit;
+   
+   if(len < 16) return(ScanScalar(buffer, len, set));
+   
+   for(k=0; k<nchars; k++) want[k] = _mm_set1_epi8(chars[k]);
+   
+   for(i=0; ; i+=16)
+   {
+      /* The last block ends at the end of the buffer                   */
+      if(i > len-16) i = len-16;
       
-      /* Now build all the strings into the single buffer               */
-      for(i=0; i<ndef; i++) strcat(buffer, funcdef[i]);
+      data = _mm_loadu_si128((const __m128i *)(buffer+i));
+      hit  = _mm_cmpeq_epi8(data, want[0]);
+      for(k=1; k<nchars; k++)
+         hit = _mm_or_si128(hit, _mm_cmpeq_epi8(data, want[k]));
       
-      /* V1.3
-         Remove comments
-      */
-      KillComments(buffer);
+      if((mask = (unsigned)_mm_movemask_epi8(hit)) != 0)
+         return(i + __builtin_ctz(mask));
+      if(i == len-16) break;
+   }
+   
+   return(len);
+}
+
+/************************************************************************/
+/*>int ScanAVX2(const char *buffer, int len, int set)
+   --------------------------------------------------
+   Input:   const char *buffer   Bytes to scan
+            int        len       Number of bytes
+            int        set       SC_CODE, SC_COMMENT, SC_DIC or SC_SIC
+   Returns: int                  Offset of the first byte in the set, or
+                                 len if there isn't one
+
+   As ScanSSE2() but 32 bytes at a time.
+
+   16.10.26 Original
+*/
+__attribute__((target("avx2")))
+int ScanAVX2(const char *buffer, int len, int set)
+{
+   const char  *chars = ScanSet[set];
+   int         nchars = ScanSetLen[set],
+               i,
+               k;
+   unsigned    mask;
+   __m256i     want[8],
+               data,
+               hit;
+   
+   if(len < 32) return(ScanSSE2(buffer, len, set));
+   
+   for(k=0; k<nchars; k++) want[k] = _mm256_set1_epi8(chars[k]);
+   
+   for(i=0; ; i+=32)
+   {
+      /* The last block ends at the end of the buffer                   */
+      if(i > len-32) i = len-32;
+      
+      data = _mm256_loadu_si256((const __m256i *)(buffer+i));
+      hit  = _mm256_cmpeq_epi8(data, want[0]);
+      for(k=1; k<nchars; k++)
+         hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(data, want[k]));
+      
+      if((mask = (unsigned)_mm256_movemask_epi8(hit)) != 0)
+         return(i + __builtin_ctz(mask));
+      if(i == len-32) break;
+   }
+   
+   return(len);
+}
+#endif
+
+/************************************************************************/
+/*>SCANNER *FindScanner(const char *name)
+   --------------------------------------
+   Input:   const char *name     Name of a scanner, or NULL for the best
+   Returns: SCANNER *            The scanner (NULL if the name is unknown
+                                 or this processor can't run it)
+
+   Looks up a scanner, checking that the processor supports it.
+
+   16.10.26 Original
+*/
+SCANNER *FindScanner(const char *name)
+{
+   SCANNER  *scanner;
+   
+   for(scanner=Scanners; scanner->name != NULL; scanner++)
+   {
+      if(name != NULL && strcmp(name, scanner->name)) continue;
+#ifdef SIMD_X86
+      if(scanner->func == ScanAVX2 && !__builtin_cpu_supports("avx2"))
+         continue;
+      if(scanner->func == ScanSSE2 && !__builtin_cpu_supports("sse2"))
+         continue;
+#endif
+      return(scanner);
+   }
+   return(NULL);
+}
+
+/************************************************************************/
+/*>int Ansify(ANSICTX *ctx, OUTBUF *out, DEFLINES *funcdef, int ndef)
+   -------------------------------------------------------------------
+   Input:   ANSICTX  *ctx           Conversion context. ctx->mode is the
+                                    processing mode-generate ANSI or 
+                                    prototypes
+                                    MakeANSI:   Create ANSI
+                                    MakeProtos: Create prototypes
+                                    ctx->tok has the definition's tokens
+            OUTBUF   *out           Output being created
+            DEFLINES *funcdef       Function definition lines
+            int      ndef           Number of definition lines
+   Returns: int                     ANSI_OK or ANSI_ENOMEM
 
-      /* Copy the function part into func                               */
-      for(i=0; buffer[i] != ')'; i++) func[i] = buffer[i];
-      func[i]     = ')';
-      func[i+1]   = '\0';
+   If it's already ANSI, just writes it; otherwise assembles function into
+   a single buffer line, writes the function name and calls WriteANSI() to
+   write the definition of each variable. When making ANSI with 
+   ctx->keepprotos, the prototype goes to ctx->protos at the same time:
+   the parameter list is written there once and copied to out, so the 
+   two only differ in how they end.
+
+   17.12.91 Original    By: ACRM
+   21.01.92 Fixed call to WriteANSI()
+   19.02.92 Added call to KillComments()
+   16.10.26 funcdef is now a DEFLINES. Mode comes from the context.
+            Returns ANSI_OK or ANSI_ENOMEM
+   16.10.26 Work space comes from GetScratch() and is sized from the
+            definition rather than being MAXBUFF
+   16.10.26 Uses the tokens from LexLine() to find the ; { and parameter
+            list. StripComments() replaces KillComments()
+   16.10.26 Writes to an OUTBUF. Pads with OutPad()
+   16.10.26 Finds the K&R declarations with ParseDecls()
+   16.10.26 Uses isKRDef()
+   16.10.26 Writes the definition and its prototype together when
+            ctx->keepprotos is set
+*/
+int Ansify(ANSICTX  *ctx,
+           OUTBUF   *out,
+           DEFLINES *funcdef,
+           int      ndef)
+{
+   TOKEN  *tok    = ctx->tok,
+          *end    = ctx->tok + ctx->ntok,
+          *lparen,
+          *rparen;
+   OUTBUF *def    = (ctx->mode == MakeANSI)   ? out : NULL,
+          *proto  = (ctx->mode == MakeProtos) ? out : 
+                    ctx->keepprotos ? &ctx->protos : NULL,
+          *head;
+   size_t headpos = 0;
+   int    i,
+          width,
+          from,
+          to,
+          isANSI,
+          bufflen = 0,
+          first   = TRUE;
+   char   *buffer = NULL,
+          *bufptr,
+          *varname;
+   
+   ndef++;
+   
+   /* If none of the lines contains a ;, it's already ANSI              */
+   isANSI = !isKRDef(ctx);
+   
+   if(isANSI)
+   {
+      /* It's already ANSI                                              */
+      if(def != NULL)
+      {
+         /* We're making ANSI, so just output it                        */
+         for(i=0; i<ndef; i++) 
+            PassLine(&ctx->in, def, funcdef->start[i], funcdef->len[i]);
+      }
+      if(proto != NULL)
+      {
+         /* We're making prototypes, just output, but put a ; instead
+            of a {
+         */
+         for(tok=ctx->tok; tok<end && tok->type != '{'; tok++) ;
+         for(i=0; i<ndef; i++)
+         {
+            if(tok<end && tok->start < funcdef->start[i] + funcdef->len[i])
+            {
+               OutWrite(proto, DEFLINE(funcdef,i), 
+                        tok->start - funcdef->start[i]);
+               OutString(proto, ";\n");
+               break;
+            }
+            PassLine(&ctx->in, proto, funcdef->start[i], funcdef->len[i]);
+         }
+      }
+   }
+   else     /* It's not ANSI, so we convert it.                         */
+   {
+      /* Find the parameter list. The first line had a ( in code so 
+         there is always one. If there's no ) leave it alone
+      */
+      for(lparen=ctx->tok; lparen->type != '('; lparen++) ;
+      for(rparen=lparen; rparen<end && rparen->type != ')'; rparen++) ;
+      if(rparen == end)
+      {
+         for(i=0; i<ndef; i++) 
+         {
+            if(def != NULL)
+               PassLine(&ctx->in, def, funcdef->start[i], funcdef->len[i]);
+            if(proto != NULL)
+               PassLine(&ctx->in, proto, funcdef->start[i], 
+                        funcdef->len[i]);
+         }
+         return(ANSI_OK);
+      }
+      StatCount(ctx, converted);
       
-      /* Find the first (, copy up to here and print it                 */
-      for(i=0; func[i] != '('; i++) temp[i] = func[i];
-      temp[i]     = '(';
-      temp[i+1]   = '\0';
-      width       = strlen(temp);
-      fprintf(fp,"%s",temp);
+      /* First get some memory. None of the pieces can be longer than
+         the whole definition
+      */
+      for(i=0; i<ndef; i++) bufflen += funcdef->len[i];
+      bufflen += 2;
+      if((buffer = GetScratch(ctx, 2 * bufflen)) == NULL)
+         return(ANSI_ENOMEM);
+      varname = buffer + bufflen;
       
-      /* Set bufptr to point to the buffer excluding the function def   */
-      bufptr = strchr(buffer, ')') + 1;
+      /* Now build all the strings into the single buffer. V1.3: Without
+         comments
+      */
+      StripComments(ctx, funcdef, ndef, buffer);
+
+      /* The parameter list goes to the prototype if there is one. 
+         V4.1: If there's a definition too, it's copied from there, so
+         anything waiting in it must be written first
+      */
+      head = (proto != NULL) ? proto : def;
+      if(def != NULL && proto != NULL)
+      {
+         if(!OutFlush(proto)) return(ANSI_ENOMEM);
+         headpos = proto->len;
+      }
+
+      /* Print up to and including the first (                          */
+      width = lparen->clean + 1;
+      OutWrite(head, buffer, width);
       
-      /* Set funptr to point to start of parameter list                 */
-      funptr = strchr(func, '(') + 1;
+      /* Set bufptr to point to the buffer excluding the function def.
+         V3.1: Find the declarations in it
+      */
+      bufptr = buffer + rparen->clean + 1;
+      if(ParseDecls(ctx, bufptr) != ANSI_OK) return(ANSI_ENOMEM);
       
-      /* Step through the parameter list getting a parameter at a time  */
+      /* Step through the parameter list getting a parameter at a time.
+         Each ends at a , or the )
+      */
+      from  = width;
       first = TRUE;
-      while(*funptr && *funptr != ')')
+      for(tok=lparen+1; tok<=rparen; tok++)
       {
+         if(tok->type != ',' && tok->type != ')') continue;
+         
+         /* Get a parameter without leading or trailing spaces          */
+         to = tok->clean;
+         while(from < to && isSpace(buffer[from])) from++;
+         while(to > from && isSpace(buffer[to-1])) to--;
+         if(from == to && tok == rparen) break;
+         memcpy(varname, buffer+from, to-from);
+         varname[to-from] = '\0';
+         from = tok->clean + 1;
+         
          if(!first)
          {
-            fprintf(fp,",\n");
-            for(i=0;i<width;i++) fprintf(fp," ");
+            OutString(head, ",\n");
+            OutPad(head, ' ', width);
          }
          first = FALSE;
-         /* Kill spaces                                                 */
-         for( ; funptr && (*funptr == ' ' || *funptr == '\t'); funptr++) ;
-         /* Get a parameter                                             */
-         funptr += GetVarName(funptr, varname) + 1;
+         
          /* Write the ANSI version                                      */
-         if(WriteANSI(fp, varname, bufptr))   /* V1.1                   */
+         if(WriteANSI(ctx, head, varname, bufptr))  /* V1.1              */
          {
             /* Returns 1, if there was a problem                        */
-            temp[strlen(temp)-1] = '\0';
-            printf("   %s()\n",temp);
+            Message(ctx,"   %.*s()\n",width-1,buffer);
          }
       }
       
-      if(mode == MakeANSI)
-         fprintf(fp,")\n{\n");
-      else  /* mode == MakeProtos                                       */
-         fprintf(fp,");\n");
-      
-      /* Free memory                                                    */
-      free(buffer);
+      if(def != NULL && proto != NULL)
+      {
+         if(proto->error) return(ANSI_ENOMEM);
+         OutWrite(def, proto->buffer + headpos, proto->len - headpos);
+      }
+      if(def != NULL)
+         OutString(def, ")\n{\n");
+      if(proto != NULL)
+         OutString(proto, ");\n");
    }
+   
+   return(ANSI_OK);
 }
 
 /************************************************************************/
-/*>int WriteANSI(FILE *fp, char *varname, char *definitions)
-   ---------------------------------------------------------
-   Input:   FILE     *fp            File being written
+/*>int WriteANSI(ANSICTX *ctx, OUTBUF *out, char *varname, 
+                  char *definitions)
+   -----------------------------------------------------------
+   Input:   ANSICTX  *ctx           Conversion context for messages and
+                                    the table from ParseDecls()
+            OUTBUF   *out           Output being written
             char     *varname       Variable name being processed
             char     *definitions   Assembled KR definitions.
    Returns: int                     0: if all OK; 1: if a problem
@@ -683,149 +3126,86 @@ void Ansify(FILE *fp,
    14.02.92 Added calls to FindVarName()
    19.02.92 Changed step back since comments have been removed by
             KillComments()
+   16.10.26 Messages are held in the context
+   16.10.26 Writes the type and array size straight from definitions 
+            rather than copying them to a MAXBUFF buffer
+   16.10.26 Writes to an OUTBUF
+   16.10.26 Searches with FindParam() so they can be counted
+   16.10.26 The type, *'s and array size come from FindDecl() rather 
+            than three searches of definitions
 */
-int WriteANSI(FILE *fp,
-              char *varname,
-              char *definitions)
+int WriteANSI(ANSICTX *ctx,
+              OUTBUF  *out,
+              char    *varname,
+              char    *definitions)
 {
-   char  *start,
-         *stop,
-         *ptr,
-         buffer[MAXBUFF];
-   int   i;
-        
-/*** Find the variable type                                           ***/
-
-   /* Set these to the position of varname in the definitions list      */
-   start = stop = FindVarName(definitions, varname);  /* V1.2           */
+   PARAMDECL   *decl,
+               found;
    
-   if(!start)
+   if((decl = FindDecl(ctx, definitions, varname, &found)) == NULL)
    {
-      printf("Parameter `%s' was not found in definitions for function:\n",
-             varname);
+      Message(ctx,
+              "Parameter `%s' was not found in definitions for function:\n",
+              varname);
       return(1);
    }
    
-   /* Step start back to the start of the list, or the preceeding ;     */
-/***V1.3+
-//   while(start > definitions && *start != ';' && *start != '/') start--;
-//   if(*start == ';' || *start == '/') start++;
-*/
-   while(start > definitions && *start != ';') start--;
-   if(*start == ';') start++;
-
-/***V1.3-                                                               */
-   
-   /* Kill any leading spaces                                           */
-   while(*start && (*start == ' ' || *start == '\t')) start++;
-   
-   /* If there are any commas between start and stop, move stop
-      back to the first comma
-   */
-   for(ptr=start; ptr<=stop; ptr++)
-   {
-      if(*ptr == ',')
-      {
-         stop = ptr;
-         break;
-      }
-   }
-   
-   /* Step stop on to the first , or ;                                  */
-   while(*stop && *stop != ',' && *stop != ';') stop++;
-
-   /* Now step back over any spaces                                     */
-   stop--;
-   while(stop > start && (*stop == ' ' || *stop == '\t')) stop--;
-   
-   /* Now step back over the first variable name                        */
-   while(stop > start && *stop != ' ' && *stop != '\t') stop--;
-   
-   /* and over the spaces preceeding it                                 */
-   while(stop > start && (*stop == ' ' || *stop == '\t')) stop--;
-   
-   /* Now copy the string delimited by start and stop                   */
-   for(i=0; i<MAXBUFF && start <= stop; i++, start++)
-      buffer[i] = *start;
-
-   /* Terminate and print it                                            */
-   buffer[i] = '\0';
-   fprintf(fp,"%s ",buffer);
-   
-/*** Now print the variable name with *'s if appropriate              ***/
-
-   /* Set this to the position of varname in the definitions list       */
-   start = FindVarName(definitions, varname);  /* V1.2                  */
-   
-   /* Step start back to the first non-space character                  */
-   start--;
-   while(start > definitions && (*start == ' ' || *start == '\t')) 
-      start--;
-   
-   while(*(start--) == '*')
-      fprintf(fp,"*");
-
-   fprintf(fp,"%s",varname);
-   
-/*** Finally see if it's a [] array                                   ***/
-   /* Set these to the position of varname in the definitions list      */
-   start = stop = FindVarName(definitions, varname);  /* V1.2           */
-
-   /* Step stop on to the first , or ;                                  */
-   while(*stop && *stop != ',' && *stop != ';') stop++;
-
-   /* Now step back over any spaces                                     */
-   stop--;
-   while(stop > start && (*stop == ' ' || *stop == '\t')) stop--;
-   
-   /* See if there is a [ between start and stop                        */
-   while(start<stop && *start != '[') start++;
-   
-   /* If a [ was found copy and print the string                        */
-   if(start < stop)
-   {
-      for(i=0; i<MAXBUFF && start <= stop; i++, start++)
-         buffer[i] = *start;
-
-      /* Terminate and print it                                         */
-      buffer[i] = '\0';
-      fprintf(fp,"%s",buffer);
-   }
+   /* The type, the name with *'s if appropriate, and any [] array      */
+   if(decl->typelen) OutWrite(out, definitions + decl->type, decl->typelen);
+   OutString(out, " ");
+   OutPad(out, '*', decl->stars);
+   OutWrite(out, varname, strlen(varname));
+   if(decl->arraylen) 
+      OutWrite(out, definitions + decl->array, decl->arraylen);
    
    return(0);  /* V1.1, all OK                                          */
 }
 
 /************************************************************************/
-/*>char *FindString(char *buffer, char *string)
-   --------------------------------------------
+/*>char *FindVarName(char *buffer, char *string)
+   ---------------------------------------------
    Input:   char     *buffer        Buffer being searched
             char     *string        String to search for
    Returns: *char                   Pointer to start of string in buffer
 
-   Searches for a string in another string returning a pointer to the start
-   of the string.
+   Searches for a string in another string returning a pointer to the 
+   start of the string, with the additional condition that the string 
+   must be preceded by a space or * and must be followed by one of
+   space ; [ ) or ,
 
-   17.12.91 Original    By: ACRM
+   14.02.92 Original   By: ACRM
+   16.10.26 Length of string found once
+   16.10.26 Described in full now that FindString() is gone
 */
-char *FindString(char *buffer, char *string)
+char *FindVarName(char *buffer, char *string)
 {
    char  *ptr;
-   int   ok = FALSE,
+   int   ok  = FALSE,
+         len = (int)strlen(string),
          i;
    
    ptr = buffer;
    
    while(!ok)
    {
-      /* Step ptr along buffer till we find first character of string   */
-      while(*ptr && *ptr != *string) ptr++;
-
+      /* Step ptr along buffer till we find first character of string with
+         a space or * before it.
+      */
+      ptr--;
+      do
+      {
+         ptr++;
+         while(*ptr && *ptr != *string) ptr++;
+      }  while(*ptr && *(ptr-1) != ' ' && 
+                       *(ptr-1) != '*' && 
+                       *(ptr-1) != ',');
+
       /* Return NULL if we didn't find it                               */
       if(*ptr == '\0') return((char *)NULL);
       
       /* Now compare the rest of the string                             */
       ok = TRUE;
-      for(i=0; i<strlen(string); i++)
+      for(i=0; i<len; i++)
       {
          if(ptr[i] != string[i])
          {
@@ -833,420 +3213,6927 @@ char *FindString(char *buffer, char *string)
             break;
          }
       }
+      
+      /* Check the character after the string                           */
+      if(*(ptr+i) != ';' && *(ptr+i) != '[' && 
+         *(ptr+i) != ' ' && *(ptr+i) != ')' && *(ptr+i) != ',') 
+         ok = FALSE;
+
       ptr++;
    }
    return(--ptr);
 }
 
 /************************************************************************/
-/*>char *FindVarName(char *buffer, char *string)
-   ---------------------------------------------
-   Input:   char     *buffer        Buffer being searched
-            char     *string        String to search for
-   Returns: *char                   Pointer to start of string in buffer
+/*>int ParseDecls(ANSICTX *ctx, char *definitions)
+   -----------------------------------------------
+   I/O:     ANSICTX  *ctx           Conversion context. The table of
+                                    declarations is filled in
+   Input:   char     *definitions   Assembled KR definitions
+   Returns: int                     ANSI_OK or ANSI_ENOMEM
+
+   Goes through the K&R definitions once, finding every name which 
+   FindVarName() could find: one which follows a space, * or , and is 
+   followed by one of space ; [ ) or ,. What WriteANSI() needs for each
+   is kept in a table hashed on the name. Only the first of each name is
+   kept, since that's the one FindVarName() finds.
+
+   The type is the same for every name in a statement (up to a ;) so is
+   only worked out once for each.
+
+   16.10.26 Original
+*/
+int ParseDecls(ANSICTX *ctx, char *definitions)
+{
+   PARAMDECL   *decl;
+   int         len  = (int)strlen(definitions),
+               stmt = 0,
+               type = 0,
+               typelen = -1,
+               size,
+               bucket,
+               i,
+               j;
+   
+   ctx->ndecl = 0;
+   
+   /* Buckets for as many names as there could be                       */
+   for(size=16; size<len/4; size*=2) ;
+   if(size > ctx->hashsize)
+   {
+      int *ptr;
+      if((ptr = (int *)realloc(ctx->declhash, size * sizeof(int))) == NULL)
+         return(ANSI_ENOMEM);
+      ctx->declhash = ptr;
+      ctx->hashsize = size;
+   }
+   for(i=0; i<ctx->hashsize; i++) ctx->declhash[i] = -1;
+   if(Stats(ctx) != NULL) Stats(ctx)->findbytes += len;
+   
+   for(i=0; i<len; i++)
+   {
+      if(definitions[i] == ';')
+      {
+         stmt    = i+1;
+         typelen = -1;
+         continue;
+      }
+      
+      /* A name starts here if it follows a space, * or ,               */
+      if(i == 0 || !isIdentChar(definitions[i]) || 
+         (definitions[i-1] != ' ' && definitions[i-1] != '*' && 
+          definitions[i-1] != ','))
+         continue;
+      for(j=i+1; isIdentChar(definitions[j]); j++) ;
+      if(definitions[j] != ';' && definitions[j] != '[' && 
+         definitions[j] != ' ' && definitions[j] != ')' && 
+         definitions[j] != ',')
+      {
+         i = j-1;
+         continue;
+      }
+      
+      /* Skip it if we already have it                                  */
+      bucket = (int)(HashName(definitions+i, j-i) & (ctx->hashsize-1));
+      for(decl = (ctx->declhash[bucket] < 0) ? NULL : 
+                 &ctx->decl[ctx->declhash[bucket]];
+          decl != NULL;
+          decl = (decl->next < 0) ? NULL : &ctx->decl[decl->next])
+      {
+         if(decl->namelen == j-i && 
+            !strncmp(definitions+decl->name, definitions+i, j-i))
+            break;
+      }
+      if(decl != NULL)
+      {
+         i = j-1;
+         continue;
+      }
+      
+      if(ctx->ndecl == ctx->maxdecl)
+      {
+         int max = ctx->maxdecl ? 2*ctx->maxdecl : 64;
+         if((decl = (PARAMDECL *)realloc(ctx->decl, 
+                                         max * sizeof(PARAMDECL))) == NULL)
+            return(ANSI_ENOMEM);
+         ctx->decl    = decl;
+         ctx->maxdecl = max;
+      }
+      
+      if(typelen < 0) DeclType(definitions, stmt, &type, &typelen);
+      decl          = &ctx->decl[ctx->ndecl];
+      decl->type    = type;
+      decl->typelen = typelen;
+      DeclAt(definitions, i, j-i, decl);
+      decl->next    = ctx->declhash[bucket];
+      ctx->declhash[bucket] = ctx->ndecl++;
+      
+      i = j-1;
+   }
+   
+   return(ANSI_OK);
+}
+
+/************************************************************************/
+/*>PARAMDECL *FindDecl(ANSICTX *ctx, char *definitions, char *varname,
+                       PARAMDECL *found)
+   -------------------------------------------------------------------
+   I/O:     ANSICTX  *ctx           Conversion context with the table 
+                                    from ParseDecls()
+   Input:   char     *definitions   Assembled KR definitions
+            char     *varname       Parameter to look for
+   Output:  PARAMDECL *found        Space for a declaration not in the 
+                                    table
+   Returns: PARAMDECL *             Its declaration (NULL if not found)
+
+   Looks a parameter up in the table. A name which isn't an identifier 
+   can't be in it, so is searched for with FindVarName() as before.
+
+   16.10.26 Original
+*/
+PARAMDECL *FindDecl(ANSICTX *ctx, char *definitions, char *varname,
+                    PARAMDECL *found)
+{
+   PARAMDECL   *decl;
+   char        *ptr;
+   int         len,
+               index;
+   
+   StatCount(ctx, findvar);
+   
+   for(len=0; isIdentChar(varname[len]); len++) ;
+   if(len && varname[len] == '\0')
+   {
+      index = ctx->declhash[HashName(varname, len) & (ctx->hashsize-1)];
+      for( ; index >= 0; index = decl->next)
+      {
+         decl = &ctx->decl[index];
+         if(decl->namelen == len && 
+            !strncmp(definitions+decl->name, varname, len))
+            return(decl);
+      }
+      return(NULL);
+   }
+   
+   if((ptr = FindVarName(definitions, varname)) == NULL) return(NULL);
+   if(Stats(ctx) != NULL) 
+      Stats(ctx)->findbytes += (ptr - definitions) + strlen(varname);
+   for(index=(int)(ptr-definitions); index>0 && definitions[index-1]!=';';
+       index--) ;
+   DeclType(definitions, index, &found->type, &found->typelen);
+   DeclAt(definitions, (int)(ptr-definitions), (int)strlen(varname), 
+          found);
+   return(found);
+}
+
+/************************************************************************/
+/*>void DeclType(char *definitions, int stmt, int *type, int *typelen)
+   -------------------------------------------------------------------
+   Input:   char     *definitions   Assembled KR definitions
+            int      stmt           Offset of the start of a statement
+   Output:  int      *type          Offset of its type
+            int      *typelen       Length of the type (0 if none)
+
+   The type is everything from the start of the statement, less leading 
+   spaces, up to the name of its first variable, which is the last word
+   before the first , or ;. Any *'s on that word go with it.
+
+   16.10.26 Original, from WriteANSI()
+*/
+void DeclType(char *definitions, int stmt, int *type, int *typelen)
+{
+   int   start = stmt,
+         stop;
+   
+   /* Kill any leading spaces                                           */
+   while(definitions[start] == ' ' || definitions[start] == '\t') start++;
+   
+   /* Step stop on to the first , or ;                                  */
+   for(stop=start; definitions[stop] && definitions[stop] != ',' && 
+                   definitions[stop] != ';'; stop++) ;
+   
+   /* Now step back over any spaces                                     */
+   stop--;
+   while(stop > start && isBlank(definitions[stop])) stop--;
+   
+   /* Now step back over the first variable name                        */
+   while(stop > start && !isBlank(definitions[stop])) stop--;
+   
+   /* and over the spaces preceeding it                                 */
+   while(stop > start && isBlank(definitions[stop])) stop--;
+   
+   *type    = start;
+   *typelen = (start <= stop) ? stop-start+1 : 0;
+}
+
+/************************************************************************/
+/*>void DeclAt(char *definitions, int name, int namelen, PARAMDECL *decl)
+   ----------------------------------------------------------------------
+   Input:   char     *definitions   Assembled KR definitions
+            int      name           Offset of a variable's name
+            int      namelen        Its length
+   I/O:     PARAMDECL *decl         The name, the *'s before it and any
+                                    [] after it are filled in
+
+   16.10.26 Original, from WriteANSI()
+*/
+void DeclAt(char *definitions, int name, int namelen, PARAMDECL *decl)
+{
+   int   start,
+         stop;
+   
+   decl->name    = name;
+   decl->namelen = namelen;
+   
+   /* Count the *'s before the name, stepping back over any spaces      */
+   start = name - 1;
+   while(start > 0 && isBlank(definitions[start])) start--;
+   for(stop=start; stop>=0 && definitions[stop] == '*'; stop--) ;
+   decl->stars = start - stop;
+   
+   /* See if it's a [] array: a [ between the name and the next , or ;
+      less any spaces
+   */
+   for(stop=name; definitions[stop] && definitions[stop] != ',' && 
+                  definitions[stop] != ';'; stop++) ;
+   stop--;
+   while(stop > name && isBlank(definitions[stop])) stop--;
+   for(start=name; start<stop && definitions[start] != '['; start++) ;
+   
+   decl->array    = start;
+   decl->arraylen = (start < stop) ? stop-start+1 : 0;
+}
+
+/************************************************************************/
+/*>unsigned long HashName(const char *name, int len)
+   -------------------------------------------------
+   Input:   const char *name     A name (need not be terminated)
+            int      len         Its length
+   Returns: unsigned long        FNV-1a hash of it
+
+   16.10.26 Original
+*/
+unsigned long HashName(const char *name, int len)
+{
+   unsigned long hash = 2166136261UL;
+   
+   while(len--)
+   {
+      hash ^= (unsigned char)*name++;
+      hash *= 16777619UL;
+   }
+   return(hash);
+}
+
+/************************************************************************/
+/*>int isFunc(ANSICTX *ctx, LINEINFO *info)
+   ----------------------------------------
+   Input:   ANSICTX  *ctx           Context with the character before the
+                                    first ; from LexLine()
+            LINEINFO *info          What was found on the last line
+   Returns: int                     1: This is a function
+                                    0: Not a function
+
+   Determines whether a possible function definition identified by 
+   LexLine() really is a function.
+
+   17.12.91 Original    By: ACRM
+   16.10.26 funcdef is now a DEFLINES. Only looks for the ; on the last
+            line and stops if there isn't one (end of file)
+   16.10.26 Uses what LexLine() found rather than stepping back through 
+            the lines
+*/
+int isFunc(ANSICTX *ctx, LINEINFO *info)
+{
+   /* If it's a prototype, it will not be terminated by a {             */
+   if(info->brace >= 0) return(1);
+   
+   /* If there's no ; we ran out of file                                */
+   if(info->semi < 0) return(0);
+   
+   /* It's now either a prototype or a K&R function defintion.
+      To be a prototype, the first non-space character before the
+      ; must be a )
+   */
+   return(ctx->beforesemi == ')' ? 0 : 1);
+}
+
+/************************************************************************/
+/*>BOOL isKRDef(ANSICTX *ctx)
+   --------------------------
+   Input:   ANSICTX  *ctx           Context with the tokens of a function
+                                    definition up to its {
+   Returns: BOOL                    Whether it's K&R
+
+   A definition is K&R if it has a ; (ending a parameter's declaration)
+   outside comments.
+
+   16.10.26 Original, split out of Ansify() and DeAnsify()
+*/
+BOOL isKRDef(ANSICTX *ctx)
+{
+   TOKEN *tok,
+         *end = ctx->tok + ctx->ntok;
+   
+   for(tok=ctx->tok; tok<end; tok++)
+   {
+      if(tok->type == ';') return(TRUE);
+   }
+   return(FALSE);
+}
+
+/************************************************************************/
+/*>BOOL NeedsConverting(ANSICTX *ctx, int ndef)
+   --------------------------------------------
+   Input:   ANSICTX  *ctx           Context with the tokens of a function
+                                    definition up to its {
+            int      ndef           Index of its last line in funcdef
+   Returns: BOOL                    Whether Ansify() or DeAnsify() would
+                                    change it
+
+   For MakeANSI, a definition needs converting if it's K&R and has a ) 
+   to close its parameters. For MakeKR, it does if it's ANSI and has 
+   anything (even void) in its parameters. With none, DeAnsify() still
+   writes it again as what comes before the ( followed by ()\n{\n, 
+   without comments, so it only stays the same if it was just that.
+
+   16.10.26 Original
+   16.10.26 A MakeKR definition with no parameters needs converting 
+            unless DeAnsify() would write it exactly as it is
+*/
+BOOL NeedsConverting(ANSICTX *ctx, int ndef)
+{
+   DEFLINES *funcdef = &ctx->funcdef;
+   TOKEN    *tok,
+            *end     = ctx->tok + ctx->ntok;
+   long     defend;
+   
+   if(ctx->mode == MakeANSI)
+   {
+      if(!isKRDef(ctx)) return(FALSE);
+      for(tok=ctx->tok; tok->type != '('; tok++) ;
+      for( ; tok<end && tok->type != ')'; tok++) ;
+      return((BOOL)(tok < end));
+   }
+   
+   if(isKRDef(ctx)) return(FALSE);
+   
+   /* The first line had a ( in code so there is always one. Anything 
+      before it is written without comments
+   */
+   for(tok=ctx->tok; tok->type != '('; tok++)
+   {
+      if(tok->type == TK_COMMENT) return(TRUE);
+   }
+   for(tok++; tok<end && tok->type == TK_COMMENT; tok++) ;
+   if(tok < end && tok->type != ')') return(TRUE);
+   
+   /* No parameters, so see if it's already ()\n{\n to the end         */
+   for(tok=ctx->tok; tok->type != '('; tok++) ;
+   defend = funcdef->start[ndef] + funcdef->len[ndef] + 1;
+   return((BOOL)(defend > ctx->in.size || defend - tok->start != 5 ||
+                 memcmp(funcdef->base + tok->start, "()\n{\n", 5)));
+}
+
+/************************************************************************/
+/*>int DeAnsify(ANSICTX *ctx, OUTBUF *out, DEFLINES *funcdef, int ndef)
+   ---------------------------------------------------------------------
+   I/O:     ANSICTX  *ctx           Conversion context for work space
+                                    and the definition's tokens
+            OUTBUF   *out           Output being written
+   Input:   DEFLINES *funcdef       Function definition lines
+            int      ndef           Number of definition lines
+   Returns: int                     ANSI_OK or ANSI_ENOMEM
+
+   Writes a K&R function definition from the ANSI (or K&R) form in funcdef.
+   If it's already K&R, just writes it; otherwise assembles function into
+   a single buffer line, writes the function name and the names of the 
+   parameters, and calls WriteKR() to write the definition of each one.
+
+   17.12.91 Original    By: ACRM
+   16.10.26 funcdef is now a DEFLINES. Returns a status
+   16.10.26 Work space comes from GetScratch() and is sized from the
+            definition rather than being MAXBUFF
+   16.10.26 Uses the tokens from LexLine() to find the ; and the name
+            of each parameter. Comments are removed. A parameter list
+            of just void has no parameters, but void *p is a parameter
+   16.10.26 Writes to an OUTBUF
+   16.10.26 Unchanged lines are copied with PassLine()
+   16.10.26 The parameters are found once, as PARAMs in the context, and
+            written from those rather than being copied into a list, 
+            read back with GetVarName() and searched for by WriteKR().
+            Finds the name of a pointer to a function
+   16.10.26 Uses isKRDef()
+*/
+int DeAnsify(ANSICTX  *ctx,
+             OUTBUF   *out,
+             DEFLINES *funcdef,
+             int      ndef)
+{
+   TOKEN *tok     = ctx->tok,
+         *end     = ctx->tok + ctx->ntok,
+         *lparen,
+         *name    = NULL;
+   PARAM *param;
+   int   i,
+         nparam   = 0,
+         ntok     = 0,
+         depth    = 0,
+         from,
+         isKR,
+         done     = FALSE,
+         fnptr    = FALSE,
+         bufflen  = 0;
+   char  *buffer  = NULL;
+   
+   ndef++;
+   
+   /* If any of the lines contains a ;, it's already KR                 */
+   isKR = isKRDef(ctx);
+   
+   if(isKR)
+   {
+      /* It's already KR, so just output it                             */
+      for(i=0; i<ndef; i++) 
+         PassLine(&ctx->in, out, funcdef->start[i], funcdef->len[i]);
+   }
+   else     /* It's not KR, so we convert it.                           */
+   {
+      StatCount(ctx, converted);
+      
+      /* First get some memory. None of the pieces can be longer than
+         the whole definition
+      */
+      for(i=0; i<ndef; i++) bufflen += funcdef->len[i];
+      bufflen += 2;
+      if((buffer = GetScratch(ctx, bufflen)) == NULL)
+         return(ANSI_ENOMEM);
+      
+      /* Now build all the strings into the single buffer ignoring 
+         comments 
+      */
+      StripComments(ctx, funcdef, ndef, buffer);
+
+      /* Print up to and including the first (. The first line had a ( 
+         in code so there is always one
+      */
+      for(lparen=ctx->tok; lparen->type != '('; lparen++) ;
+      OutWrite(out, buffer, lparen->clean + 1);
+      
+      /* Step through the parameter list a token at a time. Each 
+         parameter ends at a , or the closing ) and its name is the last 
+         identifier outside any brackets, or inside the (* ) of a 
+         pointer to a function. V3.2: Each is kept as a PARAM
+      */
+      from = lparen->clean + 1;
+      for(tok=lparen+1; tok<end && !done; tok++)
+      {
+         switch(tok->type)
+         {
+         case '(':
+            /* V3.2: (* starts the name of a pointer to a function       */
+            if(!depth++ && tok+1 < end && tok[1].type == '*')
+               fnptr = TRUE;
+            break;
+         case '[':
+            depth++;
+            break;
+         case ']':
+            depth--;
+            break;
+         case ')':
+            if(depth)
+            {
+               if(!--depth) fnptr = FALSE;
+               break;
+            }
+            /* At the closing ) we finish the last parameter            */
+            done = TRUE;
+            /* Fall through                                             */
+         case ',':
+            if(depth) break;
+            
+            /* A lone void means there are no parameters                */
+            if(name != NULL && 
+               !(done && nparam == 0 && ntok == 1 && name->len == 4 && 
+                 (!strncmp(buffer+name->clean, "void", 4) ||
+                  !strncmp(buffer+name->clean, "VOID", 4))))
+            {
+               if(nparam == ctx->maxparam && !GrowParams(ctx))
+                  return(ANSI_ENOMEM);
+               param = &ctx->param[nparam++];
+               
+               /* The type starts after any spaces and the suffix runs 
+                  up to the , or )
+               */
+               while(from < name->clean && isBlank(buffer[from])) from++;
+               param->type      = from;
+               param->typelen   = name->clean - from;
+               param->name      = name->clean;
+               param->namelen   = name->len;
+               param->suffix    = name->clean + name->len;
+               param->suffixlen = tok->clean - param->suffix;
+            }
+            from  = tok->clean + 1;
+            name  = NULL;
+            ntok  = 0;
+            fnptr = FALSE;
+            continue;
+         case TK_IDENT:
+            if(!depth || (depth == 1 && fnptr)) name = tok;
+            break;
+         }
+         ntok++;
+      }
+      
+      /* If there weren't any parameters we can just output a closing
+         parenthesis an opening { and return.
+      */
+      if(nparam==0)
+      {
+         OutString(out, ")\n{\n");
+         return(ANSI_OK);
+      }
+
+      /* We can now echo the parameter names to the output file         */
+      for(i=0; i<nparam; i++)
+      {
+         if(i) OutString(out, ", ");
+         OutWrite(out, buffer + ctx->param[i].name, ctx->param[i].namelen);
+      }
+      OutString(out, ")\n");
+
+      /* Then write the parameter definition lines                      */
+      for(i=0; i<nparam; i++)
+         WriteKR(out, buffer, &ctx->param[i]);
+      
+      OutString(out, "{\n");
+   }
+   
+   return(ANSI_OK);
+}
+
+/************************************************************************/
+/*>void WriteKR(OUTBUF *out, char *buffer, PARAM *param)
+   -----------------------------------------------------
+   I/O:     OUTBUF   *out           Output being written
+   Input:   char     *buffer        ANSI style definition without comments
+            PARAM    *param         A parameter in it
+   Returns: void
+
+   Writes a variable definition in K&R form by extracting information from
+   the ANSI definition.
+
+   17.12.91 Original    By: ACRM
+   26.03.92 Added call to FindVarName()
+   16.10.26 Writes the definition straight from definitions rather than
+            copying it to a MAXBUFF buffer
+   16.10.26 Writes to an OUTBUF
+   16.10.26 Writes the type, name and suffix of a PARAM found by 
+            DeAnsify() rather than searching for the name with 
+            FindVarName()
+*/
+void WriteKR(OUTBUF *out, char *buffer, PARAM *param)
+{
+   /* Output the variable definition and add a ;                        */
+   OutWrite(out, buffer + param->type,   param->typelen);
+   OutWrite(out, buffer + param->name,   param->namelen);
+   OutWrite(out, buffer + param->suffix, param->suffixlen);
+   OutString(out, ";\n");
+}
+
+/************************************************************************/
+/*>BOOL GrowParams(ANSICTX *ctx)
+   -----------------------------
+   I/O:     ANSICTX  *ctx        Conversion context
+   Returns: BOOL                 FALSE if out of memory
+
+   Doubles the number of parameters a definition may have. The table is
+   kept from one definition to the next.
+
+   16.10.26 Original
+*/
+BOOL GrowParams(ANSICTX *ctx)
+{
+   int   max = ctx->maxparam ? 2*ctx->maxparam : 64;
+   PARAM *param;
+   
+   if((param = (PARAM *)realloc(ctx->param, max * sizeof(PARAM))) == NULL)
+      return(FALSE);
+   ctx->param    = param;
+   ctx->maxparam = max;
+   return(TRUE);
+}
+
+/************************************************************************/
+/*>BOOL OpenInput(INFILE *in, FILE *fp)
+   ------------------------------------
+   I/O:     INFILE   *in         Input source to initialise. Any arena
+                                 from a previous file is kept for reuse
+   Input:   FILE     *fp         File opened for reading
+   Returns: BOOL                 TRUE if the file was mapped into memory
+
+   Sets up an input source for GetLine(). If the file is a regular file
+   it is mapped into memory so that lines can be used where they lie. 
+   Otherwise (pipes, empty files, or no mmap()) we fall back to reading
+   a line at a time from the stream into the arena.
+
+   16.10.26 Original
+*/
+BOOL OpenInput(INFILE *in, FILE *fp)
+{
+#ifdef POSIX_IO
+   struct stat st;
+   void        *map;
+#endif
+
+   in->fp        = fp;
+   in->fd        = -1;
+   in->map       = in->arena;
+   in->size      = 0;
+   in->pos       = 0;
+   in->mapped    = FALSE;
+   in->streaming = TRUE;
+   in->nomem     = FALSE;
+   in->nread     = 0;
+   in->ready     = 0;
+   in->line      = 0;
+
+#ifdef POSIX_IO
+   /* Only regular files with something in them can be mapped          */
+   if(fstat(fileno(fp), &st) || !S_ISREG(st.st_mode) || st.st_size <= 0)
+      return(FALSE);
+
+   /* Skip anything already read from the stream                        */
+   if((in->pos = ftell(fp)) < 0 || in->pos >= st.st_size)
+   {
+      in->pos = 0;
+      return(FALSE);
+   }
+
+   map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+              fileno(fp), 0);
+   if(map == MAP_FAILED)
+   {
+      in->pos = 0;
+      return(FALSE);
+   }
+#  ifdef MADV_SEQUENTIAL
+   madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+#  endif
+
+   in->map       = (char *)map;
+   in->fd        = fileno(fp);
+   in->size      = (long)st.st_size;
+   in->mapped    = TRUE;
+   in->streaming = FALSE;
+   return(TRUE);
+#else
+   return(FALSE);
+#endif
+}
+
+#ifdef POSIX_IO
+/************************************************************************/
+/*>BOOL InputWaiting(INFILE *in)
+   -----------------------------
+   Input:   INFILE   *in         Input being read a line at a time
+   Returns: BOOL                 TRUE if more can be read straight away
+
+   Sees if there's more input we can read without waiting for it. We 
+   ask how much is waiting in the pipe (or whatever it is), so don't 
+   need to ask again until we've read that much. Only the descriptor is
+   looked at, not what the stream has buffered, so this may say there 
+   isn't any when there is.
+
+   16.10.26 Original
+*/
+BOOL InputWaiting(INFILE *in)
+{
+   int   n;
+   
+   if(in->nread < in->ready) return(TRUE);
+   if(ioctl(fileno(in->fp), FIONREAD, &n) || n <= 0) return(FALSE);
+   in->ready = in->nread + n;
+   return(TRUE);
+}
+#endif
+
+/************************************************************************/
+/*>void OpenBuffer(INFILE *in, const char *buffer, size_t len)
+   -----------------------------------------------------------
+   I/O:     INFILE   *in         Input source to initialise
+   Input:   char     *buffer     Source held in memory
+            size_t   len         Length of the source
+
+   Sets up an input source for GetLine() which reads from memory. The 
+   buffer is used just like a mapped file.
+
+   16.10.26 Original
+*/
+void OpenBuffer(INFILE *in, const char *buffer, size_t len)
+{
+   in->fp        = NULL;
+   in->fd        = -1;
+   in->map       = (char *)buffer;
+   in->size      = (long)len;
+   in->pos       = 0;
+   in->mapped    = FALSE;
+   in->streaming = FALSE;
+   in->nomem     = FALSE;
+   in->line      = 0;
+}
+
+/************************************************************************/
+/*>BOOL GetLine(INFILE *in, long *start, int *len)
+   -----------------------------------------------
+   I/O:     INFILE   *in         Input source
+   Output:  long     *start      Offset of the line from in->map
+            int      *len        Length of the line
+   Returns: BOOL                 FALSE at end of file (or if the arena
+                                 could not grow, which sets in->nomem)
+
+   Gets the next line. If the file is mapped, the line is where it lies
+   in the map and nothing is copied. Otherwise the line is added to the 
+   end of the arena, which grows as needed; since that may move it, 
+   in->map must be used again after each call. The line is not terminated
+   and its length excludes the \n. Lines may be any length.
+
+   16.10.26 Original
+   16.10.26 Returns an offset. Lines are no longer limited in length
+   16.10.26 Counts the lines
+*/
+BOOL GetLine(INFILE *in, long *start, int *len)
+{
+   char  *nl;
+   long  n;
+   
+   if(!in->streaming)
+   {
+      if(in->pos >= in->size) return(FALSE);
+
+      *start = in->pos;
+      if((nl = (char *)memchr(in->map + in->pos, '\n', 
+                              (size_t)(in->size - in->pos))) != NULL)
+      {
+         *len     = (int)(nl - (in->map + in->pos));
+         in->pos += *len + 1;
+      }
+      else
+      {
+         *len     = (int)(in->size - in->pos);
+         in->pos  = in->size;
+      }
+      in->line++;
+      return(TRUE);
+   }
+   
+   /* Read onto the end of the arena, a piece at a time if need be      */
+   *start = in->size;
+   for(;;)
+   {
+      if(in->arenasize - in->size < ARENABUFF/2)
+      {
+         long  size = in->arenasize ? 2*in->arenasize : ARENABUFF;
+         char  *ptr;
+         
+         if((ptr = (char *)realloc(in->arena, (size_t)size)) == NULL)
+         {
+            in->nomem = TRUE;
+            return(FALSE);
+         }
+         in->arena     = in->map = ptr;
+         in->arenasize = size;
+      }
+
+      if(!fgets(in->arena + in->size, (int)(in->arenasize - in->size), 
+                in->fp))
+         break;
+      
+      n          = strlen(in->arena + in->size);
+      in->size  += n;
+      in->nread += n;
+      if(n && in->arena[in->size-1] == '\n') break;
+   }
+   
+   /* Nothing read means we're at the end of the file                   */
+   if(in->size == *start) return(FALSE);
+   
+   *len    = (int)(in->size - *start);
+   if(in->arena[in->size-1] == '\n') (*len)--;
+   in->pos = in->size;
+   in->line++;
+   return(TRUE);
+}
+
+/************************************************************************/
+/*>void ResetArena(INFILE *in)
+   ---------------------------
+   I/O:     INFILE   *in         Input source
+
+   Discards the lines held in the arena once they have been dealt with.
+   The arena itself is kept for the next lines. Does nothing if the file
+   is mapped.
+
+   16.10.26 Original
+*/
+void ResetArena(INFILE *in)
+{
+   if(in->streaming) in->size = in->pos = 0;
+}
+
+/************************************************************************/
+/*>void CloseInput(INFILE *in)
+   ---------------------------
+   I/O:     INFILE   *in         Input source
+
+   Unmaps the file if it was mapped. The stream itself is left open and 
+   the arena is kept.
+
+   16.10.26 Original
+*/
+void CloseInput(INFILE *in)
+{
+#ifdef POSIX_IO
+   if(in->mapped) munmap(in->map, (size_t)in->size);
+#endif
+   in->map    = NULL;
+   in->fd     = -1;
+   in->mapped = FALSE;
+}
+
+/************************************************************************/
+/*>BOOL GrowDefLines(DEFLINES *funcdef)
+   ------------------------------------
+   I/O:     DEFLINES *funcdef    Definition line table
+   Returns: BOOL                 FALSE if out of memory
+
+   Doubles the number of lines a definition may have. The table is kept
+   from one definition to the next.
+
+   16.10.26 Original
+*/
+BOOL GrowDefLines(DEFLINES *funcdef)
+{
+   int   n = funcdef->maxlines ? 2*funcdef->maxlines : DEFLINES0;
+   long  *start;
+   int   *len;
+   
+   if((start = (long *)realloc(funcdef->start, n*sizeof(long))) == NULL)
+      return(FALSE);
+   funcdef->start = start;
+   if((len = (int *)realloc(funcdef->len, n*sizeof(int))) == NULL)
+      return(FALSE);
+   funcdef->len      = len;
+   funcdef->maxlines = n;
+   
+   return(TRUE);
+}
+
+/************************************************************************/
+/*>BOOL AddDefLine(ANSICTX *ctx, INFILE *in, int n, LINEINFO *info,
+                   int *status)
+   ----------------------------------------------------------------
+   I/O:     ANSICTX  *ctx        Conversion context
+            INFILE   *in         Input source
+   Input:   int      n           Index of the new line
+   Output:  LINEINFO *info       What LexLine() found on the line
+            int      *status     ANSI_ENOMEM if we ran out of memory
+   Returns: BOOL                 FALSE at end of file or if out of memory
+
+   Reads the next line of a function definition into ctx->funcdef and 
+   passes it to LexLine() to update the count of brackets, etc. and add
+   its tokens to the definition's.
+
+   16.10.26 Original
+*/
+BOOL AddDefLine(ANSICTX *ctx, INFILE *in, int n, LINEINFO *info,
+                int *status)
+{
+   DEFLINES *funcdef = &ctx->funcdef;
+   
+   if(n >= funcdef->maxlines && !GrowDefLines(funcdef))
+   {
+      *status = ANSI_ENOMEM;
+      return(FALSE);
+   }
+   if(!GetLine(in, &funcdef->start[n], &funcdef->len[n]))
+   {
+      if(in->nomem) *status = ANSI_ENOMEM;
+      return(FALSE);
+   }
+   
+   /* The arena may have moved                                          */
+   funcdef->base = in->map;
+   StatCount(ctx, lines);
+   if((*status = LexLine(ctx, DEFLINE(funcdef,n), funcdef->start[n],
+                         funcdef->len[n], LEX_TOKENS, info)) != ANSI_OK)
+      return(FALSE);
+
+   return(TRUE);
+}
+
+/************************************************************************/
+/*>int StripComments(ANSICTX *ctx, DEFLINES *funcdef, int ndef, 
+                     char *buffer)
+   -------------------------------------------------------------
+   I/O:     ANSICTX  *ctx        Context with the definition's tokens. The
+                                 clean offset of each token is set
+   Input:   DEFLINES *funcdef    Function definition lines
+            int      ndef        Number of definition lines
+   Output:  char     *buffer     The lines joined without comments
+   Returns: int                  Length of buffer
+
+   Joins the lines of a definition into a single buffer leaving out the 
+   comment tokens, and notes where each of the other tokens ended up.
+
+   16.10.26 Original
+*/
+int StripComments(ANSICTX *ctx, DEFLINES *funcdef, int ndef, char *buffer)
+{
+   TOKEN *tok = ctx->tok,
+         *end = ctx->tok + ctx->ntok;
+   long  pos,
+         stop;
+   int   i,
+         j    = 0;
+   
+   for(i=0; i<ndef; i++)
+   {
+      pos  = funcdef->start[i];
+      stop = pos + funcdef->len[i];
+      for( ; tok<end && tok->start < stop; tok++)
+      {
+         if(tok->type == TK_COMMENT)
+         {
+            memcpy(buffer+j, funcdef->base+pos, tok->start-pos);
+            j  += tok->start - pos;
+            pos = tok->start + tok->len;
+         }
+         else
+         {
+            tok->clean = j + (tok->start - pos);
+         }
+      }
+      memcpy(buffer+j, funcdef->base+pos, stop-pos);
+      j += stop - pos;
+   }
+   buffer[j] = '\0';
+   
+   return(j);
+}
+
+/************************************************************************/
+/*>char *GetScratch(ANSICTX *ctx, size_t size)
+   -------------------------------------------
+   I/O:     ANSICTX  *ctx        Conversion context
+   Input:   size_t   size        Number of bytes needed
+   Returns: char *               Work space (NULL if out of memory)
+
+   Returns work space of at least the size requested. This is kept in the
+   context and reused rather than being freed after each definition.
+
+   16.10.26 Original
+*/
+char *GetScratch(ANSICTX *ctx, size_t size)
+{
+   char  *ptr;
+   
+   if(size > ctx->scratchsize)
+   {
+      if(size < 2*ctx->scratchsize) size = 2*ctx->scratchsize;
+      if((ptr = (char *)realloc(ctx->scratch, size)) == NULL)
+         return(NULL);
+      ctx->scratch     = ptr;
+      ctx->scratchsize = size;
+   }
+   return(ctx->scratch);
+}
+
+/************************************************************************/
+/*>void WriteLine(OUTBUF *out, char *line, int len)
+   ------------------------------------------------
+   I/O:     OUTBUF   *out        Output being written
+   Input:   char     *line       Line (need not be terminated)
+            int      len         Length of the line
+
+   Writes a line followed by a \n.
+
+   16.10.26 Original
+   16.10.26 Writes to an OUTBUF
+   16.10.26 len is compared with the space left as a size_t
+*/
+void WriteLine(OUTBUF *out, char *line, int len)
+{
+   if(out->spanlen) OutSendSpan(out);
+   
+   if((size_t)len < out->size - out->len)
+   {
+      memcpy(out->buffer + out->len, line, len);
+      out->len += len;
+      out->buffer[out->len++] = '\n';
+      out->pos += len + 1;
+   }
+   else
+   {
+      OutWrite(out, line, len);
+      OutString(out, "\n");
+   }
+}
+
+/************************************************************************/
+/*>BOOL OutOpen(OUTBUF *out, FILE *fp, size_t size)
+   ------------------------------------------------
+   I/O:     OUTBUF   *out        Output buffer. Any buffer it already has
+                                 is reused
+   Input:   FILE     *fp         File to write, or NULL to keep the output
+                                 in memory
+            size_t   size        Space to start with if kept in memory
+   Returns: BOOL                 FALSE if out of memory
+
+   Gets an output buffer ready for a file. Anything the caller has 
+   already written to fp is flushed first since, where we have a file
+   descriptor, we write to that rather than through fp.
+
+   16.10.26 Original
+   16.10.26 Notes whether the file is a pipe, terminal, etc.
+*/
+BOOL OutOpen(OUTBUF *out, FILE *fp, size_t size)
+{
+#ifdef POSIX_IO
+   struct stat st;
+#endif
+
+   out->fp     = fp;
+   out->len    = 0;
+   out->fd     = -1;
+   out->memory = (fp == NULL);
+   out->error  = FALSE;
+   out->nocopy = FALSE;
+   out->spanlen = 0;
+   out->pos    = 0;
+   out->flush  = FALSE;
+
+   if(!out->memory)
+   {
+      size = OUTBUFF;
+      fflush(fp);
+#ifdef POSIX_IO
+      out->fd    = fileno(fp);
+      out->flush = (!fstat(out->fd, &st) && !S_ISREG(st.st_mode));
+#endif
+   }
+   
+   if(out->buffer == NULL || out->size < size)
+   {
+      char *ptr;
+      if((ptr = (char *)realloc(out->buffer, size)) == NULL)
+      {
+         out->error = TRUE;
+         return(FALSE);
+      }
+      out->buffer = ptr;
+      out->size   = size;
+   }
+   return(TRUE);
+}
+
+/************************************************************************/
+/*>void OutWrite(OUTBUF *out, const char *data, size_t len)
+   --------------------------------------------------------
+   I/O:     OUTBUF   *out        Output buffer
+   Input:   const char *data     Bytes to write
+            size_t   len         Number of bytes
+
+   Appends bytes to the output. When writing to a file, anything too big
+   for the buffer is written along with what's waiting rather than being
+   copied.
+
+   16.10.26 Original
+*/
+void OutWrite(OUTBUF *out, const char *data, size_t len)
+{
+   if(out->spanlen) OutSendSpan(out);
+   out->pos += len;
+   
+   if(len > out->size - out->len)
+   {
+      if(out->memory)
+      {
+         if(!OutGrow(out, len)) return;
+      }
+      else if(len >= out->size)
+      {
+         OutSend(out, data, len);
+         return;
+      }
+      else
+      {
+         OutSend(out, NULL, 0);
+      }
+   }
+   memcpy(out->buffer + out->len, data, len);
+   out->len += len;
+}
+
+/************************************************************************/
+/*>void OutPad(OUTBUF *out, int c, size_t n)
+   -----------------------------------------
+   I/O:     OUTBUF   *out        Output buffer
+   Input:   int      c           Character to write
+            size_t   n           Number of times to write it
+
+   Appends n copies of a character to the output.
+
+   16.10.26 Original
+*/
+void OutPad(OUTBUF *out, int c, size_t n)
+{
+   size_t   chunk;
+   
+   if(out->spanlen) OutSendSpan(out);
+   out->pos += n;
+   
+   while(n && !out->error)
+   {
+      if(out->len == out->size)
+      {
+         if(out->memory)
+         {
+            if(!OutGrow(out, n)) return;
+         }
+         else
+         {
+            OutSend(out, NULL, 0);
+         }
+      }
+      chunk = out->size - out->len;
+      if(chunk > n) chunk = n;
+      memset(out->buffer + out->len, c, chunk);
+      out->len += chunk;
+      n        -= chunk;
+   }
+}
+
+/************************************************************************/
+/*>BOOL OutSend(OUTBUF *out, const char *data, size_t len)
+   -------------------------------------------------------
+   I/O:     OUTBUF   *out        Output buffer, which is emptied
+   Input:   const char *data     Bytes to write after the buffer (may be
+                                 NULL)
+            size_t   len         Number of bytes in data
+   Returns: BOOL                 FALSE if the write failed
+
+   Writes what's in the buffer, then data, to the file. With a file
+   descriptor this is a single writev() unless it's cut short.
+
+   16.10.26 Original
+   16.10.26 Timed if statistics are being kept
+*/
+BOOL OutSend(OUTBUF *out, const char *data, size_t len)
+{
+   double   wall = 0.0,
+            cpu  = 0.0;
+   
+   if(out->error || out->memory) return(FALSE);
+   if(Stats(out) != NULL) StatClock(&wall, &cpu);
+   
+#ifdef POSIX_IO
+   if(out->fd != -1)
+   {
+      struct iovec   iov[2];
+      int            niov  = 0,
+                     first = 0;
+      ssize_t        n;
+      
+      if(out->len)
+      {
+         iov[niov].iov_base   = out->buffer;
+         iov[niov++].iov_len  = out->len;
+      }
+      if(len)
+      {
+         iov[niov].iov_base   = (char *)data;
+         iov[niov++].iov_len  = len;
+      }
+      
+      while(first < niov)
+      {
+         if((n = writev(out->fd, iov+first, niov-first)) <= 0)
+         {
+            if(n < 0 && errno == EINTR) continue;
+            out->error = TRUE;
+            break;
+         }
+         
+         /* Step over whatever was written                              */
+         while(first < niov && (size_t)n >= iov[first].iov_len)
+            n -= iov[first++].iov_len;
+         if(first < niov)
+         {
+            iov[first].iov_base  = (char *)iov[first].iov_base + n;
+            iov[first].iov_len  -= n;
+         }
+      }
+   }
+   else
+#endif
+   if((out->len && fwrite(out->buffer, 1, out->len, out->fp) != out->len) ||
+      (len && fwrite(data, 1, len, out->fp) != len))
+   {
+      out->error = TRUE;
+   }
+   
+   out->len = 0;
+   if(Stats(out) != NULL) 
+      StatStage(Stats(out), ANSI_STAGE_WRITE, wall, cpu);
+   return(!out->error);
+}
+
+/************************************************************************/
+/*>BOOL OutGrow(OUTBUF *out, size_t len)
+   -------------------------------------
+   I/O:     OUTBUF   *out        Output buffer kept in memory
+   Input:   size_t   len         Number of bytes about to be appended
+   Returns: BOOL                 FALSE if out of memory
+
+   Makes room for len more bytes, and a NUL, by at least doubling the
+   buffer.
+
+   16.10.26 Original
+*/
+BOOL OutGrow(OUTBUF *out, size_t len)
+{
+   size_t   size = 2*out->size;
+   char     *ptr;
+
+   if(size < out->len + len + 1) size = out->len + len + 1;
+   if((ptr = (char *)realloc(out->buffer, size)) == NULL)
+   {
+      out->error = TRUE;
+      return(FALSE);
+   }
+   out->buffer = ptr;
+   out->size   = size;
+   
+   return(TRUE);
+}
+
+/************************************************************************/
+/*>BOOL OutFlush(OUTBUF *out)
+   --------------------------
+   I/O:     OUTBUF   *out        Output buffer
+   Returns: BOOL                 FALSE if anything failed to be written
+                                 (or we ran out of memory)
+
+   Writes anything left in the buffer to the file. Output kept in memory
+   is left where it is.
+
+   16.10.26 Original
+   16.10.26 Writes any span first
+*/
+BOOL OutFlush(OUTBUF *out)
+{
+   if(out->spanlen)              OutSendSpan(out);
+   if(out->error)                return(FALSE);
+   if(out->memory || !out->len)  return(TRUE);
+   return(OutSend(out, NULL, 0));
+}
+
+/************************************************************************/
+/*>void OutSpan(OUTBUF *out, const char *data, size_t len, int fd, 
+                long offset)
+   ---------------------------------------------------------------
+   I/O:     OUTBUF   *out        Output buffer
+   Input:   const char *data     Unchanged input to be copied out. This
+                                 must stay put until the next write or 
+                                 OutFlush()
+            size_t   len         Number of bytes
+            int      fd          File the input was mapped from, or -1
+            long     offset      Offset of data in that file
+
+   Adds a span of input to be copied to the output unchanged. If it 
+   follows on from the span already waiting the two are joined, so runs
+   of unchanged lines are written in one go.
+
+   16.10.26 Original
+*/
+void OutSpan(OUTBUF *out, const char *data, size_t len, int fd, 
+             long offset)
+{
+   if(out->spanlen)
+   {
+      if(data == out->span + out->spanlen)
+      {
+         out->spanlen += len;
+         return;
+      }
+      OutSendSpan(out);
+   }
+   out->span    = data;
+   out->spanlen = len;
+   out->spanfd  = fd;
+   out->spanoff = offset;
+}
+
+/************************************************************************/
+/*>void OutSendSpan(OUTBUF *out)
+   -----------------------------
+   I/O:     OUTBUF   *out        Output buffer with a span waiting
+
+   Writes the waiting span. Where both ends are files and the span is 
+   big enough, what's in the buffer is written and the span is then 
+   copied from one file to the other by the kernel with copy_file_range()
+   or, if that can't be used, sendfile(). Otherwise, or if neither works,
+   it's appended from memory like anything else.
+
+   16.10.26 Original
+   16.10.26 File to file copies are timed if statistics are being kept
+*/
+void OutSendSpan(OUTBUF *out)
+{
+   const char  *data = out->span;
+   size_t      len   = out->spanlen;
+   
+   out->spanlen = 0;
+   
+#ifdef ZERO_COPY
+   if(len >= ZCOPYMIN && !out->memory && !out->nocopy && 
+      out->fd != -1 && out->spanfd != -1 && OutSend(out, NULL, 0))
+   {
+      loff_t   off  = out->spanoff;
+      off_t    soff;
+      ssize_t  n;
+      double   wall = 0.0,
+               cpu  = 0.0;
+      
+      if(Stats(out) != NULL) StatClock(&wall, &cpu);
+      while(len)
+      {
+         if((n = copy_file_range(out->spanfd, &off, out->fd, NULL, 
+                                 len, 0)) <= 0)
+         {
+            soff = (off_t)off;
+            if((n = sendfile(out->fd, out->spanfd, &soff, len)) <= 0)
+            {
+               /* Neither works with these files so don't try again    */
+               out->nocopy = TRUE;
+               break;
+            }
+            off = (loff_t)soff;
+         }
+         data     += n;
+         len      -= n;
+         out->pos += n;
+      }
+      if(Stats(out) != NULL) 
+         StatStage(Stats(out), ANSI_STAGE_WRITE, wall, cpu);
+      if(!len) return;
+   }
+#endif
+
+   OutWrite(out, data, len);
+}
+
+/************************************************************************/
+/*>void PassLine(INFILE *in, OUTBUF *out, long start, int len)
+   -----------------------------------------------------------
+   Input:   INFILE   *in         Input source
+   I/O:     OUTBUF   *out        Output being written
+   Input:   long     start       Offset of the line in the input
+            int      len         Length of the line
+
+   Copies a line of input to the output unchanged. If the input is mapped
+   (or in memory) and the line has its \n the line and \n are added to 
+   the span waiting in the output buffer. Otherwise it is written with
+   WriteLine().
+
+   16.10.26 Original
+*/
+void PassLine(INFILE *in, OUTBUF *out, long start, int len)
+{
+   if(!in->streaming && start + len < in->size)
+      OutSpan(out, in->map + start, len + 1, in->fd, start);
+   else
+      WriteLine(out, in->map + start, len);
+}
+
+/************************************************************************/
+/*>void Message(ANSICTX *ctx, char *format, ...)
+   ---------------------------------------------
+   I/O:     ANSICTX  *ctx        Conversion context
+   Input:   char     *format     printf() style format
+            ...                  Arguments for the format
+
+   Adds a message to those held in the context. Messages longer than 
+   MSGBUFF are truncated. If we run out of memory the message is lost.
+
+   16.10.26 Original
+*/
+void Message(ANSICTX *ctx, char *format, ...)
+{
+   va_list  args;
+   char     *ptr;
+   int      len;
+   
+   if(ctx->msglen + MSGBUFF + 1 > ctx->msgsize)
+   {
+      size_t size = 2*ctx->msgsize + MSGBUFF + 1;
+      if((ptr = (char *)realloc(ctx->msgs, size)) == NULL) return;
+      ctx->msgs    = ptr;
+      ctx->msgsize = size;
+   }
+   
+   va_start(args, format);
+   len = vsnprintf(ctx->msgs + ctx->msglen, MSGBUFF + 1, format, args);
+   va_end(args);
+   
+   if(len > 0) ctx->msglen += (len > MSGBUFF) ? MSGBUFF : len;
+}
+
+#ifdef THREADS
+/************************************************************************/
+/*>void AddMessages(ANSICTX *ctx, const char *msgs, size_t len)
+   ------------------------------------------------------------
+   I/O:     ANSICTX  *ctx        Conversion context
+   Input:   const char *msgs     Messages from another context
+            size_t   len         Their length
+
+   Adds messages already formatted by Message() to those held in the 
+   context. If we run out of memory they are lost.
+
+   16.10.26 Original
+*/
+void AddMessages(ANSICTX *ctx, const char *msgs, size_t len)
+{
+   char     *ptr;
+   
+   if(len == 0) return;
+   if(ctx->msglen + len + 1 > ctx->msgsize)
+   {
+      size_t size = 2*ctx->msgsize + len + 1;
+      if((ptr = (char *)realloc(ctx->msgs, size)) == NULL) return;
+      ctx->msgs    = ptr;
+      ctx->msgsize = size;
+   }
+   
+   memcpy(ctx->msgs + ctx->msglen, msgs, len);
+   ctx->msglen += len;
+   ctx->msgs[ctx->msglen] = '\0';
+}
+#endif
+
+/************************************************************************/
+/*>BOOL NoteFunction(ANSICTX *ctx, INFILE *in, DEFLINES *funcdef, 
+                     int ndef, size_t outpos, size_t outend)
+   ---------------------------------------------------------------
+   I/O:     ANSICTX  *ctx        Conversion context holding the tokens of
+                                 the definition
+   Input:   INFILE   *in         The input
+            DEFLINES *funcdef    Lines of the definition
+            int      ndef        Index of its last line
+            size_t   outpos      Offset in the output of what was written
+                                 for it
+            size_t   outend      Offset of the byte after that
+            size_t   protopos    The same for its prototype, if one was
+            size_t   protoend    made
+   Returns: BOOL                 FALSE if out of memory
+
+   Adds a function which has just been converted to those held in the
+   context. Its name is the first identifier followed by a ( which isn't
+   followed by a *, so int (*fn(int x))() is fn. Anything in double 
+   brackets, such as __attribute__((...)), is skipped. If there isn't a
+   name (it can't really be a function) nothing is added, unless it's 
+   an edit, when the name is empty.
+
+   16.10.26 Original
+   16.10.26 Edits are always added
+   16.10.26 Notes the line it starts on
+   16.10.26 Added protopos and protoend
+*/
+BOOL NoteFunction(ANSICTX *ctx, INFILE *in, DEFLINES *funcdef, int ndef,
+                  size_t outpos, size_t outend, size_t protopos, 
+                  size_t protoend)
+{
+   TOKEN    *tok  = ctx->tok,
+            *end  = ctx->tok + ctx->ntok,
+            *name = NULL,
+            *paren,
+            *next;
+   int      depth;
+   
+   for( ; tok<end && name==NULL; tok++)
+   {
+      if(tok->type != TK_IDENT) continue;
+      
+      /* Skip comments to see what follows                              */
+      for(paren=tok+1; paren<end && paren->type==TK_COMMENT; paren++) ;
+      if(paren == end || paren->type != '(') continue;
+      for(next=paren+1; next<end && next->type==TK_COMMENT; next++) ;
+      
+      if(next < end && next->type == '(')
+      {
+         for(tok=paren, depth=0; tok<end; tok++)
+         {
+            if(tok->type == '(') depth++;
+            else if(tok->type == ')' && --depth == 0) break;
+         }
+         if(tok == end) break;
+      }
+      else if(next == end || next->type != '*')
+      {
+         name = tok;
+      }
+   }
+   if(name == NULL && !ctx->edits) return(TRUE);
+   
+   return(AddFunction(ctx, (name == NULL) ? "" : in->map + name->start, 
+                      (name == NULL) ? 0  : name->len,
+                      in->streaming ? -1 : funcdef->start[0],
+                      in->streaming ? -1 : funcdef->start[ndef] + 
+                                           funcdef->len[ndef],
+                      in->line - ndef, outpos, outend - outpos,
+                      protopos, protoend - protopos));
+}
+
+/************************************************************************/
+/*>BOOL AddFunction(ANSICTX *ctx, const char *name, size_t namelen, 
+                    long start, long end, long line, size_t outpos, 
+                    size_t outlen, size_t protopos, size_t protolen)
+   ---------------------------------------------------------------
+   I/O:     ANSICTX  *ctx        Conversion context
+   Input:   const char *name     Name of the function (not terminated)
+            size_t   namelen     Its length
+            long     start       Offsets of its definition in the input
+            long     end         
+            long     line        Line it starts on (from 1)
+            size_t   outpos      Offset of what was written for it
+            size_t   outlen      How much was written
+            size_t   protopos    Offset of its prototype
+            size_t   protolen    Its length (0 if none was made)
+   Returns: BOOL                 FALSE if out of memory
+
+   Adds a function to those held in the context. The name goes on the 
+   end of ctx->names; the pointer to it is filled in by AnsiFunctions()
+   since the names may move as they grow.
+
+   16.10.26 Original
+   16.10.26 Added line
+   16.10.26 Added protopos and protolen
+*/
+BOOL AddFunction(ANSICTX *ctx, const char *name, size_t namelen, 
+                 long start, long end, long line, size_t outpos, 
+                 size_t outlen, size_t protopos, size_t protolen)
+{
+   ANSIFUNC *func;
+   
+   if(ctx->nfuncs == ctx->maxfuncs)
+   {
+      int max = ctx->maxfuncs ? 2*ctx->maxfuncs : 64;
+      if((func = (ANSIFUNC *)realloc(ctx->funcs, max * sizeof(ANSIFUNC)))
+         == NULL)
+         return(FALSE);
+      ctx->funcs    = func;
+      ctx->maxfuncs = max;
+   }
+   if(ctx->namelen + namelen + 1 > ctx->namesize)
+   {
+      size_t size = 2*ctx->namesize + namelen + 1;
+      char   *ptr;
+      if((ptr = (char *)realloc(ctx->names, size)) == NULL) return(FALSE);
+      ctx->names    = ptr;
+      ctx->namesize = size;
+   }
+   
+   memcpy(ctx->names + ctx->namelen, name, namelen);
+   ctx->namelen += namelen;
+   ctx->names[ctx->namelen++] = '\0';
+   
+   func = &ctx->funcs[ctx->nfuncs++];
+   func->name   = NULL;
+   func->start  = start;
+   func->end    = end;
+   func->line   = line;
+   func->outpos = outpos;
+   func->outlen = outlen;
+   func->protopos = protopos;
+   func->protolen = protolen;
+   return(TRUE);
+}
+
+/************************************************************************/
+/*>void ResetContext(ANSICTX *ctx)
+   -------------------------------
+   I/O:     ANSICTX  *ctx        Conversion context
+
+   Gets a context ready to convert another file.
+
+   16.10.26 Original
+   16.10.26 Forgets the functions found
+   16.10.26 Clears the statistics
+*/
+void ResetContext(ANSICTX *ctx)
+{
+   ctx->bra_count     = 0;
+   ctx->quote         = 0;
+   ctx->inComment     = FALSE;
+   ctx->inDirective   = FALSE;
+   ctx->ntok          = 0;
+   ctx->msglen        = 0;
+   ctx->nfuncs        = 0;
+   ctx->namelen       = 0;
+   ctx->statwait      = 0.0;
+   ctx->checkat       = -1;
+   if(ctx->msgs != NULL) ctx->msgs[0] = '\0';
+   if(Stats(ctx) != NULL)
+   {
+      memset(&ctx->stat,      0, sizeof(ANSISTATS));
+      memset(&ctx->splitstat, 0, sizeof(ANSISTATS));
+   }
+}
+
+/************************************************************************/
+/*>void StatClock(double *wall, double *cpu)
+   -----------------------------------------
+   Output:  double   *wall       Wall clock time in seconds
+            double   *cpu        Processor time used by this thread
+
+   Reads the clocks for timing a stage. Without POSIX clocks both are 
+   the processor time of the whole program.
+
+   16.10.26 Original
+*/
+void StatClock(double *wall, double *cpu)
+{
+#if defined(POSIX_IO) && defined(CLOCK_MONOTONIC)
+   struct timespec ts;
+   
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   *wall = ts.tv_sec + ts.tv_nsec / 1e9;
+#  ifdef CLOCK_THREAD_CPUTIME_ID
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+   *cpu  = ts.tv_sec + ts.tv_nsec / 1e9;
+#  else
+   *cpu  = (double)clock() / CLOCKS_PER_SEC;
+#  endif
+#else
+   *wall = *cpu = (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/************************************************************************/
+/*>void StatStage(ANSISTATS *stats, int stage, double wall, double cpu)
+   --------------------------------------------------------------------
+   I/O:     ANSISTATS *stats     Statistics being kept
+   Input:   int      stage       ANSI_STAGE_...
+            double   wall        Times from StatClock() when the stage 
+            double   cpu         started
+
+   Adds the time since a stage started to it.
+
+   16.10.26 Original
+*/
+void StatStage(ANSISTATS *stats, int stage, double wall, double cpu)
+{
+   double   now,
+            nowcpu;
+   
+   StatClock(&now, &nowcpu);
+   stats->stagewall[stage] += now - wall;
+   stats->stagecpu[stage]  += nowcpu - cpu;
+}
+
+/************************************************************************/
+/*>void StatEnd(ANSICTX *ctx, double wall, double cpu)
+   ---------------------------------------------------
+   I/O:     ANSICTX  *ctx        Context keeping statistics
+   Input:   double   wall        Times from StatClock() when the 
+            double   cpu         conversion started
+
+   Finishes the statistics for a conversion. The time this thread spent
+   which wasn't converting, writing or waiting for other threads was 
+   spent reading and scanning. Then anything other threads did on pieces
+   of the file is added in; the bytes and elapsed time are still those
+   of the whole file.
+
+   16.10.26 Original
+*/
+void StatEnd(ANSICTX *ctx, double wall, double cpu)
+{
+   ANSISTATS *stats = Stats(ctx);
+   double    now,
+             nowcpu;
+   
+   StatClock(&now, &nowcpu);
+   stats->bytes = (unsigned long)(ctx->in.streaming ? ctx->in.nread 
+                                                    : ctx->in.size);
+   stats->wall  = now - wall;
+   stats->cpu   = nowcpu - cpu;
+   stats->stagewall[ANSI_STAGE_SCAN] = stats->wall - ctx->statwait - 
+      stats->stagewall[ANSI_STAGE_CONVERT] - 
+      stats->stagewall[ANSI_STAGE_WRITE];
+   stats->stagecpu[ANSI_STAGE_SCAN]  = stats->cpu - 
+      stats->stagecpu[ANSI_STAGE_CONVERT] - 
+      stats->stagecpu[ANSI_STAGE_WRITE];
+   
+   StatMerge(stats, &ctx->splitstat);
+   stats->bytes -= ctx->splitstat.bytes;
+   stats->wall   = now - wall;
+}
+
+/************************************************************************/
+/*>void StatMerge(ANSISTATS *to, const ANSISTATS *from)
+   ----------------------------------------------------
+   I/O:     ANSISTATS *to        Statistics to add to
+   Input:   const ANSISTATS *from  Statistics to add
+
+   Adds one set of statistics to another.
+
+   16.10.26 Original
+*/
+void StatMerge(ANSISTATS *to, const ANSISTATS *from)
+{
+   int      i;
+   
+   to->bytes       += from->bytes;
+   to->lines       += from->lines;
+   to->interesting += from->interesting;
+   to->candidates  += from->candidates;
+   to->accepted    += from->accepted;
+   to->rejected    += from->rejected;
+   to->converted   += from->converted;
+   to->findvar     += from->findvar;
+   to->findbytes   += from->findbytes;
+   to->wall        += from->wall;
+   to->cpu         += from->cpu;
+   for(i=0; i<ANSI_NSTAGES; i++)
+   {
+      to->stagewall[i] += from->stagewall[i];
+      to->stagecpu[i]  += from->stagecpu[i];
+   }
+}
+
+/************************************************************************/
+/*>ANSICTX *AnsiCreate(int mode)
+   -----------------------------
+   Input:   int      mode        Processing mode
+                                 MakeANSI:   Create ANSI
+                                 MakeKR:     Create K&R
+                                 MakeProtos: Create prototypes
+   Returns: ANSICTX *            New context (NULL if no memory or the 
+                                 mode was invalid)
+
+   Creates a context for converting files. Free it with AnsiDestroy().
+
+   16.10.26 Original
+   16.10.26 Chooses a scanner
+   16.10.26 Files are converted on one thread unless AnsiSetThreads()
+            is called
+*/
+ANSICTX *AnsiCreate(int mode)
+{
+   ANSICTX *ctx;
+   
+   if(mode != MakeANSI && mode != MakeKR && mode != MakeProtos)
+      return(NULL);
+   
+   if((ctx = (ANSICTX *)calloc(1, sizeof(ANSICTX))) == NULL)
+      return(NULL);
+   
+   ctx->mode     = mode;
+   ctx->nthreads = 1;
+   
+   /* V2.3: The best scanner unless ANSI_SCAN names another             */
+   if((ctx->scanner = FindScanner(getenv("ANSI_SCAN"))) == NULL)
+      ctx->scanner = FindScanner(NULL);
+   ctx->scan = ctx->scanner->func;
+   
+   return(ctx);
+}
+
+/************************************************************************/
+/*>void AnsiDestroy(ANSICTX *ctx)
+   ------------------------------
+   I/O:     ANSICTX  *ctx        Context to free
+
+   Frees a context created by AnsiCreate().
+
+   16.10.26 Original
+   16.10.26 Frees the functions found
+   16.10.26 Frees the prototypes kept
+*/
+void AnsiDestroy(ANSICTX *ctx)
+{
+   if(ctx == NULL) return;
+   free(ctx->msgs);
+   free(ctx->in.arena);
+   free(ctx->funcdef.start);
+   free(ctx->funcdef.len);
+   free(ctx->scratch);
+   free(ctx->tok);
+   free(ctx->decl);
+   free(ctx->declhash);
+   free(ctx->param);
+   free(ctx->out.buffer);
+   free(ctx->protos.buffer);
+   free(ctx->funcs);
+   free(ctx->names);
+   free(ctx);
+}
+
+/************************************************************************/
+/*>int AnsiConvertStream(ANSICTX *ctx, FILE *in, FILE *out)
+   --------------------------------------------------------
+   I/O:     ANSICTX  *ctx        Conversion context
+   Input:   FILE     *in         File to be converted
+            FILE     *out        Where the result is written
+   Returns: int                  ANSI_OK or an error code
+
+   Converts a file. If the input is a regular file it is mapped into 
+   memory, otherwise it is read a line at a time. Neither file is closed.
+
+   16.10.26 Original
+   16.10.26 The output goes through the context's OUTBUF
+   16.10.26 Finishes the statistics if they're being kept
+   16.10.26 Keeps the prototypes if asked
+*/
+int AnsiConvertStream(ANSICTX *ctx, FILE *in, FILE *out)
+{
+   int      status;
+   double   wall = 0.0,
+            cpu  = 0.0;
+   
+   ResetContext(ctx);
+   if(Stats(ctx) != NULL) StatClock(&wall, &cpu);
+   if(!OutOpen(&ctx->out, out, 0) || 
+      (ctx->keepprotos && !OutOpen(&ctx->protos, NULL, PROTOBUFF)))
+      return(ANSI_ENOMEM);
+   OpenInput(&ctx->in, in);
+   status = process_file(ctx, &ctx->in, &ctx->out);
+   
+   /* Any span waiting is still in the mapped file                      */
+   if(!OutFlush(&ctx->out) && status == ANSI_OK) status = ANSI_EWRITE;
+   if(ctx->keepprotos && !OutFlush(&ctx->protos) && status == ANSI_OK)
+      status = ANSI_ENOMEM;
+   if(fflush(out) && status == ANSI_OK)          status = ANSI_EWRITE;
+   if(Stats(ctx) != NULL) StatEnd(ctx, wall, cpu);
+   CloseInput(&ctx->in);
+   return(status);
+}
+
+/************************************************************************/
+/*>int AnsiConvertBuffer(ANSICTX *ctx, const char *in, size_t inlen,
+                         char **out, size_t *outlen)
+   -----------------------------------------------------------------
+   I/O:     ANSICTX  *ctx        Conversion context
+   Input:   char     *in         Source to be converted
+            size_t   inlen       Length of the source
+   Output:  char     **out       Converted source in memory from malloc().
+                                 This is terminated by a NUL which is not
+                                 included in the length. NULL on error.
+            size_t   *outlen     Length of converted source
+   Returns: int                  ANSI_OK or an error code
+
+   Converts source held in memory. The input is used where it lies; it is
+   not copied and need not be terminated.
+
+   16.10.26 Original
+   16.10.26 The output is built in the context's OUTBUF
+   16.10.26 Finishes the statistics if they're being kept
+   16.10.26 Keeps the prototypes if asked
+*/
+int AnsiConvertBuffer(ANSICTX *ctx, const char *in, size_t inlen,
+                      char **out, size_t *outlen)
+{
+   OUTBUF   *buf = &ctx->out;
+   int      status;
+   double   wall = 0.0,
+            cpu  = 0.0;
+   
+   *out    = NULL;
+   *outlen = 0;
+   ResetContext(ctx);
+   if(Stats(ctx) != NULL) StatClock(&wall, &cpu);
+   
+   /* The input buffer is treated just like a mapped file and the output
+      is built in the output buffer, which starts as big as the input
+   */
+   OpenBuffer(&ctx->in, in, inlen);
+   if(!OutOpen(buf, NULL, inlen + inlen/8 + 64) ||
+      (ctx->keepprotos && !OutOpen(&ctx->protos, NULL, PROTOBUFF)))
+      return(ANSI_ENOMEM);
+   status = process_file(ctx, &ctx->in, buf);
+   if(!OutFlush(buf) && status == ANSI_OK) status = ANSI_ENOMEM;
+   if(ctx->keepprotos && !OutFlush(&ctx->protos) && status == ANSI_OK)
+      status = ANSI_ENOMEM;
+   if(Stats(ctx) != NULL) StatEnd(ctx, wall, cpu);
+   
+   /* Hand the buffer over to the caller                                */
+   if(status == ANSI_OK && (buf->len < buf->size || OutGrow(buf, 1)))
+   {
+      buf->buffer[buf->len] = '\0';
+      *out    = buf->buffer;
+      *outlen = buf->len;
+      buf->buffer = NULL;
+      buf->size   = 0;
+   }
+   else if(status == ANSI_OK)
+   {
+      status = ANSI_ENOMEM;
+   }
+   
+   return(status);
+}
+
+/************************************************************************/
+/*>int AnsiCheckBuffer(ANSICTX *ctx, const char *in, size_t inlen, 
+                       long *line)
+   ----------------------------------------------------------------
+   I/O:     ANSICTX  *ctx        Conversion context (MakeANSI or MakeKR)
+   Input:   char     *in         Source to be checked
+            size_t   inlen       Length of the source
+   Output:  long     *line       Line (from 1) on which the first 
+                                 definition needing conversion starts, 
+                                 0 if there's none
+   Returns: int                  ANSI_OK or an error code
+
+   Checks whether source is already in the form the context converts to,
+   without converting it. Definitions are found just as by a conversion
+   but nothing is written, and it stops at the first definition which 
+   would be converted.
+
+   16.10.26 Original
+*/
+int AnsiCheckBuffer(ANSICTX *ctx, const char *in, size_t inlen, 
+                    long *line)
+{
+   const char *ptr,
+            *end;
+   int      status;
+   double   wall = 0.0,
+            cpu  = 0.0;
+   
+   *line = 0;
+   if(ctx->mode == MakeProtos) return(ANSI_EMODE);
+   ResetContext(ctx);
+   if(Stats(ctx) != NULL) StatClock(&wall, &cpu);
+   
+   /* Nothing is written, but process_file() needs an OUTBUF            */
+   OpenBuffer(&ctx->in, in, inlen);
+   if(!OutOpen(&ctx->out, NULL, 64)) return(ANSI_ENOMEM);
+   ctx->check = TRUE;
+   status     = process_file(ctx, &ctx->in, &ctx->out);
+   ctx->check = FALSE;
+   if(Stats(ctx) != NULL) StatEnd(ctx, wall, cpu);
+   
+   /* Count the lines before the definition                             */
+   if(status == ANSI_OK && ctx->checkat >= 0)
+   {
+      end = in + ctx->checkat;
+      for(*line=1, ptr=in; 
+          (ptr = (const char *)memchr(ptr, '\n', end - ptr)) != NULL; 
+          ptr++)
+         (*line)++;
+   }
+   return(status);
+}
+
+/************************************************************************/
+/*>const char *AnsiMessages(ANSICTX *ctx)
+   --------------------------------------
+   Input:   ANSICTX  *ctx        Conversion context
+   Returns: const char *         Messages from the last conversion, one 
+                                 per line (an empty string if none)
+
+   16.10.26 Original
+*/
+const char *AnsiMessages(ANSICTX *ctx)
+{
+   return((ctx->msglen) ? ctx->msgs : "");
+}
+
+/************************************************************************/
+/*>const char *AnsiStrError(int error)
+   -----------------------------------
+   Input:   int      error       Code returned by a conversion routine
+   Returns: const char *         Description of the error
+
+   16.10.26 Original
+*/
+const char *AnsiStrError(int error)
+{
+   switch(error)
+   {
+   case ANSI_OK:
+      return("No error");
+   case ANSI_ENOMEM:
+      return("Out of memory");
+   case ANSI_EMODE:
+      return("Invalid processing mode");
+   case ANSI_EREAD:
+      return("Error reading input");
+   case ANSI_EWRITE:
+      return("Error writing output");
+   case ANSI_ETOOBIG:
+      return("Function definition too big");
+   case ANSI_ESCAN:
+      return("Scanner not available");
+   default:
+      break;
+   }
+   return("Unknown error");
+}
+
+/************************************************************************/
+/*>int AnsiSetScanner(ANSICTX *ctx, const char *name)
+   --------------------------------------------------
+   I/O:     ANSICTX  *ctx        Conversion context
+   Input:   const char *name     scalar, sse2, avx2 or NULL for the best
+                                 this processor has
+   Returns: int                  ANSI_OK or ANSI_ESCAN
+
+   Chooses the scanner used to skip over comments, strings and function
+   bodies. The output is the same whichever is used.
+
+   16.10.26 Original
+*/
+int AnsiSetScanner(ANSICTX *ctx, const char *name)
+{
+   SCANNER  *scanner;
+   
+   if((scanner = FindScanner(name)) == NULL)
+      return(ANSI_ESCAN);
+   ctx->scanner = scanner;
+   ctx->scan    = scanner->func;
+   
+   return(ANSI_OK);
+}
+
+/************************************************************************/
+/*>const char *AnsiScannerName(ANSICTX *ctx)
+   -----------------------------------------
+   Input:   ANSICTX  *ctx        Conversion context
+   Returns: const char *         Name of the scanner in use
+
+   16.10.26 Original
+*/
+const char *AnsiScannerName(ANSICTX *ctx)
+{
+   return(ctx->scanner->name);
+}
+
+/************************************************************************/
+/*>int AnsiSetThreads(ANSICTX *ctx, int nthreads)
+   ----------------------------------------------
+   I/O:     ANSICTX  *ctx        Conversion context
+   Input:   int      nthreads    Most threads to convert one file on (0 
+                                 for one per processor)
+   Returns: int                  ANSI_OK
+
+   Files of SPLITMIN bytes or more, which are mapped or in memory, are 
+   split into pieces converted on up to this many threads. The output is
+   the same. Without threads, files are always converted on one.
+
+   16.10.26 Original
+*/
+int AnsiSetThreads(ANSICTX *ctx, int nthreads)
+{
+   if(nthreads < 1)
+   {
+#ifdef THREADS
+      long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+      nthreads = (ncpu > 0) ? (int)ncpu : 1;
+#else
+      nthreads = 1;
+#endif
+   }
+   ctx->nthreads = nthreads;
+   
+   return(ANSI_OK);
+}
+
+/************************************************************************/
+/*>const ANSIFUNC *AnsiFunctions(ANSICTX *ctx, int *nfuncs)
+   --------------------------------------------------------
+   Input:   ANSICTX  *ctx        Conversion context
+   Output:  int      *nfuncs     Number of functions
+   Returns: const ANSIFUNC *     Functions converted by the last 
+                                 conversion, in order (NULL if none).
+                                 These belong to the context and last
+                                 until it's used again
+
+   Functions are only kept once AnsiKeepFunctions() has been called.
+
+   16.10.26 Original
+*/
+const ANSIFUNC *AnsiFunctions(ANSICTX *ctx, int *nfuncs)
+{
+   char  *name = ctx->names;
+   int   i;
+   
+   for(i=0; i<ctx->nfuncs; i++)
+   {
+      ctx->funcs[i].name = name;
+      name += strlen(name) + 1;
+   }
+   
+   *nfuncs = ctx->nfuncs;
+   return((ctx->nfuncs) ? ctx->funcs : NULL);
+}
+
+/************************************************************************/
+/*>int AnsiKeepFunctions(ANSICTX *ctx, int keep)
+   ---------------------------------------------
+   I/O:     ANSICTX  *ctx        Conversion context
+   Input:   int      keep        Non-zero to keep the functions converted
+                                 for AnsiFunctions()
+   Returns: int                  ANSI_OK
+
+   They aren't kept unless asked for, since memory use would then grow
+   with the number of functions rather than being limited by the 
+   largest.
+
+   16.10.26 Original
+*/
+int AnsiKeepFunctions(ANSICTX *ctx, int keep)
+{
+   ctx->keepfuncs = (BOOL)(keep != 0);
+   return(ANSI_OK);
+}
+
+/************************************************************************/
+/*>int AnsiEditsOnly(ANSICTX *ctx, int edits)
+   ------------------------------------------
+   I/O:     ANSICTX  *ctx        Conversion context (MakeANSI or MakeKR)
+   Input:   int      edits       Non-zero to write only the definitions
+                                 which change
+   Returns: int                  ANSI_OK, or ANSI_EMODE with MakeProtos
+
+   Once set, a conversion writes nothing but what each definition which
+   changes is replaced by, and AnsiFunctions() lists them all (with an
+   empty name if none was found). Each replaces the input from start up
+   to and including the \n which ends the line at end, so the output 
+   grows with the number of definitions converted rather than the size 
+   of the input.
+
+   16.10.26 Original
+*/
+int AnsiEditsOnly(ANSICTX *ctx, int edits)
+{
+   if(ctx->mode == MakeProtos) return(ANSI_EMODE);
+   ctx->edits = (BOOL)(edits != 0);
+   return(ANSI_OK);
+}
+
+/************************************************************************/
+/*>int AnsiKeepPrototypes(ANSICTX *ctx, int keep)
+   ----------------------------------------------
+   I/O:     ANSICTX  *ctx        Conversion context (MakeANSI)
+   Input:   int      keep        Non-zero to make prototypes as well
+   Returns: int                  ANSI_OK, or ANSI_EMODE unless MakeANSI
+
+   Once set, a conversion to ANSI also makes the prototype of each 
+   definition, as MakeProtos would, while the definition is written. 
+   They're kept in the context for AnsiPrototypes() and, if functions
+   are kept, AnsiFunctions() says where each is. Not much use with 
+   AnsiEditsOnly(), since only the definitions which change are seen.
+
+   16.10.26 Original
+*/
+int AnsiKeepPrototypes(ANSICTX *ctx, int keep)
+{
+   if(ctx->mode != MakeANSI) return(ANSI_EMODE);
+   ctx->keepprotos = (BOOL)(keep != 0);
+   return(ANSI_OK);
+}
+
+/************************************************************************/
+/*>const char *AnsiPrototypes(ANSICTX *ctx, size_t *len)
+   -----------------------------------------------------
+   Input:   ANSICTX  *ctx        Conversion context
+   Output:  size_t   *len        Length of the prototypes
+   Returns: const char *         Prototypes made by the last conversion,
+                                 one after another. These belong to the
+                                 context and last until it's used again.
+                                 NULL unless AnsiKeepPrototypes() has
+                                 been called
+
+   16.10.26 Original
+*/
+const char *AnsiPrototypes(ANSICTX *ctx, size_t *len)
+{
+   *len = ctx->keepprotos ? ctx->protos.len : 0;
+   if(!ctx->keepprotos) return(NULL);
+   return((ctx->protos.buffer != NULL) ? ctx->protos.buffer : "");
+}
+
+/************************************************************************/
+/*>int AnsiKeepStats(ANSICTX *ctx, int keep)
+   -----------------------------------------
+   I/O:     ANSICTX  *ctx        Conversion context
+   Input:   int      keep        Non-zero to keep statistics for 
+                                 AnsiStats()
+   Returns: int                  ANSI_OK
+
+   Counting and timing cost a little, so are only done when asked for. 
+   If NOSTATS was defined they're never done.
+
+   16.10.26 Original
+*/
+int AnsiKeepStats(ANSICTX *ctx, int keep)
+{
+#ifndef NOSTATS
+   ctx->stats     = keep ? &ctx->stat : NULL;
+   ctx->out.stats = ctx->stats;
+   if(keep) memset(&ctx->stat, 0, sizeof(ANSISTATS));
+#else
+   (void)ctx;
+   (void)keep;
+#endif
+   return(ANSI_OK);
+}
+
+/************************************************************************/
+/*>const ANSISTATS *AnsiStats(ANSICTX *ctx)
+   ----------------------------------------
+   Input:   ANSICTX  *ctx        Conversion context
+   Returns: const ANSISTATS *    Statistics for the last conversion. 
+                                 These belong to the context and last
+                                 until it's used again. NULL unless 
+                                 AnsiKeepStats() has been called (or if
+                                 built with NOSTATS)
+
+   16.10.26 Original
+*/
+const ANSISTATS *AnsiStats(ANSICTX *ctx)
+{
+   return(Stats(ctx));
+}
+
+#ifndef ANSI_LIBRARY
+/************************************************************************/
+/*>int RunJob(JOB *job, int mode, int nthreads, CACHE *cache, 
+              SIGDB *sigdb, RUNSTATS *stats, BOOL hold)
+   -------------------------------------------------------------
+   I/O:     JOB      *job        The pair of files to convert
+            CACHE    *cache      Conversion cache (NULL if none)
+            SIGDB    *sigdb      Signature store (NULL if none)
+            RUNSTATS *stats      Statistics to add to (NULL if none)
+   Input:   int      mode        Processing mode
+            int      nthreads    Threads to split a large file over
+            BOOL     hold        Hold messages and standard output in 
+                                 temporary files so they can be written 
+                                 out in order later
+   Returns: int                  0 if all OK, 1 on error
+
+   Converts one pair of files for batch mode. If the input has been
+   converted before, the output and messages are taken from the cache. 
+   An output file which is already the same is left alone. With a 
+   signature store, it's run by SigJob() instead. An input 
+   of - is stdin. If the job is atomic, a reader never sees a partly
+   written output. An in-place job is run by InPlaceJob(), a check by 
+   CheckJob() and an edit script by EditJob(). An input which is already
+   converted is just copied by CopyJob().
+
+   16.10.26 Original
+   16.10.26 Added nthreads
+   16.10.26 Added cache
+   16.10.26 Added sigdb
+   16.10.26 Reads stdin for -
+   16.10.26 Added stats
+   16.10.26 Writes an atomic job's output to a temporary file which 
+            replaces the output when it's complete
+   16.10.26 In-place jobs are run by InPlaceJob()
+   16.10.26 Checks are run by CheckJob()
+   16.10.26 Inputs which are already converted are copied by CopyJob()
+   16.10.26 Edit scripts are written by EditJob()
+*/
+int RunJob(JOB *job, int mode, int nthreads, CACHE *cache, 
+           SIGDB *sigdb, RUNSTATS *stats, BOOL hold)
+{
+   FILE     *fp_in  = NULL,
+            *fp_out = NULL,
+            *msg    = stdout;
+   ANSICTX  *ctx;
+   BOOL     toStdout;
+   char     *key    = NULL,
+            *tmp    = NULL;
+   int      status;
+
+   toStdout = (BOOL)(job->out != NULL && !strcmp(job->out, "-"));
+   
+   if(hold)
+   {
+      if((msg = job->fp_msg = tmpfile()) == NULL)
+      {
+         fprintf(stderr,"Unable to create temporary file for %s\n",
+                 job->in);
+         return(job->status = 1);
+      }
+   }
+   else if(toStdout)
+   {
+      msg = stderr;
+   }
+
+#ifdef POSIX_IO
+   /* V3.7: Only checking the input                                     */
+   if(job->check)
+      return(CheckJob(job, mode, msg));
+   
+   /* V3.9: Writing an edit script for the input                      */
+   if(job->edits)
+      return(EditJob(job, mode, nthreads, stats, msg, hold));
+   
+   /* V3.6: Rewriting the input                                         */
+   if(job->inplace)
+      return(InPlaceJob(job, mode, nthreads, sigdb, stats, msg));
+#endif
+
+   /* V2.8: Prototypes from the signature store                         */
+   if(sigdb != NULL)
+   {
+#ifdef POSIX_IO
+      return(SigJob(job, sigdb, mode, nthreads, stats, msg, hold));
+#endif
+   }
+
+#ifdef POSIX_IO
+   /* V3.8: An input which needs no change is copied by the kernel      */
+   if(mode != MakeProtos && !toStdout && strcmp(job->in, "-") &&
+      CopyJob(job, mode, stats, msg))
+      return(job->status);
+#endif
+
+   if(!strcmp(job->in, "-"))
+      fp_in = stdin;
+   else if((fp_in = fopen(job->in,"r")) == NULL)
+   {
+      fprintf(msg,"Unable to open input file %s\n",job->in);
+      return(job->status = 1);
+   }
+
+   /* V2.7: Use the cached conversion of this input if there is one.
+      Output to stdout isn't cached
+   */
+   if(cache != NULL && !toStdout)
+   {
+#ifdef POSIX_IO
+      if((key = CacheName(cache, fp_in, mode)) != NULL &&
+         CacheGet(cache, key, job->out, msg, &job->status))
+      {
+         free(key);
+         if(fp_in != stdin) fclose(fp_in);
+         return(job->status);
+      }
+#endif
+   }
+
+   if(toStdout)
+      fp_out = hold ? (job->fp_out = tmpfile()) : stdout;
+#ifdef POSIX_IO
+   else if(job->atomic)
+      fp_out = OpenAtomic(job->out, fileno(fp_in), &tmp);
+#endif
+   else
+      fp_out = fopen(job->out,"w");
+   
+   if(fp_out == NULL)
+   {
+      fprintf(msg,"Unable to open output file %s\n",job->out);
+      if(fp_in != stdin) fclose(fp_in);
+      free(key);
+      return(job->status = 1);
+   }
+   
+   if((ctx = AnsiCreate(mode)) == NULL)
+   {
+      fprintf(msg,"No memory to convert %s\n",job->in);
+      job->status = 1;
+   }
+   else
+   {
+      AnsiSetThreads(ctx, nthreads);
+      AnsiKeepStats(ctx, stats != NULL);
+      if((status = AnsiConvertStream(ctx, fp_in, fp_out)) != ANSI_OK)
+         job->status = 1;
+      fputs(AnsiMessages(ctx), msg);
+      if(status != ANSI_OK)
+         fprintf(msg,"%s: %s\n",job->in,AnsiStrError(status));
+      else if(stats != NULL)
+         JobStats(stats, ctx, msg, job->in);
+   }
+
+   if(fp_in != stdin) fclose(fp_in);
+   if(!toStdout && fclose(fp_out))
+   {
+      fprintf(msg,"Error writing output file %s\n",job->out);
+      job->status = 1;
+   }
+
+#ifdef POSIX_IO
+   /* V3.5: Put a complete output in place, or throw it away            */
+   if(tmp != NULL)
+   {
+      if(!job->status && rename(tmp, job->out))
+      {
+         fprintf(msg,"Error writing output file %s\n",job->out);
+         job->status = 1;
+      }
+      if(job->status) unlink(tmp);
+      free(tmp);
+   }
+
+   /* V2.7: Keep the conversion for next time                           */
+   if(key != NULL && ctx != NULL && !job->status)
+      CachePut(cache, key, job->out, AnsiMessages(ctx));
+#endif
+   free(key);
+   AnsiDestroy(ctx);
+   
+   return(job->status);
+}
+
+/************************************************************************/
+/*>void JobStats(RUNSTATS *stats, ANSICTX *ctx, FILE *fp, char *file)
+   ------------------------------------------------------------------
+   I/O:     RUNSTATS *stats      Statistics for the run
+   Input:   ANSICTX  *ctx        Context which has converted a file
+            FILE     *fp         Where to write its statistics
+            char     *file       Name of the file
+
+   Writes the statistics for a file and adds them to those for the run.
+
+   16.10.26 Original
+*/
+void JobStats(RUNSTATS *stats, ANSICTX *ctx, FILE *fp, char *file)
+{
+   const ANSISTATS *filestats;
+   
+   if((filestats = AnsiStats(ctx)) == NULL) return;
+   WriteStats(fp, file, filestats);
+   
+#ifdef THREADS
+   pthread_mutex_lock(&stats->lock);
+#endif
+   StatMerge(&stats->total, filestats);
+   stats->files++;
+#ifdef THREADS
+   pthread_mutex_unlock(&stats->lock);
+#endif
+}
+
+/************************************************************************/
+/*>void WriteStats(FILE *fp, char *file, const ANSISTATS *stats)
+   -------------------------------------------------------------
+   Input:   FILE     *fp         Where to write
+            char     *file       Name of the file (or Total)
+            const ANSISTATS *stats  Its statistics
+
+   Writes the statistics for --stats. Times are in milliseconds, as wall
+   clock/processor time.
+
+   16.10.26 Original
+*/
+void WriteStats(FILE *fp, char *file, const ANSISTATS *stats)
+{
+   fprintf(fp,"%s: %lu bytes, %lu lines (%lu interesting), \
+%lu possible definitions\n", file, stats->bytes, stats->lines, 
+           stats->interesting, stats->candidates);
+   fprintf(fp,"   %lu functions (%lu converted), %lu prototypes; \
+%lu parameter searches over %lu bytes\n", stats->accepted, 
+           stats->converted, stats->rejected, stats->findvar, 
+           stats->findbytes);
+   fprintf(fp,"   ms: scan %.2f/%.2f, convert %.2f/%.2f, \
+write %.2f/%.2f, total %.2f/%.2f\n",
+           1e3 * stats->stagewall[ANSI_STAGE_SCAN], 
+           1e3 * stats->stagecpu[ANSI_STAGE_SCAN],
+           1e3 * stats->stagewall[ANSI_STAGE_CONVERT], 
+           1e3 * stats->stagecpu[ANSI_STAGE_CONVERT],
+           1e3 * stats->stagewall[ANSI_STAGE_WRITE], 
+           1e3 * stats->stagecpu[ANSI_STAGE_WRITE],
+           1e3 * stats->wall, 1e3 * stats->cpu);
+}
+
+#ifdef THREADS
+/************************************************************************/
+/*>void ReleaseJob(JOB *job)
+   -------------------------
+   I/O:     JOB      *job        A job which has been run
+
+   Copies anything held for a job to stdout (messages go to stderr if 
+   output is also going to stdout) and closes the temporary files.
+
+   16.10.26 Original
+*/
+void ReleaseJob(JOB *job)
+{
+   FILE  *fp[2],
+         *dest[2];
+   char  buffer[BUFSIZ];
+   int   i;
+   size_t n;
+
+   fp[0]   = job->fp_msg;
+   dest[0] = (job->fp_out != NULL) ? stderr : stdout;
+   fp[1]   = job->fp_out;
+   dest[1] = stdout;
+
+   for(i=0; i<2; i++)
+   {
+      if(fp[i] == NULL) continue;
+      rewind(fp[i]);
+      while((n = fread(buffer, 1, BUFSIZ, fp[i])) > 0)
+         fwrite(buffer, 1, n, dest[i]);
+      fclose(fp[i]);
+   }
+   job->fp_msg = job->fp_out = NULL;
+}
+#endif
+
+/************************************************************************/
+/*>int RunBatch(JOB *jobs, int njobs, int mode, int nworkers, 
+                CACHE *cache, SIGDB *sigdb, RUNSTATS *stats)
+   ----------------------------------------------------------
+   I/O:     JOB      *jobs       Pairs of files to be converted
+   Input:   int      njobs       Number of pairs
+            int      mode        Processing mode
+            int      nworkers    Number of worker threads (0: one per
+                                 processor)
+            CACHE    *cache      Conversion cache (NULL if none)
+            SIGDB    *sigdb      Signature store (NULL if none)
+            RUNSTATS *stats      Statistics to add to (NULL if none)
+   Returns: int                  0 if all OK, 1 if any file failed
+
+   Converts all the files in a batch. With threads, each worker starts
+   with an equal share of the files and, when it runs out, steals half of
+   what is left from another worker. Meanwhile the main thread waits for 
+   each job in turn and writes out anything it has held for stdout, so 
+   output appears in the same order as the files were given.
+   
+   Each file may also be split over as many threads as there are 
+   workers if it's large. There's usually only one such file left at the
+   end, holding everything else up.
+
+   16.10.26 Original
+   16.10.26 Large files are split over nworkers threads
+   16.10.26 Added cache
+   16.10.26 Added sigdb
+   16.10.26 Added stats
+*/
+int RunBatch(JOB *jobs, int njobs, int mode, int nworkers, CACHE *cache,
+             SIGDB *sigdb, RUNSTATS *stats)
+{
+   int      i,
+            nthreads = nworkers,
+            status   = 0;
+#ifdef THREADS
+   POOL      pool;
+   pthread_t *threads;
+   WORKER    *workers;
+   
+   if(nworkers < 1)
+   {
+      long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+      nworkers = (ncpu > 0) ? (int)ncpu : 1;
+   }
+   nthreads = nworkers;
+   if(nworkers > njobs) nworkers = njobs;
+   
+   if(nworkers > 1)
+   {
+      pool.jobs     = jobs;
+      pool.njobs    = njobs;
+      pool.mode     = mode;
+      pool.nworkers = nworkers;
+      pool.nthreads = nthreads;
+      pool.cache    = cache;
+      pool.sigdb    = sigdb;
+      pool.stats    = stats;
+      pool.deque    = (DEQUE *)malloc(nworkers * sizeof(DEQUE));
+      threads       = (pthread_t *)malloc(nworkers * sizeof(pthread_t));
+      workers       = (WORKER *)malloc(nworkers * sizeof(WORKER));
+      
+      if(pool.deque != NULL && threads != NULL && workers != NULL)
+      {
+         pthread_mutex_init(&pool.lock, NULL);
+         pthread_cond_init(&pool.cond, NULL);
+         
+         /* Give each worker an equal share to start with               */
+         for(i=0; i<nworkers; i++)
+         {
+            pthread_mutex_init(&pool.deque[i].lock, NULL);
+            pool.deque[i].head = (int)((long)njobs * i / nworkers);
+            pool.deque[i].tail = (int)((long)njobs * (i+1) / nworkers);
+         }
+         
+         for(i=0; i<nworkers; i++)
+         {
+            workers[i].pool = &pool;
+            workers[i].id   = i;
+            if(pthread_create(&threads[i], NULL, Worker, &workers[i]))
+               break;
+         }
+         /* If we couldn't start them all, those we did start will steal
+            the jobs of the rest
+         */
+         if(i == 0) 
+         {
+            nworkers = 1;
+         }
+         else
+         {
+            nworkers = i;
+            
+            /* Write out the results in order as they become ready      */
+            for(i=0; i<njobs; i++)
+            {
+               pthread_mutex_lock(&pool.lock);
+               while(!jobs[i].done)
+                  pthread_cond_wait(&pool.cond, &pool.lock);
+               pthread_mutex_unlock(&pool.lock);
+
+               ReleaseJob(&jobs[i]);
+               if(jobs[i].status) status = 1;
+            }
+            
+            for(i=0; i<nworkers; i++)
+               pthread_join(threads[i], NULL);
+         }
+         
+         for(i=0; i<pool.nworkers; i++)
+            pthread_mutex_destroy(&pool.deque[i].lock);
+         pthread_mutex_destroy(&pool.lock);
+         pthread_cond_destroy(&pool.cond);
+      }
+      else
+      {
+         nworkers = 1;
+      }
+      
+      free(pool.deque);
+      free(threads);
+      free(workers);
+      
+      if(nworkers > 1) return(status);
+   }
+#endif
+
+   /* No threads, so just do them one at a time                         */
+   for(i=0; i<njobs; i++)
+   {
+      if(RunJob(&jobs[i], mode, nthreads, cache, sigdb, stats, FALSE)) 
+         status = 1;
+      fflush(stdout);
+   }
+   
+   return(status);
+}
+
+#ifdef THREADS
+/************************************************************************/
+/*>BOOL NextJob(POOL *pool, int id, int *job)
+   ------------------------------------------
+   I/O:     POOL     *pool       The worker pool
+   Input:   int      id          This worker
+   Output:  int      *job        Job to run next
+   Returns: BOOL                 FALSE if there is nothing left to do
+
+   Takes the next job from the front of this worker's own range. If that
+   is empty, steals the back half of the range of the first worker found
+   with jobs left.
+
+   16.10.26 Original
+*/
+BOOL NextJob(POOL *pool, int id, int *job)
+{
+   DEQUE *own = &pool->deque[id],
+         *victim;
+   int   i,
+         n,
+         head,
+         tail;
+   
+   pthread_mutex_lock(&own->lock);
+   if(own->head < own->tail)
+   {
+      *job = own->head++;
+      pthread_mutex_unlock(&own->lock);
+      return(TRUE);
+   }
+   pthread_mutex_unlock(&own->lock);
+   
+   /* Our own range is empty, so try to steal from another worker       */
+   for(i=1; i<pool->nworkers; i++)
+   {
+      victim = &pool->deque[(id+i) % pool->nworkers];
+      
+      pthread_mutex_lock(&victim->lock);
+      if((n = victim->tail - victim->head) > 0)
+      {
+         /* Take the back half (rounded up)                             */
+         n     = (n + 1) / 2;
+         tail  = victim->tail;
+         head  = tail - n;
+         victim->tail = head;
+         pthread_mutex_unlock(&victim->lock);
+         
+         /* Run the first and keep the rest. Nobody else adds to our
+            range, so it's still empty
+         */
+         pthread_mutex_lock(&own->lock);
+         own->head = head + 1;
+         own->tail = tail;
+         pthread_mutex_unlock(&own->lock);
+         
+         *job = head;
+         return(TRUE);
+      }
+      pthread_mutex_unlock(&victim->lock);
+   }
+   
+   return(FALSE);
+}
+
+/************************************************************************/
+/*>void *Worker(void *arg)
+   -----------------------
+   Input:   void     *arg        The worker's pool and id
+
+   Thread routine for a batch mode worker. Runs jobs until there are none
+   left, flagging each one as done.
+
+   16.10.26 Original
+*/
+void *Worker(void *arg)
+{
+   WORKER   *self = (WORKER *)arg;
+   POOL     *pool = self->pool;
+   int      job;
+   
+   while(NextJob(pool, self->id, &job))
+   {
+      RunJob(&pool->jobs[job], pool->mode, pool->nthreads, pool->cache, 
+             pool->sigdb, pool->stats, TRUE);
+      
+      pthread_mutex_lock(&pool->lock);
+      pool->jobs[job].done = TRUE;
+      pthread_cond_broadcast(&pool->cond);
+      pthread_mutex_unlock(&pool->lock);
+   }
+   
+   return(NULL);
+}
+#endif
+
+/************************************************************************/
+/*>JOB *ReadJobList(FILE *fp, int *njobs, BOOL pairs)
+   --------------------------------------------------
+   Input:   FILE     *fp         File containing NUL terminated names
+            BOOL     pairs       Names are pairs of input and output 
+                                 files, rather than just inputs
+   Output:  int      *njobs      Number of jobs read
+   Returns: JOB *                Array of jobs (NULL if there was an odd
+                                 number of names, none, or no memory)
+
+   Reads pairs of input and output file names, each terminated by a NUL,
+   for batch mode. Without pairs, each name is an input with no output.
+
+   16.10.26 Original
+   16.10.26 Added pairs
+   16.10.26 Reads the list with ReadAll()
+*/
+JOB *ReadJobList(FILE *fp, int *njobs, BOOL pairs)
+{
+   char     *names,
+            *ptr;
+   size_t   used,
+            n;
+   int      nnames = 0,
+            i;
+   JOB      *jobs;
+   
+   if((names = ReadAll(fp, &used)) == NULL) return(NULL);
+   
+   /* Terminate the last name if the list didn't                        */
+   if(used && names[used-1] != '\0') names[used++] = '\0';
+   
+   for(n=0; n<used; n++)
+      if(names[n] == '\0') nnames++;
+   
+   if(nnames == 0 || (pairs && nnames%2))
+   {
+      free(names);
+      return(NULL);
+   }
+   if(pairs) nnames /= 2;
+   if((jobs = (JOB *)calloc(nnames, sizeof(JOB))) == NULL)
+   {
+      free(names);
+      return(NULL);
+   }
+   
+   /* The names are left in place for the life of the program           */
+   for(i=0, ptr=names; i<nnames; i++)
+   {
+      jobs[i].in  = ptr;
+      ptr        += strlen(ptr) + 1;
+      if(pairs)
+      {
+         jobs[i].out = ptr;
+         ptr        += strlen(ptr) + 1;
+      }
+   }
+   
+   *njobs = nnames;
+   return(jobs);
+}
+
+/************************************************************************/
+/*>char *ReadAll(FILE *fp, size_t *len)
+   ------------------------------------
+   Input:   FILE     *fp         File to read
+   Output:  size_t   *len        Bytes read
+   Returns: char *               All of it from malloc(), with room for 
+                                 one more byte (NULL if no memory)
+
+   Slurps a whole file, such as a list of names or an edit script.
+
+   16.10.26 Original, split out of ReadJobList()
+*/
+char *ReadAll(FILE *fp, size_t *len)
+{
+   char     *data = NULL,
+            *ptr;
+   size_t   size  = 0,
+            used  = 0,
+            n;
+   
+   do
+   {
+      if(used == size)
+      {
+         size = size ? 2*size : BUFSIZ;
+         if((ptr = (char *)realloc(data, size+1)) == NULL)
+         {
+            free(data);
+            return(NULL);
+         }
+         data = ptr;
+      }
+      n     = fread(data+used, 1, size-used, fp);
+      used += n;
+   }  while(n);
+   
+   *len = used;
+   return(data);
+}
+
+#ifdef POSIX_IO
+/************************************************************************/
+/*>uint64_t XXHash64(const char *data, size_t len, uint64_t seed)
+   --------------------------------------------------------------
+   Input:   const char *data     Bytes to hash
+            size_t   len         Number of bytes
+            uint64_t seed        Seed for the hash
+   Returns: uint64_t             The hash
+
+   Yann Collet's XXH64 hash, which runs at several GB/s. Used to key the
+   conversion cache. Words are read in the machine's byte order, so the
+   hash is only the standard one on little endian machines; that doesn't
+   matter since a cache is only used on one machine.
+
+   16.10.26 Original
+*/
+#define XXP1 0x9E3779B185EBCA87ULL
+#define XXP2 0xC2B2AE3D27D4EB4FULL
+#define XXP3 0x165667B19E3779F9ULL
+#define XXP4 0x85EBCA77C2B2AE63ULL
+#define XXP5 0x27D4EB2F165667C5ULL
+#define XXROTL(x,r)   (((x) << (r)) | ((x) >> (64 - (r))))
+#define XXROUND(a,w)  ((a) = XXROTL((a) + (w) * XXP2, 31) * XXP1)
+
+uint64_t XXHash64(const char *data, size_t len, uint64_t seed)
+{
+   const unsigned char *p   = (const unsigned char *)data,
+                       *end = p + len;
+   uint64_t h,
+            w,
+            v[4];
+   uint32_t w32;
+   int      i;
+   
+   if(len >= 32)
+   {
+      /* Four lanes of 8 bytes at a time                                */
+      v[0] = seed + XXP1 + XXP2;
+      v[1] = seed + XXP2;
+      v[2] = seed;
+      v[3] = seed - XXP1;
+      for( ; p + 32 <= end; p += 32)
+      {
+         for(i=0; i<4; i++)
+         {
+            memcpy(&w, p + 8*i, 8);
+            XXROUND(v[i], w);
+         }
+      }
+      h = XXROTL(v[0], 1) + XXROTL(v[1], 7) + XXROTL(v[2], 12) + 
+          XXROTL(v[3], 18);
+      for(i=0; i<4; i++)
+      {
+         w = 0;
+         XXROUND(w, v[i]);
+         h = (h ^ w) * XXP1 + XXP4;
+      }
+   }
+   else
+   {
+      h = seed + XXP5;
+   }
+   h += (uint64_t)len;
+   
+   /* The last 31 bytes or less                                         */
+   for( ; p + 8 <= end; p += 8)
+   {
+      memcpy(&v[0], p, 8);
+      w = 0;
+      XXROUND(w, v[0]);
+      h ^= w;
+      h  = XXROTL(h, 27) * XXP1 + XXP4;
+   }
+   if(p + 4 <= end)
+   {
+      memcpy(&w32, p, 4);
+      h ^= (uint64_t)w32 * XXP1;
+      h  = XXROTL(h, 23) * XXP2 + XXP3;
+      p += 4;
+   }
+   for( ; p < end; p++)
+   {
+      h ^= (uint64_t)*p * XXP5;
+      h  = XXROTL(h, 11) * XXP1;
+   }
+   
+   /* Mix the bits                                                      */
+   h ^= h >> 33;
+   h *= XXP2;
+   h ^= h >> 29;
+   h *= XXP3;
+   h ^= h >> 32;
+   return(h);
+}
+
+/************************************************************************/
+/*>BOOL CacheOpen(CACHE *cache, char *dir, long maxmb)
+   ---------------------------------------------------
+   Output:  CACHE    *cache      The cache
+   Input:   char     *dir        Directory to keep it in
+            long     maxmb       Size it's evicted down to, in MB
+   Returns: BOOL                 FALSE if the directory can't be made
+
+   Gets a conversion cache ready, making its directory if need be.
+
+   16.10.26 Original
+*/
+BOOL CacheOpen(CACHE *cache, char *dir, long maxmb)
+{
+   struct stat st;
+   
+   if(mkdir(dir, 0777) && errno != EEXIST)         return(FALSE);
+   if(stat(dir, &st) || !S_ISDIR(st.st_mode))      return(FALSE);
+   
+   cache->dir     = dir;
+   cache->maxsize = maxmb * 1024L * 1024L;
+   cache->hits    = cache->misses = cache->stored = cache->evicted = 0;
+#ifdef THREADS
+   pthread_mutex_init(&cache->lock, NULL);
+#endif
+   return(TRUE);
+}
+
+/************************************************************************/
+/*>void CacheClose(CACHE *cache, FILE *fp)
+   ---------------------------------------
+   I/O:     CACHE    *cache      The cache
+   Input:   FILE     *fp         Where to write statistics (NULL for 
+                                 none)
+
+   Evicts entries if the cache has grown too big, and says how much use
+   it was.
+
+   16.10.26 Original
+*/
+void CacheClose(CACHE *cache, FILE *fp)
+{
+   long  n;
+   
+   CacheEvict(cache);
+   
+   if(fp != NULL)
+   {
+      n = cache->hits + cache->misses;
+      fprintf(fp,"Cache: %ld of %ld files found (%.1f%% hit rate), \
+%ld added, %ld evicted\n", cache->hits, n, 
+              n ? (100.0 * cache->hits) / n : 0.0, 
+              cache->stored, cache->evicted);
+   }
+#ifdef THREADS
+   pthread_mutex_destroy(&cache->lock);
+#endif
+}
+
+/************************************************************************/
+/*>char *CacheName(CACHE *cache, FILE *fp, int mode)
+   -------------------------------------------------
+   Input:   CACHE    *cache      The cache
+            FILE     *fp         Input file
+            int      mode        Processing mode
+   Returns: char *               Path of the cache entry for converting
+                                 this input in this mode, from malloc()
+                                 (NULL if it can't be cached)
+
+   Hashes the input, which must be a regular file so it can be mapped.
+   The hash is seeded with the mode and the version of the program, so a
+   new version doesn't find old conversions. The name is the hash, the 
+   input's size and the mode.
+
+   16.10.26 Original
+*/
+char *CacheName(CACHE *cache, FILE *fp, int mode)
+{
+   struct stat st;
+   char        *map,
+               *name;
+   uint64_t    hash;
+   int         fd = fileno(fp);
+   
+   if(fstat(fd, &st) || !S_ISREG(st.st_mode)) return(NULL);
+   
+   hash = XXHash64(VERSION, strlen(VERSION), (uint64_t)mode);
+   if(st.st_size == 0)
+   {
+      hash = XXHash64("", 0, hash);
+   }
+   else
+   {
+      if((map = (char *)mmap(NULL, (size_t)st.st_size, PROT_READ, 
+                             MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+         return(NULL);
+      hash = XXHash64(map, (size_t)st.st_size, hash);
+      munmap(map, (size_t)st.st_size);
+   }
+   
+   if((name = (char *)malloc(strlen(cache->dir) + 40)) != NULL)
+   {
+      sprintf(name, "%s/%016llx-%lx.%c", cache->dir, 
+              (unsigned long long)hash, (unsigned long)st.st_size,
+              "akp"[mode-1]);
+   }
+   return(name);
+}
+
+/************************************************************************/
+/*>BOOL CacheGet(CACHE *cache, char *name, char *out, FILE *msg, 
+                 int *status)
+   -------------------------------------------------------------
+   I/O:     CACHE    *cache      The cache
+   Input:   char     *name       Path of the entry from CacheName()
+            char     *out        Output file name
+            FILE     *msg        Where to write the messages
+   Output:  int      *status     Set to 1 if the output couldn't be 
+                                 written
+   Returns: BOOL                 TRUE if the entry was found and used
+
+   Looks for a conversion in the cache. An entry is a line giving the 
+   version and the length of the messages, then the messages and then 
+   the output. If it's there, the messages are written out and so is the
+   output, unless the output file already holds exactly that. The entry 
+   is touched so that it's evicted last. A damaged entry is removed.
+
+   16.10.26 Original
+*/
+BOOL CacheGet(CACHE *cache, char *name, char *out, FILE *msg, 
+              int *status)
+{
+   struct stat st;
+   char        *map    = NULL,
+               *nl,
+               header[64],
+               version[16];
+   long        msglen;
+   size_t      hdrlen  = 0,
+               outlen;
+   BOOL        found   = FALSE;
+   FILE        *fp;
+   int         fd;
+   
+   if((fd = open(name, O_RDONLY)) < 0)
+   {
+      CacheCount(cache, misses);
+      return(FALSE);
+   }
+   
+   /* Map it and check the header                                       */
+   if(!fstat(fd, &st) && st.st_size > 0 &&
+      (map = (char *)mmap(NULL, (size_t)st.st_size, PROT_READ, 
+                          MAP_PRIVATE, fd, 0)) != MAP_FAILED &&
+      (nl = (char *)memchr(map, '\n', (st.st_size < (off_t)sizeof(header))
+                           ? (size_t)st.st_size : sizeof(header))) != NULL)
+   {
+      hdrlen = nl + 1 - map;
+      memcpy(header, map, hdrlen - 1);
+      header[hdrlen - 1] = '\0';
+      found = (sscanf(header, "ansi %15s %ld", version, &msglen) == 2 &&
+               !strcmp(version, VERSION) && msglen >= 0 &&
+               hdrlen + msglen <= (size_t)st.st_size);
+   }
+   close(fd);
+   
+   if(found)
+   {
+      fwrite(map + hdrlen, 1, (size_t)msglen, msg);
+      outlen = (size_t)st.st_size - hdrlen - msglen;
+      if(!SameContents(out, map + hdrlen + msglen, outlen))
+      {
+         if((fp = fopen(out, "w")) == NULL)
+         {
+            fprintf(msg,"Unable to open output file %s\n",out);
+            *status = 1;
+         }
+         else if(fwrite(map + hdrlen + msglen, 1, outlen, fp) != outlen ||
+                 fclose(fp))
+         {
+            fprintf(msg,"Error writing output file %s\n",out);
+            *status = 1;
+         }
+      }
+      utime(name, NULL);
+      CacheCount(cache, hits);
+   }
+   else
+   {
+      unlink(name);
+      CacheCount(cache, misses);
+   }
+   
+   if(map != NULL && map != MAP_FAILED) munmap(map, (size_t)st.st_size);
+   return(found);
+}
+
+/************************************************************************/
+/*>void CachePut(CACHE *cache, char *name, char *out, const char *msgs)
+   --------------------------------------------------------------------
+   I/O:     CACHE    *cache      The cache
+   Input:   char     *name       Path of the entry from CacheName()
+            char     *out        Output file name
+            const char *msgs     Messages from the conversion
+
+   Adds a conversion to the cache, copying the output from the file it
+   was written to. The entry is written to a temporary file and renamed,
+   so anyone else using the cache sees all of it or none of it.
+
+   16.10.26 Original
+*/
+void CachePut(CACHE *cache, char *name, char *out, const char *msgs)
+{
+   struct stat st;
+   char        *map = NULL,
+               *tmp,
+               header[64];
+   BOOL        ok   = FALSE;
+   int         fd,
+               ofd;
+   
+   if((tmp = (char *)malloc(strlen(cache->dir) + 16)) == NULL) return;
+   sprintf(tmp, "%s/.tmpXXXXXX", cache->dir);
+   
+   if((ofd = open(out, O_RDONLY)) >= 0 && !fstat(ofd, &st) &&
+      (fd = mkstemp(tmp)) >= 0)
+   {
+      sprintf(header, "ansi %s %ld\n", VERSION, (long)strlen(msgs));
+      ok = WriteAll(fd, header, strlen(header)) &&
+           WriteAll(fd, msgs, strlen(msgs));
+      if(ok && st.st_size > 0)
+      {
+         map = (char *)mmap(NULL, (size_t)st.st_size, PROT_READ, 
+                            MAP_PRIVATE, ofd, 0);
+         ok  = (map != MAP_FAILED) && 
+               WriteAll(fd, map, (size_t)st.st_size);
+         if(map != MAP_FAILED) munmap(map, (size_t)st.st_size);
+      }
+      if(close(fd)) ok = FALSE;
+      
+      if(ok && !rename(tmp, name))
+         CacheCount(cache, stored);
+      else
+         unlink(tmp);
+   }
+   
+   if(ofd >= 0) close(ofd);
+   free(tmp);
+}
+
+/************************************************************************/
+/*>void CacheEvict(CACHE *cache)
+   -----------------------------
+   I/O:     CACHE    *cache      The cache
+
+   If the entries in the cache add up to more than its maximum size, 
+   removes the least recently used until they don't. Only files named 
+   like entries are looked at.
+
+   16.10.26 Original
+*/
+void CacheEvict(CACHE *cache)
+{
+   DIR            *dir;
+   struct dirent  *de;
+   struct stat    st;
+   CACHEENTRY     *entries = NULL,
+                  *ptr;
+   int            n        = 0,
+                  max      = 0,
+                  i;
+   long           total    = 0;
+   
+   if((dir = opendir(cache->dir)) == NULL) return;
+   
+   while((de = readdir(dir)) != NULL)
+   {
+      /* Entries start with 16 hex digits and a -                       */
+      if(strlen(de->d_name) >= sizeof(entries->name) ||
+         strspn(de->d_name, "0123456789abcdef") != 16 ||
+         de->d_name[16] != '-' ||
+         fstatat(dirfd(dir), de->d_name, &st, 0) || !S_ISREG(st.st_mode))
+         continue;
+      
+      if(n == max)
+      {
+         max = max ? 2*max : 256;
+         if((ptr = (CACHEENTRY *)realloc(entries, 
+                                         max * sizeof(CACHEENTRY))) == NULL)
+            break;
+         entries = ptr;
+      }
+      strcpy(entries[n].name, de->d_name);
+#ifdef __linux__
+      entries[n].mtime = st.st_mtim.tv_sec + st.st_mtim.tv_nsec / 1e9;
+#else
+      entries[n].mtime = (double)st.st_mtime;
+#endif
+      entries[n].size  = (long)st.st_size;
+      total += entries[n++].size;
+   }
+   
+   /* Oldest first                                                      */
+   if(total > cache->maxsize)
+   {
+      qsort(entries, n, sizeof(CACHEENTRY), CompareEntries);
+      for(i=0; i<n && total > cache->maxsize; i++)
+      {
+         if(!unlinkat(dirfd(dir), entries[i].name, 0))
+         {
+            total -= entries[i].size;
+            cache->evicted++;
+         }
+      }
+   }
+   
+   closedir(dir);
+   free(entries);
+}
+
+/************************************************************************/
+/*>int CompareEntries(const void *a, const void *b)
+   ------------------------------------------------
+   Input:   const void *a        CACHEENTRY
+            const void *b        CACHEENTRY
+   Returns: int                  <0, 0 or >0 as a was used before, at 
+                                 the same time as, or after b
+
+   qsort() comparison for CacheEvict().
+
+   16.10.26 Original
+*/
+int CompareEntries(const void *a, const void *b)
+{
+   double ta = ((const CACHEENTRY *)a)->mtime,
+          tb = ((const CACHEENTRY *)b)->mtime;
+   
+   return((ta < tb) ? -1 : ((ta > tb) ? 1 : 0));
+}
+
+/************************************************************************/
+/*>BOOL SameContents(char *file, const char *data, size_t len)
+   -----------------------------------------------------------
+   Input:   char     *file       File name
+            const char *data     What it should hold
+            size_t   len         Length of data
+   Returns: BOOL                 TRUE if the file exists and holds
+                                 exactly data
+
+   16.10.26 Original
+*/
+BOOL SameContents(char *file, const char *data, size_t len)
+{
+   struct stat st;
+   char        *map;
+   BOOL        same = FALSE;
+   int         fd;
+   
+   if((fd = open(file, O_RDONLY)) < 0) return(FALSE);
+   
+   if(!fstat(fd, &st) && S_ISREG(st.st_mode) && (size_t)st.st_size == len)
+   {
+      if(len == 0)
+      {
+         same = TRUE;
+      }
+      else if((map = (char *)mmap(NULL, len, PROT_READ, MAP_PRIVATE, 
+                                  fd, 0)) != MAP_FAILED)
+      {
+         same = !memcmp(map, data, len);
+         munmap(map, len);
+      }
+   }
+   
+   close(fd);
+   return(same);
+}
+
+/************************************************************************/
+/*>BOOL WriteAll(int fd, const char *data, size_t len)
+   ---------------------------------------------------
+   Input:   int      fd          File descriptor
+            const char *data     Bytes to write
+            size_t   len         Number of bytes
+   Returns: BOOL                 FALSE if the write failed
+
+   write() which carries on after partial writes and interrupts.
+
+   16.10.26 Original
+*/
+BOOL WriteAll(int fd, const char *data, size_t len)
+{
+   ssize_t n;
+   
+   while(len)
+   {
+      if((n = write(fd, data, len)) < 0)
+      {
+         if(errno == EINTR) continue;
+         return(FALSE);
+      }
+      data += n;
+      len  -= (size_t)n;
+   }
+   return(TRUE);
+}
+
+/************************************************************************/
+/*>BOOL SigOpen(SIGDB *db, char *path)
+   -----------------------------------
+   Output:  SIGDB    *db         The signature store
+   Input:   char     *path       File it's kept in (NULL to keep it in
+                                 memory for this run only)
+   Returns: BOOL                 FALSE if out of memory
+
+   Gets a signature store ready, reading what was kept by the last run.
+   The file starts with a line giving the version. Each file is then a
+   line
+      F <hash> <size> <path length> <message length> <output length> 
+        <number of functions>
+   followed by its path and a \n, its messages and its prototypes. Then
+   there's a line
+      P <start> <end> <offset> <length> <name>
+   for each function, giving where its definition is in the file and 
+   where its prototype is in the prototypes. A file from another version
+   is ignored, so everything is converted again, as is anything after
+   damage.
+
+   16.10.26 Original
+*/
+BOOL SigOpen(SIGDB *db, char *path)
+{
+   struct stat st;
+   ANSIFUNC    *funcs = NULL;
+   char        *text,
+               *ptr,
+               *end,
+               *nl,
+               *fpath,
+               *msgs,
+               version[16];
+   unsigned long long hash;
+   unsigned long pathlen,
+               msglen,
+               outlen,
+               outpos,
+               protolen;
+   long        size,
+               start,
+               fend;
+   ssize_t     n;
+   size_t      got    = 0;
+   int         nfuncs,
+               i,
+               k,
+               fd;
+   BOOL        ok     = TRUE;
+   
+   memset(db, 0, sizeof(SIGDB));
+   db->path = path;
+#ifdef THREADS
+   pthread_mutex_init(&db->lock, NULL);
+#endif
+   if(!SigGrow(db, 0)) return(FALSE);
+   
+   /* Read the whole file. It's picked apart in place                   */
+   if(path == NULL || (fd = open(path, O_RDONLY)) < 0) return(TRUE);
+   if(fstat(fd, &st) || st.st_size == 0)
+   {
+      close(fd);
+      return(TRUE);
+   }
+   if((text = (char *)malloc((size_t)st.st_size + 1)) == NULL)
+   {
+      close(fd);
+      return(FALSE);
+   }
+   while(got < (size_t)st.st_size &&
+         ((n = read(fd, text + got, (size_t)st.st_size - got)) > 0 ||
+          (n < 0 && errno == EINTR)))
+   {
+      if(n > 0) got += (size_t)n;
+   }
+   close(fd);
+   end  = text + got;
+   *end = '\0';
+   
+   if((nl = strchr(text, '\n')) == NULL ||
+      sscanf(text, "ansi-sigdb %15s", version) != 1 || 
+      strcmp(version, VERSION))
+   {
+      free(text);
+      return(TRUE);
+   }
+   
+   for(ptr=nl+1; ptr<end && ok; )
+   {
+      /* The file's line, path, messages and prototypes                 */
+      if((nl = strchr(ptr, '\n')) == NULL) break;
+      *nl = '\0';
+      if(sscanf(ptr, "F %llx %ld %lu %lu %lu %d", &hash, &size, &pathlen,
+                &msglen, &outlen, &nfuncs) != 6 || nfuncs < 0 ||
+         pathlen + msglen + outlen + 1 > (unsigned long)(end - nl - 1))
+         break;
+      fpath = nl + 1;
+      msgs  = fpath + pathlen + 1;
+      ptr   = msgs + msglen + outlen;
+      if(fpath[pathlen] != '\n') break;
+      fpath[pathlen] = '\0';
+      
+      /* Its functions                                                  */
+      if(nfuncs && (funcs = (ANSIFUNC *)malloc(nfuncs * sizeof(ANSIFUNC)))
+         == NULL)
+      {
+         ok = FALSE;
+         break;
+      }
+      for(i=0; i<nfuncs; i++, ptr=nl+1)
+      {
+         if((nl = strchr(ptr, '\n')) == NULL) break;
+         *nl = '\0';
+         k   = 0;
+         if(sscanf(ptr, "P %ld %ld %lu %lu %n", &start, &fend, &outpos,
+                   &protolen, &k) != 4 || !k || !ptr[k] || 
+            outpos + protolen > outlen)
+            break;
+         funcs[i].name   = ptr + k;
+         funcs[i].start  = start;
+         funcs[i].end    = fend;
+         funcs[i].line   = 0;
+         funcs[i].outpos = funcs[i].protopos = (size_t)outpos;
+         funcs[i].outlen = funcs[i].protolen = (size_t)protolen;
+      }
+      
+      if(i == nfuncs)
+         ok = SigAddFile(db, fpath, (uint64_t)hash, size, msgs, msglen,
+                         msgs + msglen, outlen, funcs, nfuncs);
+      free(funcs);
+      funcs = NULL;
+      if(i < nfuncs) break;
+   }
+   
+   /* What we read is as it was, so doesn't need saving again           */
+   db->changed = FALSE;
+   free(text);
+   return(ok);
+}
+
+/************************************************************************/
+/*>void SigClose(SIGDB *db, FILE *fp)
+   ----------------------------------
+   I/O:     SIGDB    *db         The signature store, which is freed
+   Input:   FILE     *fp         Where to write statistics (NULL for 
+                                 none)
+
+   Says how much use the signature store was and frees it. Call 
+   SigSave() first to keep it.
+
+   16.10.26 Original
+*/
+void SigClose(SIGDB *db, FILE *fp)
+{
+   SIGFILE  *file,
+            *next;
+   long     i;
+   
+   if(fp != NULL)
+   {
+      fprintf(fp,"Signatures: %ld of %ld files unchanged, %ld functions \
+in %ld files kept\n", db->reused, db->reused + db->parsed, db->nfuncs,
+              db->nfiles);
+   }
+   
+   for(i=0; i<db->filebuckets; i++)
+   {
+      for(file=db->files[i]; file!=NULL; file=next)
+      {
+         next = file->next;
+         free(file->path);
+         free(file->funcs);
+         free(file);
+      }
+   }
+   free(db->files);
+   free(db->funcs);
+#ifdef THREADS
+   pthread_mutex_destroy(&db->lock);
+#endif
+}
+
+/************************************************************************/
+/*>BOOL SigSave(SIGDB *db)
+   -----------------------
+   I/O:     SIGDB    *db         The signature store
+   Returns: BOOL                 FALSE if it couldn't be written
+
+   Writes the signature store back to its file, if it has one and it has
+   changed, in the form read by SigOpen(). Files which no longer exist 
+   are dropped first. It's written to a temporary file and renamed, so 
+   it's never left half written.
+
+   16.10.26 Original
+*/
+BOOL SigSave(SIGDB *db)
+{
+   struct stat st;
+   SIGFILE     *file,
+               *next;
+   SIGFUNC     *func;
+   FILE        *fp;
+   char        *tmp;
+   long        i;
+   int         j,
+               fd;
+   BOOL        ok;
+   
+   if(db->path == NULL) return(TRUE);
+   
+   for(i=0; i<db->filebuckets; i++)
+   {
+      for(file=db->files[i]; file!=NULL; file=next)
+      {
+         next = file->next;
+         if(stat(file->path, &st) && errno == ENOENT)
+            SigRemoveFile(db, file);
+      }
+   }
+   if(!db->changed) return(TRUE);
+   
+   if((tmp = (char *)malloc(strlen(db->path) + 16)) == NULL) 
+      return(FALSE);
+   sprintf(tmp, "%s.tmpXXXXXX", db->path);
+   if((fd = mkstemp(tmp)) < 0 || (fp = fdopen(fd, "w")) == NULL)
+   {
+      if(fd >= 0)
+      {
+         close(fd);
+         unlink(tmp);
+      }
+      free(tmp);
+      return(FALSE);
+   }
+   
+   fprintf(fp, "ansi-sigdb %s\n", VERSION);
+   for(i=0; i<db->filebuckets; i++)
+   {
+      for(file=db->files[i]; file!=NULL; file=file->next)
+      {
+         fprintf(fp, "F %016llx %ld %lu %lu %lu %d\n%s\n", file->hash,
+                 file->size, (unsigned long)strlen(file->path),
+                 (unsigned long)file->msglen, 
+                 (unsigned long)file->outlen, file->nfuncs, file->path);
+         fwrite(file->msgs, 1, file->msglen, fp);
+         fwrite(file->out, 1, file->outlen, fp);
+         for(j=0; j<file->nfuncs; j++)
+         {
+            func = &file->funcs[j];
+            fprintf(fp, "P %ld %ld %lu %lu %s\n", func->start, func->end,
+                    (unsigned long)(func->proto - file->out),
+                    (unsigned long)func->protolen, func->name);
+         }
+      }
+   }
+   
+   ok = !ferror(fp);
+   if(fclose(fp)) ok = FALSE;
+   if(ok && rename(tmp, db->path)) ok = FALSE;
+   if(!ok) unlink(tmp);
+   else    db->changed = FALSE;
+   free(tmp);
+   return(ok);
+}
+
+/************************************************************************/
+/*>int SigJob(JOB *job, SIGDB *db, int mode, int nthreads, 
+                RUNSTATS *stats, FILE *msg, BOOL hold)
+   -------------------------------------------------------------------
+   I/O:     JOB      *job        The file to make prototypes for, and 
+                                 where to write them (if anywhere)
+            SIGDB    *db         The signature store
+            RUNSTATS *stats      Statistics to add to (NULL if none)
+   Input:   int      mode        MakeProtos, or MakeANSI to convert the
+                                 file as well
+            int      nthreads    Threads to split a large file over
+            FILE     *msg        Where to write messages
+            BOOL     hold        Hold standard output in a temporary
+                                 file so it can be written out in order
+                                 later
+   Returns: int                  0 if all OK, 1 on error
+
+   Makes the prototypes for a file, as RunJob() would, using the 
+   signature store. If the store has the file with the same contents,
+   its prototypes and messages are taken from there. Otherwise it's 
+   converted in memory and the store is updated with its functions. 
+   An output file which is already the same is left alone. With 
+   MakeANSI, the output is the converted file and the prototypes are 
+   made while converting it, so it's always converted.
+
+   16.10.26 Original
+   16.10.26 Added stats
+   16.10.26 The output is written with --stats too
+   16.10.26 Added mode
+*/
+int SigJob(JOB *job, SIGDB *db, int mode, int nthreads, 
+           RUNSTATS *stats, FILE *msg, BOOL hold)
+{
+   struct stat st;
+   SIGFILE     *file;
+   ANSICTX     *ctx   = NULL;
+   FILE        *fp;
+   char        *map   = NULL,
+               *out   = NULL,
+               *msgs  = NULL;
+   size_t      outlen = 0,
+               msglen = 0;
+   uint64_t    hash;
+   int         fd,
+               status = ANSI_OK;
+   
+   if((fd = open(job->in, O_RDONLY)) < 0 || fstat(fd, &st) ||
+      !S_ISREG(st.st_mode) ||
+      (st.st_size > 0 &&
+       (map = (char *)mmap(NULL, (size_t)st.st_size, PROT_READ, 
+                           MAP_PRIVATE, fd, 0)) == MAP_FAILED))
+   {
+      fprintf(msg,"Unable to read input file %s\n",job->in);
+      if(fd >= 0) close(fd);
+      return(job->status = 1);
+   }
+   close(fd);
+   if(st.st_size == 0) map = NULL;
+   
+   hash = SigHash(map, (size_t)st.st_size);
+   
+   /* Take a copy of what's kept if the file hasn't changed             */
+   SigLock(db);
+   if(mode == MakeProtos &&
+      (file = SigFindFile(db, job->in)) != NULL && file->hash == hash &&
+      file->size == (long)st.st_size)
+   {
+      if((out = (char *)malloc(file->outlen + file->msglen + 1)) != NULL)
+      {
+         memcpy(out, file->out, file->outlen);
+         memcpy(out + file->outlen, file->msgs, file->msglen);
+         outlen = file->outlen;
+         msglen = file->msglen;
+         msgs   = out + outlen;
+         db->reused++;
+      }
+   }
+   SigUnlock(db);
+   
+   /* Otherwise convert it and keep its functions                       */
+   if(out == NULL)
+   {
+      if((ctx = AnsiCreate(mode)) == NULL)
+      {
+         status = ANSI_ENOMEM;
+      }
+      else
+      {
+         AnsiSetThreads(ctx, nthreads);
+         AnsiKeepFunctions(ctx, TRUE);
+         AnsiKeepStats(ctx, stats != NULL);
+         if(mode == MakeANSI) AnsiKeepPrototypes(ctx, TRUE);
+         status = AnsiConvertBuffer(ctx, (map != NULL) ? map : "", 
+                                    (size_t)st.st_size, &out, &outlen);
+         msgs   = (char *)AnsiMessages(ctx);
+         msglen = strlen(msgs);
+         if(status == ANSI_OK &&
+            !SigKeep(db, job->in, hash, (long)st.st_size, ctx, out, 
+                     outlen, FALSE))
+            status = ANSI_ENOMEM;
+      }
+   }
+   if(map != NULL) munmap(map, (size_t)st.st_size);
+   
+   fwrite(msgs, 1, msglen, msg);
+   if(status != ANSI_OK)
+   {
+      fprintf(msg,"%s: %s\n",job->in,AnsiStrError(status));
+      job->status = 1;
+   }
+   else if(ctx != NULL && stats != NULL)
+   {
+      JobStats(stats, ctx, msg, job->in);
+   }
+   
+   if(!job->status && job->out != NULL && 
+      (!strcmp(job->out, "-") || !SameContents(job->out, out, outlen)))
+   {
+      if(!strcmp(job->out, "-"))
+         fp = hold ? (job->fp_out = tmpfile()) : stdout;
+      else
+         fp = fopen(job->out, "w");
+      
+      if(fp == NULL)
+      {
+         fprintf(msg,"Unable to open output file %s\n",job->out);
+         job->status = 1;
+      }
+      else
+      {
+         if(fwrite(out, 1, outlen, fp) != outlen) 
+            job->status = 1;
+         if(fp != stdout && fp != job->fp_out && fclose(fp))
+            job->status = 1;
+         if(job->status)
+            fprintf(msg,"Error writing output file %s\n",job->out);
+      }
+   }
+   
+   free(out);
+   AnsiDestroy(ctx);
+   return(job->status);
+}
+
+/************************************************************************/
+/*>uint64_t SigHash(const char *map, size_t size)
+   ----------------------------------------------
+   Input:   const char *map      Contents of a file
+            size_t   size        Its size
+   Returns: uint64_t             Hash it's kept under in the signature
+                                 store
+
+   The hash is seeded with VERSION and MakeProtos, as for the cache, 
+   whichever way the prototypes were made since they're the same.
+
+   16.10.26 Original, split out of SigJob()
+*/
+uint64_t SigHash(const char *map, size_t size)
+{
+   uint64_t hash;
+   
+   hash = XXHash64(VERSION, strlen(VERSION), (uint64_t)MakeProtos);
+   return(XXHash64(map, size, hash));
+}
+
+/************************************************************************/
+/*>BOOL SigKeep(SIGDB *db, const char *path, uint64_t hash, long size,
+                ANSICTX *ctx, const char *out, size_t outlen, 
+                BOOL written)
+   -------------------------------------------------------------------
+   I/O:     SIGDB    *db         The signature store
+   Input:   const char *path     File which has been converted
+            uint64_t hash        Its hash from SigHash()
+            long     size        Its size
+            ANSICTX  *ctx        Context which converted it, keeping the
+                                 functions
+            const char *out      The output, which is the prototypes 
+            size_t   outlen      unless they were kept separately
+            BOOL     written     The output has replaced the file (-i),
+                                 so hash and size are the output's
+   Returns: BOOL                 FALSE if out of memory
+
+   Puts a file's functions, prototypes and messages in the signature 
+   store. They're the same whether they came from MakeProtos or were
+   made alongside a conversion to ANSI. If the file is now the output, 
+   each function's definition is where it was written in the output.
+
+   16.10.26 Original, split out of SigJob()
+   16.10.26 Added written
+*/
+BOOL SigKeep(SIGDB *db, const char *path, uint64_t hash, long size,
+             ANSICTX *ctx, const char *out, size_t outlen, BOOL written)
+{
+   const ANSIFUNC *funcs;
+   ANSIFUNC *moved = NULL;
+   const char *protos,
+            *msgs;
+   size_t   protolen;
+   int      nfuncs,
+            i;
+   BOOL     ok;
+   
+   if((protos = AnsiPrototypes(ctx, &protolen)) == NULL)
+   {
+      protos   = out;
+      protolen = outlen;
+   }
+   funcs = AnsiFunctions(ctx, &nfuncs);
+   msgs  = AnsiMessages(ctx);
+   
+   if(written && nfuncs)
+   {
+      if((moved = (ANSIFUNC *)malloc(nfuncs * sizeof(ANSIFUNC))) == NULL)
+         return(FALSE);
+      memcpy(moved, funcs, nfuncs * sizeof(ANSIFUNC));
+      for(i=0; i<nfuncs; i++)
+      {
+         moved[i].start = (long)moved[i].outpos;
+         moved[i].end   = (long)(moved[i].outpos + moved[i].outlen) - 1;
+      }
+      funcs = moved;
+   }
+   
+   SigLock(db);
+   ok = SigAddFile(db, path, hash, size, msgs, strlen(msgs), protos, 
+                   protolen, funcs, nfuncs);
+   db->parsed++;
+   SigUnlock(db);
+   free(moved);
+   return(ok);
+}
+
+/************************************************************************/
+/*>BOOL SigHeader(SIGDB *db, JOB *jobs, int njobs, char *header, 
+                  int layout)
+   -------------------------------------------------------------
+   Input:   SIGDB    *db         The signature store
+            JOB      *jobs       Files whose prototypes are wanted
+            int      njobs       Number of files
+            char     *header     Header file to write
+            int      layout      HDR_GROUP, HDR_SORT and HDR_NOSTATIC
+   Returns: BOOL                 FALSE if it couldn't be written
+
+   Writes the prototypes of a set of files to one header from the 
+   signature store. Files which failed are left out. A prototype which 
+   is the same as one already written is left out too; they're found by
+   their XXH64 hashes. Prototypes are in the order they were found 
+   unless sorted by name, or grouped under a comment naming their file,
+   or both. static functions go in a section of their own at the end,
+   if they aren't left out. If the header is already the same it's left
+   alone, so it isn't rebuilt by make.
+
+   16.10.26 Original
+   16.10.26 Added layout. Leaves out repeated prototypes
+*/
+BOOL SigHeader(SIGDB *db, JOB *jobs, int njobs, char *header, int layout)
+{
+   SIGFILE  *file;
+   SIGFUNC  *func,
+            **seen   = NULL;
+   HDRPROTO *protos  = NULL;
+   OUTBUF   out;
+   FILE     *fp;
+   uint64_t hash,
+            *hashes  = NULL;
+   long     nseen    = 1,
+            slot;
+   int      nprotos  = 0,
+            total    = 0,
+            section  = 0,
+            group    = -1,
+            i,
+            j;
+   BOOL     ok       = TRUE,
+            isstatic;
+   
+   for(i=0; i<njobs; i++)
+   {
+      if(!jobs[i].status && (file = SigFindFile(db, jobs[i].in)) != NULL)
+         total += file->nfuncs;
+   }
+   
+   /* A table of the prototypes kept, by hash, which is never more than
+      half full
+   */
+   while(nseen < 2L*total) nseen *= 2;
+   memset(&out, 0, sizeof(OUTBUF));
+   protos = (HDRPROTO *)malloc((total ? total : 1) * sizeof(HDRPROTO));
+   seen   = (SIGFUNC **)calloc(nseen, sizeof(SIGFUNC *));
+   hashes = (uint64_t *)malloc(nseen * sizeof(uint64_t));
+   if(protos == NULL || seen == NULL || hashes == NULL || 
+      !OutOpen(&out, NULL, 65536))
+   {
+      ok = FALSE;
+      goto done;
+   }
+   
+   for(i=0; i<njobs; i++)
+   {
+      if(jobs[i].status || (file = SigFindFile(db, jobs[i].in)) == NULL)
+         continue;
+      
+      for(j=0, func=file->funcs; j<file->nfuncs; j++, func++)
+      {
+         if((isstatic = IsStatic(func->proto, func->protolen)) &&
+            (layout & HDR_NOSTATIC))
+            continue;
+         
+         hash = XXHash64(func->proto, func->protolen, 0);
+         for(slot = (long)(hash & (uint64_t)(nseen-1)); 
+             seen[slot] != NULL;
+             slot = (slot + 1) & (nseen-1))
+         {
+            if(hashes[slot] == hash && 
+               seen[slot]->protolen == func->protolen &&
+               !memcmp(seen[slot]->proto, func->proto, func->protolen))
+               break;
+         }
+         if(seen[slot] != NULL) continue;
+         seen[slot]   = func;
+         hashes[slot] = hash;
+         
+         protos[nprotos].func    = func;
+         protos[nprotos].name    = (layout & HDR_SORT) ? func->name : "";
+         protos[nprotos].section = isstatic;
+         protos[nprotos].group   = (layout & HDR_GROUP) ? i : 0;
+         protos[nprotos].order   = nprotos;
+         nprotos++;
+      }
+   }
+   
+   qsort(protos, nprotos, sizeof(HDRPROTO), CompareProtos);
+   
+   for(i=0; i<nprotos; i++)
+   {
+      func = protos[i].func;
+      if(protos[i].section != section)
+      {
+         section = protos[i].section;
+         if(out.len) OutString(&out, "\n");
+         OutString(&out, "/* static functions */\n");
+         group = -1;
+      }
+      if((layout & HDR_GROUP) && protos[i].group != group)
+      {
+         group = protos[i].group;
+         if(out.len) OutString(&out, "\n");
+         OutString(&out, "/* ");
+         OutWrite(&out, func->file->path, strlen(func->file->path));
+         OutString(&out, " */\n");
+      }
+      OutWrite(&out, func->proto, func->protolen);
+   }
+   if(out.error)
+   {
+      ok = FALSE;
+      goto done;
+   }
+   
+   if(!SameContents(header, out.buffer, out.len))
+   {
+      if((fp = fopen(header, "w")) == NULL)
+         ok = FALSE;
+      else if(fwrite(out.buffer, 1, out.len, fp) != out.len)
+         ok = FALSE;
+      if(fp != NULL && fclose(fp)) 
+         ok = FALSE;
+   }
+   
+done:
+   free(out.buffer);
+   free(protos);
+   free(seen);
+   free(hashes);
+   return(ok);
+}
+
+/************************************************************************/
+/*>BOOL IsStatic(const char *proto, size_t len)
+   --------------------------------------------
+   Input:   const char *proto    A prototype
+            size_t   len         Its length
+   Returns: BOOL                 Whether it starts with static
+
+   16.10.26 Original
+*/
+BOOL IsStatic(const char *proto, size_t len)
+{
+   while(len && isSpace(*proto))
+   {
+      proto++;
+      len--;
+   }
+   return((BOOL)(len > 6 && !strncmp(proto, "static", 6) && 
+                 !isIdentChar(proto[6])));
+}
+
+/************************************************************************/
+/*>int CompareProtos(const void *a, const void *b)
+   -----------------------------------------------
+   Input:   const void *a        HDRPROTO
+            const void *b        HDRPROTO
+   Returns: int                  <0, 0 or >0 as a goes before, with or
+                                 after b in a header
+
+   qsort() comparison for SigHeader(). static functions come last, then
+   prototypes are by file, by name and in the order they were found, as
+   the HDRPROTOs have been set up.
+
+   16.10.26 Original
+*/
+int CompareProtos(const void *a, const void *b)
+{
+   const HDRPROTO *pa = (const HDRPROTO *)a,
+                  *pb = (const HDRPROTO *)b;
+   int            cmp;
+   
+   if(pa->section != pb->section) return(pa->section - pb->section);
+   if(pa->group   != pb->group)   return(pa->group   - pb->group);
+   if((cmp = strcmp(pa->name, pb->name)) != 0) return(cmp);
+   return(pa->order - pb->order);
+}
+
+/************************************************************************/
+/*>int SigQuery(SIGDB *db, char *name, FILE *fp)
+   ---------------------------------------------
+   Input:   SIGDB    *db         The signature store
+            char     *name       Function name
+            FILE     *fp         Where to write the definitions
+   Returns: int                  0 if any were found, 1 if not
+
+   Writes the file, offset in the file and prototype of each definition
+   of a function in the signature store.
+
+   16.10.26 Original
+*/
+int SigQuery(SIGDB *db, char *name, FILE *fp)
+{
+   SIGFUNC  *func;
+   int      found = 1;
+   
+   for(func=db->funcs[SigBucket(name, db->funcbuckets)]; func!=NULL;
+       func=func->next)
+   {
+      if(!strcmp(func->name, name))
+      {
+         fprintf(fp, "%s:%ld: ", func->file->path, func->start);
+         fwrite(func->proto, 1, func->protolen, fp);
+         found = 0;
+      }
+   }
+   return(found);
+}
+
+/************************************************************************/
+/*>BOOL SigAddFile(SIGDB *db, const char *path, uint64_t hash, long size,
+                   const char *msgs, size_t msglen, const char *out,
+                   size_t outlen, const ANSIFUNC *funcs, int nfuncs)
+   ----------------------------------------------------------------------
+   I/O:     SIGDB    *db         The signature store
+   Input:   const char *path     File the prototypes were made from
+            uint64_t hash        Hash of its contents
+            long     size        Its size
+            const char *msgs     Messages from converting it
+            size_t   msglen      Their length
+            const char *out      The prototypes made
+            size_t   outlen      Their length
+            const ANSIFUNC *funcs Its functions, with their prototypes
+                                 in out
+            int      nfuncs      Number of functions
+   Returns: BOOL                 FALSE if out of memory, in which case
+                                 the store is unchanged
+
+   Adds a file to the signature store, replacing what it had for it 
+   before. Everything is copied.
+
+   16.10.26 Original
+*/
+BOOL SigAddFile(SIGDB *db, const char *path, uint64_t hash, long size,
+                const char *msgs, size_t msglen, const char *out,
+                size_t outlen, const ANSIFUNC *funcs, int nfuncs)
+{
+   SIGFILE  *file,
+            *old;
+   SIGFUNC  *func;
+   char     *text;
+   size_t   len     = strlen(path) + msglen + outlen + 2;
+   long     bucket;
+   int      i;
+   
+   for(i=0; i<nfuncs; i++)
+      len += strlen(funcs[i].name) + 1;
+   
+   if(!SigGrow(db, nfuncs)) return(FALSE);
+   file  = (SIGFILE *)calloc(1, sizeof(SIGFILE));
+   text  = (char *)malloc(len);
+   func  = (SIGFUNC *)malloc((nfuncs ? nfuncs : 1) * sizeof(SIGFUNC));
+   if(file == NULL || text == NULL || func == NULL)
+   {
+      free(file);
+      free(text);
+      free(func);
+      return(FALSE);
+   }
+   
+   if((old = SigFindFile(db, path)) != NULL) SigRemoveFile(db, old);
+   
+   /* Path, messages and prototypes, then the names                     */
+   file->path   = text;
+   strcpy(text, path);
+   text        += strlen(path) + 1;
+   file->msgs   = text;
+   file->msglen = msglen;
+   memcpy(text, msgs, msglen);
+   text[msglen] = '\0';
+   text        += msglen + 1;
+   file->out    = text;
+   file->outlen = outlen;
+   memcpy(text, out, outlen);
+   text        += outlen;
+   file->hash   = hash;
+   file->size   = size;
+   file->funcs  = func;
+   file->nfuncs = nfuncs;
+   
+   for(i=0; i<nfuncs; i++, func++)
+   {
+      func->file     = file;
+      func->name     = text;
+      strcpy(text, funcs[i].name);
+      text          += strlen(text) + 1;
+      func->proto    = file->out + funcs[i].protopos;
+      func->protolen = funcs[i].protolen;
+      func->start    = funcs[i].start;
+      func->end      = funcs[i].end;
+      
+      bucket = SigBucket(func->name, db->funcbuckets);
+      func->next = db->funcs[bucket];
+      db->funcs[bucket] = func;
+   }
+   db->nfuncs += nfuncs;
+   
+   bucket = SigBucket(file->path, db->filebuckets);
+   file->next = db->files[bucket];
+   db->files[bucket] = file;
+   db->nfiles++;
+   
+   db->changed = TRUE;
+   return(TRUE);
+}
+
+/************************************************************************/
+/*>void SigRemoveFile(SIGDB *db, SIGFILE *file)
+   --------------------------------------------
+   I/O:     SIGDB    *db         The signature store
+            SIGFILE  *file       A file in it, which is freed
+
+   Removes a file and its functions from the signature store.
+
+   16.10.26 Original
+*/
+void SigRemoveFile(SIGDB *db, SIGFILE *file)
+{
+   SIGFUNC  **fp;
+   SIGFILE  **pp;
+   int      i;
+   
+   for(i=0; i<file->nfuncs; i++)
+   {
+      for(fp = &db->funcs[SigBucket(file->funcs[i].name, db->funcbuckets)];
+          *fp != &file->funcs[i]; 
+          fp = &(*fp)->next) ;
+      *fp = (*fp)->next;
+   }
+   db->nfuncs -= file->nfuncs;
+   
+   for(pp = &db->files[SigBucket(file->path, db->filebuckets)];
+       *pp != file;
+       pp = &(*pp)->next) ;
+   *pp = file->next;
+   db->nfiles--;
+   
+   free(file->path);
+   free(file->funcs);
+   free(file);
+   db->changed = TRUE;
+}
+
+/************************************************************************/
+/*>SIGFILE *SigFindFile(SIGDB *db, const char *path)
+   -------------------------------------------------
+   Input:   SIGDB    *db         The signature store
+            const char *path     Path of a file
+   Returns: SIGFILE *            What's kept for it (NULL if nothing)
+
+   16.10.26 Original
+*/
+SIGFILE *SigFindFile(SIGDB *db, const char *path)
+{
+   SIGFILE  *file;
+   
+   for(file=db->files[SigBucket(path, db->filebuckets)]; file!=NULL; 
+       file=file->next)
+   {
+      if(!strcmp(file->path, path)) return(file);
+   }
+   return(NULL);
+}
+
+/************************************************************************/
+/*>BOOL SigGrow(SIGDB *db, int nfuncs)
+   -----------------------------------
+   I/O:     SIGDB    *db         The signature store
+   Input:   int      nfuncs      Functions about to be added with a file
+   Returns: BOOL                 FALSE if out of memory
+
+   Makes the hash tables bigger, if need be, so that there are at least
+   as many buckets as files or functions once another file is added.
+   Called with empty tables to make them in the first place.
+
+   16.10.26 Original
+*/
+BOOL SigGrow(SIGDB *db, int nfuncs)
+{
+   SIGFILE  **files,
+            *file,
+            *nextfile;
+   SIGFUNC  **funcs,
+            *func,
+            *nextfunc;
+   long     nbuckets,
+            i,
+            b;
+   
+   if(db->files == NULL || db->nfiles + 1 > db->filebuckets)
+   {
+      nbuckets = db->filebuckets ? 2*db->filebuckets : SIGFILES0;
+      if((files = (SIGFILE **)calloc(nbuckets, sizeof(SIGFILE *))) == NULL)
+         return(FALSE);
+      for(i=0; i<db->filebuckets; i++)
+      {
+         for(file=db->files[i]; file!=NULL; file=nextfile)
+         {
+            nextfile   = file->next;
+            b          = SigBucket(file->path, nbuckets);
+            file->next = files[b];
+            files[b]   = file;
+         }
+      }
+      free(db->files);
+      db->files       = files;
+      db->filebuckets = nbuckets;
+   }
+   
+   if(db->funcs == NULL || db->nfuncs + nfuncs > db->funcbuckets)
+   {
+      nbuckets = db->funcbuckets ? db->funcbuckets : SIGFUNCS0;
+      while(nbuckets < db->nfuncs + nfuncs) nbuckets *= 2;
+      if(db->funcs != NULL && nbuckets == db->funcbuckets) nbuckets *= 2;
+      if((funcs = (SIGFUNC **)calloc(nbuckets, sizeof(SIGFUNC *))) == NULL)
+         return(FALSE);
+      for(i=0; i<db->funcbuckets; i++)
+      {
+         for(func=db->funcs[i]; func!=NULL; func=nextfunc)
+         {
+            nextfunc   = func->next;
+            b          = SigBucket(func->name, nbuckets);
+            func->next = funcs[b];
+            funcs[b]   = func;
+         }
+      }
+      free(db->funcs);
+      db->funcs       = funcs;
+      db->funcbuckets = nbuckets;
+   }
+   return(TRUE);
+}
+
+/************************************************************************/
+/*>long SigBucket(const char *key, long nbuckets)
+   ----------------------------------------------
+   Input:   const char *key      A path or function name
+            long     nbuckets    Size of the hash table (a power of 2)
+   Returns: long                 The bucket it goes in
+
+   16.10.26 Original
+*/
+long SigBucket(const char *key, long nbuckets)
+{
+   return((long)(XXHash64(key, strlen(key), 0) & (uint64_t)(nbuckets-1)));
+}
+
+/************************************************************************/
+/*>int ServerRun(char *path, int nworkers, FILE *msg)
+   --------------------------------------------------
+   Input:   char     *path       Unix domain socket to listen on
+            int      nworkers    Threads answering requests (<1 for one
+                                 per processor)
+            FILE     *msg        Where to write messages
+   Returns: int                  0 after a quit request, 1 on error
+
+   Runs ansi as a server, so an editor or a hook can have code converted
+   without starting a process each time. This thread accepts the
+   connections and polls those which are waiting for a request; when
+   one sends a request, the connection is handed to one of the threads,
+   which answers that one request and hands it back. So a client may
+   keep its connection open between requests without holding a thread.
+   Each thread keeps a context for each mode so nothing is set up per
+   request. A connection may send any number of requests, each a line
+      buffer <mode> <length>     followed by that many bytes of input
+      file <mode> <path>         to convert a file
+      stats                      for the counts and request times
+      quit                       to stop the server
+   where <mode> is a (to ANSI), k (to K&R) or p (prototypes). A request
+   line, with its newline, may be at most MAXREQUEST-1 characters, and
+   a buffer at most MAXINPUT bytes. Each is answered with a line
+      <status> <output length> <message length>
+   followed by the output and the messages. The status is 0 or one of
+   the ANSI_ errors; a longer line gets ANSI_EREAD. A client which
+   sends a length which isn't a number up to MAXINPUT, or which stops
+   for SERVERWAIT seconds part way through a request, is disconnected.
+   After a quit, the requests being answered are finished and every
+   connection is closed.
+
+   16.10.26 Original
+   16.10.26 Documented the limit on a request line
+   16.10.26 Requests, rather than connections, are handed to the threads
+*/
+int ServerRun(char *path, int nworkers, FILE *msg)
+{
+   struct sockaddr_un addr;
+   struct stat st;
+   struct pollfd *pfds   = NULL;
+   SERVER   server;
+   CONN     **polled     = NULL,
+            *conn;
+   ANSICTX  *ctx[3]      = {NULL, NULL, NULL};
+   char     drain[64];
+   double   cpu;
+   int      npoll,
+            maxpoll      = 0,
+            nthreads     = 0,
+            i;
+   BOOL     quit         = FALSE;
+#ifdef THREADS
+   pthread_t *threads    = NULL;
+#endif
+   
+   if(strlen(path) >= sizeof(addr.sun_path))
+   {
+      fprintf(msg,"Socket name %s is too long\n",path);
+      return(1);
+   }
+   
+   /* A socket left by a server which was killed is replaced            */
+   if(!stat(path, &st) && S_ISSOCK(st.st_mode)) unlink(path);
+   
+   memset(&server, 0, sizeof(SERVER));
+   memset(&addr, 0, sizeof(addr));
+   server.wake[0] = server.wake[1] = -1;
+   addr.sun_family = AF_UNIX;
+   strcpy(addr.sun_path, path);
+   if((server.listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+      bind(server.listenfd, (struct sockaddr *)&addr, sizeof(addr)) ||
+      listen(server.listenfd, SOMAXCONN) ||
+      pipe(server.wake))
+   {
+      fprintf(msg,"Unable to listen on socket %s\n",path);
+      if(server.listenfd >= 0) close(server.listenfd);
+      return(1);
+   }
+   
+   /* Neither a connection which goes before it's accepted nor a full
+      pipe may block this thread
+   */
+   fcntl(server.listenfd, F_SETFL, O_NONBLOCK);
+   fcntl(server.wake[0], F_SETFL, O_NONBLOCK);
+   fcntl(server.wake[1], F_SETFL, O_NONBLOCK);
+   
+   /* A client which goes away mustn't take us with it                  */
+   signal(SIGPIPE, SIG_IGN);
+   StatClock(&server.started, &cpu);
+   
+#ifdef THREADS
+   if(nworkers < 1)
+   {
+      long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+      nworkers = (ncpu > 0) ? (int)ncpu : 1;
+   }
+   pthread_mutex_init(&server.lock, NULL);
+   pthread_cond_init(&server.ready, NULL);
+   if((threads = (pthread_t *)malloc(nworkers * sizeof(pthread_t)))
+      != NULL)
+   {
+      for(nthreads=0; nthreads<nworkers; nthreads++)
+      {
+         if(pthread_create(&threads[nthreads], NULL, ServerWorker,
+                           &server))
+            break;
+      }
+   }
+#else
+   (void)nworkers;
+#endif
+   
+   while(!quit)
+   {
+      /* Poll for new connections, the threads handing connections back,
+         and requests on those which are waiting
+      */
+      SigLock(&server);
+      if(maxpoll < server.maxconns + 2)
+      {
+         maxpoll = server.maxconns + 2;
+         free(pfds);
+         free(polled);
+         pfds   = (struct pollfd *)malloc(maxpoll * sizeof(struct pollfd));
+         polled = (CONN **)malloc(maxpoll * sizeof(CONN *));
+      }
+      if(pfds == NULL || polled == NULL)
+      {
+         SigUnlock(&server);
+         fprintf(msg,"No memory for the server's connections\n");
+         break;
+      }
+      pfds[0].fd     = server.listenfd;
+      pfds[1].fd     = server.wake[0];
+      pfds[0].events = pfds[1].events = POLLIN;
+      for(i=0, npoll=2; i<server.maxconns; i++)
+      {
+         if((conn = server.conns[i]) != NULL && conn->state == CONN_IDLE)
+         {
+            pfds[npoll].fd     = conn->fd;
+            pfds[npoll].events = POLLIN;
+            polled[npoll++]    = conn;
+         }
+      }
+      quit = server.quit;
+      SigUnlock(&server);
+      if(quit) break;
+   
+      if(poll(pfds, npoll, -1) < 0)
+      {
+         if(errno == EINTR) continue;
+         fprintf(msg,"Error polling socket %s\n",path);
+         break;
+      }
+      if(pfds[1].revents)
+         while(read(server.wake[0], drain, sizeof(drain)) > 0) ;
+      if(pfds[0].revents & POLLIN)
+         ServerAccept(&server);
+   
+      /* Those sent a request (or closed) go to the threads              */
+      SigLock(&server);
+      for(i=2; i<npoll; i++)
+      {
+         if(pfds[i].revents)
+         {
+            polled[i]->state = CONN_READY;
+            server.nready++;
+         }
+      }
+#ifdef THREADS
+      pthread_cond_broadcast(&server.ready);
+#endif
+      SigUnlock(&server);
+   
+      /* With no threads, this one answers them                         */
+      if(!nthreads)
+      {
+         while((conn = ServerTake(&server, FALSE)) != NULL)
+         {
+            ServerAnswer(&server, conn, ctx);
+            ServerGive(&server, conn);
+         }
+      }
+   }
+   
+   /* Stop the threads once they've answered what they're doing         */
+   SigLock(&server);
+   server.quit = TRUE;
+#ifdef THREADS
+   pthread_cond_broadcast(&server.ready);
+#endif
+   SigUnlock(&server);
+#ifdef THREADS
+   for(i=0; i<nthreads; i++)
+      pthread_join(threads[i], NULL);
+   free(threads);
+   pthread_cond_destroy(&server.ready);
+   pthread_mutex_destroy(&server.lock);
+#endif
+   
+   for(i=0; i<server.maxconns; i++)
+   {
+      if(server.conns[i] != NULL)
+      {
+         close(server.conns[i]->fd);
+         free(server.conns[i]);
+      }
+   }
+   for(i=0; i<3; i++)
+      AnsiDestroy(ctx[i]);
+   free(server.conns);
+   free(pfds);
+   free(polled);
+   close(server.wake[0]);
+   close(server.wake[1]);
+   close(server.listenfd);
+   unlink(path);
+   return(quit ? 0 : 1);
+}
+
+/************************************************************************/
+/*>void ServerAccept(SERVER *server)
+   ---------------------------------
+   I/O:     SERVER   *server     The server, given the new connection
+
+   Accepts a connection, which waits for a request. Reads and writes on
+   it time out after SERVERWAIT seconds, so a client which stops part
+   way through a request can't keep a thread.
+
+   16.10.26 Original
+*/
+void ServerAccept(SERVER *server)
+{
+   struct timeval wait;
+   CONN     *conn,
+            **conns;
+   int      fd,
+            slot,
+            max;
+   
+   if((fd = accept(server->listenfd, NULL, NULL)) < 0)
+      return;
+   
+   /* Some systems give it the listening socket's O_NONBLOCK             */
+   fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+   wait.tv_sec  = SERVERWAIT;
+   wait.tv_usec = 0;
+   setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+   setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &wait, sizeof(wait));
+   
+   if((conn = (CONN *)calloc(1, sizeof(CONN))) == NULL)
+   {
+      close(fd);
+      return;
+   }
+   conn->fd    = fd;
+   conn->state = CONN_IDLE;
+   
+   SigLock(server);
+   for(slot=0; slot<server->maxconns && server->conns[slot] != NULL;
+       slot++) ;
+   if(slot == server->maxconns)
+   {
+      max = server->maxconns ? 2*server->maxconns : 16;
+      if((conns = (CONN **)realloc(server->conns, max * sizeof(CONN *)))
+         == NULL)
+      {
+         SigUnlock(server);
+         close(fd);
+         free(conn);
+         return;
+      }
+      memset(conns + server->maxconns, 0,
+             (max - server->maxconns) * sizeof(CONN *));
+      server->conns    = conns;
+      server->maxconns = max;
+   }
+   conn->slot          = slot;
+   server->conns[slot] = conn;
+   server->connections++;
+   SigUnlock(server);
+}
+
+#  ifdef THREADS
+/************************************************************************/
+/*>void *ServerWorker(void *arg)
+   -----------------------------
+   Input:   void     *arg        The SERVER
+
+   Thread routine for the server. Answers a request on each connection
+   it's handed until the server quits.
+
+   16.10.26 Original
+   16.10.26 Answers requests rather than connections
+*/
+void *ServerWorker(void *arg)
+{
+   SERVER   *server = (SERVER *)arg;
+   ANSICTX  *ctx[3] = {NULL, NULL, NULL};
+   CONN     *conn;
+   int      i;
+   
+   while((conn = ServerTake(server, TRUE)) != NULL)
+   {
+      ServerAnswer(server, conn, ctx);
+      ServerGive(server, conn);
+   }
+   
+   for(i=0; i<3; i++)
+      AnsiDestroy(ctx[i]);
+   return(NULL);
+}
+
+#  endif
+
+/************************************************************************/
+/*>CONN *ServerTake(SERVER *server, BOOL wait)
+   -------------------------------------------
+   I/O:     SERVER   *server     The server
+   Input:   BOOL     wait        Wait for a connection with a request
+   Returns: CONN *               One to answer, NULL if there are none
+                                 or the server is quitting
+
+   Takes the next connection with a request. They're taken in turn, so
+   a client sending requests one after another can't keep out others.
+
+   16.10.26 Original
+*/
+CONN *ServerTake(SERVER *server, BOOL wait)
+{
+   CONN     *conn = NULL;
+   int      i;
+   
+   SigLock(server);
+#ifdef THREADS
+   while(wait && !server->nready && !server->quit)
+      pthread_cond_wait(&server->ready, &server->lock);
+#else
+   (void)wait;
+#endif
+   if(server->nready && !server->quit)
+   {
+      for(i=0; i<server->maxconns; i++)
+      {
+         conn = server->conns[(server->next + i) % server->maxconns];
+         if(conn != NULL && conn->state == CONN_READY) break;
+      }
+      server->next = (conn->slot + 1) % server->maxconns;
+      conn->state  = CONN_BUSY;
+      server->nready--;
+   }
+   SigUnlock(server);
+   return(conn);
+}
+
+/************************************************************************/
+/*>void ServerGive(SERVER *server, CONN *conn)
+   -------------------------------------------
+   I/O:     SERVER   *server     The server
+            CONN     *conn       Connection which has been answered
+
+   Hands a connection back after a request. It's closed if the client
+   went, or was disconnected, or the server is quitting. If the client
+   has already sent more, it's ready for another thread at once; if
+   not, the polling thread is woken to wait for its next request.
+
+   16.10.26 Original
+*/
+void ServerGive(SERVER *server, CONN *conn)
+{
+   SigLock(server);
+   if(conn->broken || server->quit)
+   {
+      server->conns[conn->slot] = NULL;
+      close(conn->fd);
+      free(conn);
+   }
+   else if(conn->pos < conn->len)
+   {
+      conn->state = CONN_READY;
+      server->nready++;
+#ifdef THREADS
+      pthread_cond_signal(&server->ready);
+#endif
+   }
+   else
+   {
+      conn->state = CONN_IDLE;
+   }
+   SigUnlock(server);
+   
+   /* It doesn't matter if the pipe is full; the poll will still end    */
+   if(write(server->wake[1], "", 1) < 0) return;
+}
+
+/************************************************************************/
+/*>void ServerAnswer(SERVER *server, CONN *conn, ANSICTX **ctx)
+   ------------------------------------------------------------
+   I/O:     SERVER   *server     The server
+            CONN     *conn       Connection with a request
+            ANSICTX  **ctx       This thread's context for each mode,
+                                 created as needed
+
+   Reads one request from a connection, answers it and times it. A
+   request line which doesn't fit in MAXREQUEST is skipped and answered
+   with an error, rather than being carried out in pieces. If the
+   client has gone, or the connection can't be used again, it's marked
+   broken.
+
+   16.10.26 Original, from ServerClient()
+*/
+void ServerAnswer(SERVER *server, CONN *conn, ANSICTX **ctx)
+{
+   char     line[MAXREQUEST],
+            reply[64],
+            *out   = NULL;
+   const char *msgs = "";
+   size_t   outlen = 0,
+            msglen;
+   double   start,
+            end,
+            cpu;
+   unsigned long usec;
+   int      status,
+            got,
+            bin;
+   
+   if(!(got = ServerLine(conn, line, sizeof(line))))
+      return;
+   
+   StatClock(&start, &cpu);
+   if(got < 0)
+   {
+      msgs   = "Request is too long\n";
+      status = ANSI_EREAD;
+   }
+   else
+   {
+      status = ServerRequest(server, conn, line, ctx, &out, &outlen,
+                             &msgs);
+   }
+   if(status < 0)
+   {
+      /* The connections are closed once we've answered                 */
+      SigLock(server);
+      server->quit = TRUE;
+      SigUnlock(server);
+      status = ANSI_OK;
+   }
+   msglen = strlen(msgs);
+   
+   sprintf(reply, "%d %lu %lu\n", status, (unsigned long)outlen,
+           (unsigned long)msglen);
+   if(!WriteAll(conn->fd, reply, strlen(reply)) ||
+      !WriteAll(conn->fd, out, outlen) ||
+      !WriteAll(conn->fd, msgs, msglen))
+      conn->broken = TRUE;
+   free(out);
+   
+   /* Count it and its time                                             */
+   StatClock(&end, &cpu);
+   usec = (unsigned long)((end - start) * 1e6);
+   for(bin=0; bin<LATENCYBINS-1 && (1UL << bin) < usec; bin++) ;
+   SigLock(server);
+   server->requests++;
+   if(status != ANSI_OK) server->failed++;
+   server->bytesout += outlen;
+   server->busy     += end - start;
+   server->latency[bin]++;
+   SigUnlock(server);
+}
+
+/************************************************************************/
+/*>int ServerLine(CONN *conn, char *line, size_t size)
+   ---------------------------------------------------
+   I/O:     CONN     *conn       Connection to read from
+   Output:  char     *line       The line, with its \n
+   Input:   size_t   size        Size of line
+   Returns: int                  1 if a line was read, -1 if it was too
+                                 long (and has been skipped), 0 if the
+                                 connection has ended
+
+   Reads a request line.
+
+   16.10.26 Original
+*/
+int ServerLine(CONN *conn, char *line, size_t size)
+{
+   char     *nl;
+   size_t   len;
+   BOOL     toolong = FALSE;
+   
+   for(;;)
+   {
+      if((nl = (char *)memchr(conn->buffer + conn->pos, '\n',
+                              conn->len - conn->pos)) != NULL)
+      {
+         len        = nl + 1 - (conn->buffer + conn->pos);
+         toolong    = (BOOL)(toolong || len >= size);
+         if(!toolong)
+         {
+            memcpy(line, conn->buffer + conn->pos, len);
+            line[len] = '\0';
+         }
+         conn->pos += len;
+         return(toolong ? -1 : 1);
+      }
+   
+      /* Too long already, so keep only what follows                    */
+      if(conn->len - conn->pos >= size - 1)
+      {
+         toolong   = TRUE;
+         conn->pos = conn->len;
+      }
+      if(!ServerFill(conn)) return(0);
+   }
+}
+
+/************************************************************************/
+/*>BOOL ServerRead(CONN *conn, char *data, size_t len)
+   ---------------------------------------------------
+   I/O:     CONN     *conn       Connection to read from
+   Output:  char     *data       What was read (NULL to skip it)
+   Input:   size_t   len         Bytes to read
+
+   Returns: BOOL                 FALSE if the connection ended first
+
+   Reads the input which follows a request. Once what's buffered is
+   used, it's read straight into data.
+
+   16.10.26 Original
+*/
+BOOL ServerRead(CONN *conn, char *data, size_t len)
+{
+   ssize_t  got;
+   size_t   n;
+   
+   while(len)
+   {
+      if(conn->pos == conn->len)
+      {
+         if(data == NULL)
+         {
+            if(!ServerFill(conn)) return(FALSE);
+         }
+         else
+         {
+            if((got = read(conn->fd, data, len)) < 0 && errno == EINTR)
+               continue;
+            if(got <= 0)
+            {
+               conn->broken = TRUE;
+               return(FALSE);
+            }
+            data += got;
+            len  -= (size_t)got;
+            continue;
+         }
+      }
+   
+      n = conn->len - conn->pos;
+      if(n > len) n = len;
+      if(data != NULL)
+      {
+         memcpy(data, conn->buffer + conn->pos, n);
+         data += n;
+      }
+      conn->pos += n;
+      len       -= n;
+   }
+   return(TRUE);
+}
+
+/************************************************************************/
+/*>BOOL ServerFill(CONN *conn)
+   ---------------------------
+   I/O:     CONN     *conn       Connection to read from
+   Returns: BOOL                 FALSE if it has ended (and is now
+                                 broken)
+
+   Reads more of a connection into its buffer, after what's there.
+
+   16.10.26 Original
+*/
+BOOL ServerFill(CONN *conn)
+{
+   ssize_t  got;
+   
+   if(conn->pos)
+   {
+      memmove(conn->buffer, conn->buffer + conn->pos,
+              conn->len - conn->pos);
+      conn->len -= conn->pos;
+      conn->pos  = 0;
+   }
+   do
+   {
+      got = read(conn->fd, conn->buffer + conn->len,
+                 sizeof(conn->buffer) - conn->len);
+   }  while(got < 0 && errno == EINTR);
+   if(got <= 0)
+   {
+      conn->broken = TRUE;
+      return(FALSE);
+   }
+   conn->len += (size_t)got;
+   return(TRUE);
+}
+
+/************************************************************************/
+/*>int ServerRequest(SERVER *server, CONN *conn, char *line, ANSICTX **ctx,
+                     char **out, size_t *outlen, const char **msgs)
+   ---------------------------------------------------------------------
+   I/O:     SERVER   *server     The server
+            CONN     *conn       Connection, for any input which follows
+            ANSICTX  **ctx       This thread's context for each mode
+   Input:   char     *line       The request
+   Output:  char     **out       Output to return, from malloc()
+            size_t   *outlen     Its length
+            const char **msgs    Messages to return
+   Returns: int                  ANSI_OK or an ANSI_ error; -1 for quit
+
+   Carries out one request. See ServerRun(). The input of a buffer
+   request is always read, even if the request fails, so the next line
+   is the next request; if its length can't be used the connection is
+   marked broken instead.
+
+   16.10.26 Original
+   16.10.26 The length is checked before anything else, and the input
+            read whatever happens
+*/
+int ServerRequest(SERVER *server, CONN *conn, char *line, ANSICTX **ctx,
+                  char **out, size_t *outlen, const char **msgs)
+{
+   struct stat st;
+   char     verb[16],
+            *in     = NULL,
+            *arg,
+            *end,
+            *nl;
+   size_t   inlen   = 0,
+            modelen;
+   unsigned long len;
+   int      mode    = 0,
+            fd,
+            k       = 0,
+            status;
+   BOOL     mapped  = FALSE;
+   
+   if((nl = strchr(line, '\n')) != NULL) *nl = '\0';
+   if(sscanf(line, "%15s %n", verb, &k) != 1)
+   {
+      *msgs = "Empty request\n";
+      return(ANSI_EREAD);
+   }
+   
+   if(!strcmp(verb, "stats"))
+   {
+      if((*out = ServerStats(server, outlen)) == NULL)
+         return(ANSI_ENOMEM);
+      return(ANSI_OK);
+   }
+   if(!strcmp(verb, "quit"))
+      return(-1);
+   if(strcmp(verb, "buffer") && strcmp(verb, "file"))
+   {
+      *msgs = "Requests are buffer, file, stats or quit\n";
+      return(ANSI_EREAD);
+   }
+   
+   /* buffer and file have a mode and then a length or path             */
+   arg     = line + k;
+   modelen = strcspn(arg, " \t");
+   if(modelen == 1)
+   {
+      switch(*arg)
+      {
+      case 'a': mode = MakeANSI;   break;
+      case 'k': mode = MakeKR;     break;
+      case 'p': mode = MakeProtos; break;
+      }
+   }
+   for(arg+=modelen; isBlank(*arg); arg++) ;
+   
+   if(!strcmp(verb, "buffer"))
+   {
+      /* Without a length we don't know where the next request starts   */
+      errno = 0;
+      len   = isdigit(*arg) ? strtoul(arg, &end, 10) : 0;
+      if(isdigit(*arg))
+         while(isBlank(*end)) end++;
+      if(!isdigit(*arg) || errno || *end || len > MAXINPUT)
+      {
+         conn->broken = TRUE;
+         *msgs = "Length is not a number, or is too big\n";
+         return(ANSI_EREAD);
+      }
+   
+      if(!mode || (len && (in = (char *)malloc(len)) == NULL))
+      {
+         if(!ServerRead(conn, NULL, len))
+         {
+            *msgs = "Input is short\n";
+            return(ANSI_EREAD);
+         }
+         if(!mode)
+         {
+            *msgs = "Mode must be a, k or p\n";
+            return(ANSI_EMODE);
+         }
+         return(ANSI_ENOMEM);
+      }
+      if(!ServerRead(conn, in, len))
+      {
+         free(in);
+         *msgs = "Input is short\n";
+         return(ANSI_EREAD);
+      }
+      inlen = len;
+   }
+   else
+   {
+      if(!mode)
+      {
+         *msgs = "Mode must be a, k or p\n";
+         return(ANSI_EMODE);
+      }
+      if((fd = open(arg, O_RDONLY)) < 0 || fstat(fd, &st) ||
+         !S_ISREG(st.st_mode) ||
+         (st.st_size > 0 &&
+          (in = (char *)mmap(NULL, (size_t)st.st_size, PROT_READ,
+                             MAP_PRIVATE, fd, 0)) == MAP_FAILED))
+      {
+         if(fd >= 0) close(fd);
+         *msgs = "Unable to read input file\n";
+         return(ANSI_EREAD);
+      }
+      close(fd);
+      inlen  = (size_t)st.st_size;
+      mapped = (BOOL)(inlen > 0);
+   }
+   
+   if(ctx[mode-1] == NULL && (ctx[mode-1] = AnsiCreate(mode)) == NULL)
+   {
+      status = ANSI_ENOMEM;
+   }
+   else
+   {
+      status = AnsiConvertBuffer(ctx[mode-1], (in != NULL) ? in : "",
+                                 inlen, out, outlen);
+      *msgs  = AnsiMessages(ctx[mode-1]);
+   }
+   
+   if(mapped) munmap(in, inlen);
+   else       free(in);
+   
+   SigLock(server);
+   server->bytesin += inlen;
+   SigUnlock(server);
+   return(status);
+}
+
+/************************************************************************/
+/*>char *ServerStats(SERVER *server, size_t *len)
+   ----------------------------------------------
+   Input:   SERVER   *server     The server
+   Output:  size_t   *len        Length of the text
+   Returns: char *               Text from malloc(), NULL if no memory
+
+   Describes what the server has done for a stats request: a line each
+   for the seconds it's been up and spent on requests, the connections,
+   requests, failures and bytes in and out, then a line
+      latency <us> <requests>
+   for each power of 2 up to the slowest request, giving the number 
+   which took no more than that many microseconds (and more than half 
+   as many).
+
+   16.10.26 Original
+*/
+char *ServerStats(SERVER *server, size_t *len)
+{
+   char     *text,
+            *ptr;
+   double   now,
+            cpu;
+   int      i,
+            last;
+   
+   if((text = (char *)malloc(256 + 48 * LATENCYBINS)) == NULL)
+      return(NULL);
+   StatClock(&now, &cpu);
+   
+   SigLock(server);
+   ptr  = text;
+   ptr += sprintf(ptr, "uptime %.3f\n", now - server->started);
+   ptr += sprintf(ptr, "busy %.3f\n", server->busy);
+   ptr += sprintf(ptr, "connections %lu\n", server->connections);
+   ptr += sprintf(ptr, "requests %lu\n", server->requests);
+   ptr += sprintf(ptr, "failed %lu\n", server->failed);
+   ptr += sprintf(ptr, "bytes_in %lu\n", server->bytesin);
+   ptr += sprintf(ptr, "bytes_out %lu\n", server->bytesout);
+   for(last=LATENCYBINS-1; last>0 && !server->latency[last]; last--) ;
+   for(i=0; i<=last; i++)
+      ptr += sprintf(ptr, "latency %lu %lu\n", 1UL << i, 
+                     server->latency[i]);
+   SigUnlock(server);
+   
+   *len = (size_t)(ptr - text);
+   return(text);
+}
+/************************************************************************/
+/*>FILE *OpenAtomic(char *file, int like, char **tmp)
+   --------------------------------------------------
+   Input:   char     *file       File to be written
+            int      like        Open file whose permissions it's given
+   Output:  char     **tmp       Temporary file opened, from malloc()
+   Returns: FILE *               The temporary file, NULL on error
+
+   Opens a temporary file in the same directory as a file so that, once
+   written, it can be renamed to replace it all at once.
+
+   16.10.26 Original
+*/
+FILE *OpenAtomic(char *file, int like, char **tmp)
+{
+   struct stat st;
+   FILE     *fp = NULL;
+   int      fd;
+   
+   if((*tmp = (char *)malloc(strlen(file) + 8)) == NULL) return(NULL);
+   sprintf(*tmp, "%s.XXXXXX", file);
+   if((fd = mkstemp(*tmp)) >= 0)
+   {
+      /* mkstemp() makes it private                                     */
+      if(!fstat(like, &st)) fchmod(fd, st.st_mode & 0777);
+      if((fp = fdopen(fd, "w")) == NULL)
+      {
+         close(fd);
+         unlink(*tmp);
+      }
+   }
+   if(fp == NULL)
+   {
+      free(*tmp);
+      *tmp = NULL;
+   }
+   return(fp);
+}
+
+/************************************************************************/
+/*>int CheckJob(JOB *job, int mode, FILE *msg)
+   -------------------------------------------
+   I/O:     JOB      *job        The file to check
+   Input:   int      mode        Processing mode
+            FILE     *msg        Where to write messages
+   Returns: int                  0 if the file needs no conversion, 1 if
+                                 it does or on error
+
+   Checks a file for --check. It's mapped and AnsiCheckBuffer() looks
+   for a definition which would be converted, stopping at the first. If
+   there is one, its file:line and first line are written to msg as a
+   compiler would.
+
+   16.10.26 Original
+*/
+int CheckJob(JOB *job, int mode, FILE *msg)
+{
+   struct stat st;
+   ANSICTX  *ctx    = NULL;
+   char     *map    = NULL,
+            *bol,
+            *eol;
+   long     line    = 0,
+            i;
+   int      fd,
+            status  = ANSI_ENOMEM;
+   
+   if((fd = open(job->in, O_RDONLY)) < 0 || fstat(fd, &st) ||
+      (st.st_size > 0 &&
+       (map = (char *)mmap(NULL, (size_t)st.st_size, PROT_READ, 
+                           MAP_PRIVATE, fd, 0)) == MAP_FAILED))
+   {
+      fprintf(msg,"Unable to read input file %s\n",job->in);
+      if(fd >= 0) close(fd);
+      return(job->status = 1);
+   }
+   if(st.st_size == 0) map = NULL;
+   
+   if((ctx = AnsiCreate(mode)) != NULL)
+   {
+      status = AnsiCheckBuffer(ctx, (map != NULL) ? map : "", 
+                               (size_t)st.st_size, &line);
+      fputs(AnsiMessages(ctx), msg);
+   }
+   
+   if(status != ANSI_OK)
+   {
+      fprintf(msg,"%s: %s\n",job->in,AnsiStrError(status));
+      job->status = 1;
+   }
+   else if(line)
+   {
+      /* Show the first line of the definition                         */
+      for(bol=map, i=1; i<line; i++)
+         bol = (char *)memchr(bol, '\n', map + st.st_size - bol) + 1;
+      if((eol = (char *)memchr(bol, '\n', map + st.st_size - bol)) == NULL)
+         eol = map + st.st_size;
+      fprintf(msg,"%s:%ld: %.*s\n", job->in, line, (int)(eol - bol), bol);
+      job->status = 1;
+   }
+   
+   if(map != NULL) munmap(map, (size_t)st.st_size);
+   close(fd);
+   AnsiDestroy(ctx);
+   return(job->status);
+}
+
+/************************************************************************/
+/*>BOOL AlreadyConverted(ANSICTX *ctx, const char *map, size_t size)
+   -----------------------------------------------------------------
+   I/O:     ANSICTX  *ctx        Conversion context (MakeANSI or MakeKR)
+   Input:   const char *map      A file's contents (NULL if it's empty)
+            size_t   size        Its size
+   Returns: BOOL                 TRUE if converting it would give exactly
+                                 the same
+
+   Pre-scans a file with AnsiCheckBuffer(), which stops at the first 
+   definition which would be changed. As a conversion always ends with 
+   a \n, a file without one at the end needs converting too.
+
+   16.10.26 Original
+*/
+BOOL AlreadyConverted(ANSICTX *ctx, const char *map, size_t size)
+{
+   long     line;
+   
+   if(size == 0) return(TRUE);
+   if(map[size-1] != '\n') return(FALSE);
+   return((BOOL)(AnsiCheckBuffer(ctx, map, size, &line) == ANSI_OK && 
+                 !line));
+}
+
+/************************************************************************/
+/*>BOOL CopyData(int from, int to, const char *map, size_t size)
+   -------------------------------------------------------------
+   Input:   int      from        File to copy, at its start
+            int      to          Empty file to copy it to
+            const char *map      The file mapped
+            size_t   size        Its size
+   Returns: BOOL                 FALSE if it couldn't be written
+
+   Copies a whole file. On Linux, the new file is first made to share 
+   the old one's blocks (a reflink, where the filesystem can) and then 
+   copy_file_range() is tried, so the bytes are moved by the kernel, if
+   at all. Otherwise, or for whatever's left, they're written from the 
+   map.
+
+   16.10.26 Original
+*/
+BOOL CopyData(int from, int to, const char *map, size_t size)
+{
+   size_t   done = 0;
+#ifdef ZERO_COPY
+   loff_t   off  = 0;
+   ssize_t  n;
+   
+   if(size && !ioctl(to, FICLONE, from)) return(TRUE);
+   while(done < size && 
+         (n = copy_file_range(from, &off, to, NULL, size - done, 0)) > 0)
+      done += n;
+#endif
+   return(WriteAll(to, map + done, size - done));
+}
+
+/************************************************************************/
+/*>BOOL CopyJob(JOB *job, int mode, RUNSTATS *stats, FILE *msg)
+   -------------------------------------------------------------
+   I/O:     JOB      *job        The pair of files to convert
+            RUNSTATS *stats      Statistics to add to (NULL if none)
+   Input:   int      mode        Processing mode (not MakeProtos)
+            FILE     *msg        Where to write messages
+   Returns: BOOL                 TRUE if the job has been done, FALSE if
+                                 it must be converted
+
+   Most files are often already in the form wanted. If AlreadyConverted()
+   shows that the input is, it's copied to the output with CopyData() 
+   rather than converted. An output which is the input is left alone.
+
+   16.10.26 Original
+*/
+BOOL CopyJob(JOB *job, int mode, RUNSTATS *stats, FILE *msg)
+{
+   struct stat st,
+               ost;
+   ANSICTX  *ctx    = NULL;
+   FILE     *fp     = NULL;
+   char     *map    = NULL,
+            *tmp    = NULL;
+   int      fd,
+            ofd     = -1;
+   BOOL     same    = FALSE,
+            ok;
+   
+   if((fd = open(job->in, O_RDONLY)) < 0) return(FALSE);
+   if(fstat(fd, &st) || !S_ISREG(st.st_mode) ||
+      (st.st_size > 0 &&
+       (map = (char *)mmap(NULL, (size_t)st.st_size, PROT_READ, 
+                           MAP_PRIVATE, fd, 0)) == MAP_FAILED))
+   {
+      close(fd);
+      return(FALSE);
+   }
+   if(st.st_size == 0) map = NULL;
+   
+   if((ctx = AnsiCreate(mode)) != NULL)
+   {
+      AnsiKeepStats(ctx, stats != NULL);
+      same = AlreadyConverted(ctx, map, (size_t)st.st_size);
+   }
+   
+   if(same)
+   {
+      fputs(AnsiMessages(ctx), msg);
+      if(stats != NULL) JobStats(stats, ctx, msg, job->in);
+      
+      /* Writing over the input would lose it, and it's right anyway    */
+      if(stat(job->out, &ost) || ost.st_dev != st.st_dev || 
+         ost.st_ino != st.st_ino)
+      {
+         if(job->atomic)
+         {
+            if((fp = OpenAtomic(job->out, fd, &tmp)) != NULL)
+               ofd = fileno(fp);
+         }
+         else
+         {
+            ofd = open(job->out, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+         }
+         
+         if(ofd < 0)
+         {
+            fprintf(msg,"Unable to open output file %s\n",job->out);
+            job->status = 1;
+         }
+         else
+         {
+            ok = CopyData(fd, ofd, map, (size_t)st.st_size);
+            if((fp != NULL) ? fclose(fp) : close(ofd)) ok = FALSE;
+            if(tmp != NULL)
+            {
+               if(ok && rename(tmp, job->out)) ok = FALSE;
+               if(!ok) unlink(tmp);
+            }
+            if(!ok)
+            {
+               fprintf(msg,"Error writing output file %s\n",job->out);
+               job->status = 1;
+            }
+         }
+      }
+   }
+   
+   free(tmp);
+   if(map != NULL) munmap(map, (size_t)st.st_size);
+   close(fd);
+   AnsiDestroy(ctx);
+   return(same);
+}
+
+/************************************************************************/
+/*>int InPlaceJob(JOB *job, int mode, int nthreads, SIGDB *sigdb,
+                  RUNSTATS *stats, FILE *msg)
+   -----------------------------------------------------------------
+   I/O:     JOB      *job        The file to convert in place
+            SIGDB    *sigdb      Signature store to keep its prototypes
+                                 in (NULL if none)
+            RUNSTATS *stats      Statistics to add to (NULL if none)
+   Input:   int      mode        Processing mode
+            int      nthreads    Threads to split a large file over
+            FILE     *msg        Where to write messages
+   Returns: int                  0 if all OK, 1 on error
+
+   Converts a file in place for -i. It's converted in memory and only
+   if that's different is it written, to a temporary file beside it 
+   which is renamed over it. So a file which needs no change (such as
+   one which is already ANSI) isn't written at all and keeps its 
+   modification time. A symbolic link is followed. If the file changes
+   while it's being converted it's left alone.
+
+   16.10.26 Original
+   16.10.26 A file which AlreadyConverted() finds needs no change isn't
+            converted at all
+   16.10.26 Added sigdb. The prototypes are made while converting, so
+            the file is always converted
+   16.10.26 A change within the second it was read is noticed where the
+            modification time is kept to the nanosecond
+   16.10.26 A file which is rewritten is kept in sigdb as it now is
+*/
+int InPlaceJob(JOB *job, int mode, int nthreads, SIGDB *sigdb,
+               RUNSTATS *stats, FILE *msg)
+{
+   struct stat st,
+               now;
+   ANSICTX  *ctx    = NULL;
+   FILE     *fp;
+   char     *path,
+            *map    = NULL,
+            *out    = NULL,
+            *tmp    = NULL;
+   size_t   outlen  = 0;
+   int      fd      = -1,
+            status  = ANSI_ENOMEM;
+   BOOL     ok,
+            same    = FALSE;
+   
+   if((path = realpath(job->in, NULL)) == NULL ||
+      (fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) ||
+      !S_ISREG(st.st_mode) ||
+      (st.st_size > 0 &&
+       (map = (char *)mmap(NULL, (size_t)st.st_size, PROT_READ, 
+                           MAP_PRIVATE, fd, 0)) == MAP_FAILED))
+   {
+      fprintf(msg,"Unable to read input file %s\n",job->in);
+      if(fd >= 0) close(fd);
+      free(path);
+      return(job->status = 1);
+   }
+   if(st.st_size == 0) map = NULL;
+   
+   if((ctx = AnsiCreate(mode)) != NULL)
+   {
+      AnsiSetThreads(ctx, nthreads);
+      AnsiKeepStats(ctx, stats != NULL);
+      if(sigdb != NULL)
+      {
+         AnsiKeepFunctions(ctx, TRUE);
+         AnsiKeepPrototypes(ctx, TRUE);
+      }
+      
+      /* V3.8: See whether there's anything to convert first            */
+      if(sigdb == NULL && 
+         (same = AlreadyConverted(ctx, map, (size_t)st.st_size)))
+         status = ANSI_OK;
+      else
+         status = AnsiConvertBuffer(ctx, (map != NULL) ? map : "", 
+                                    (size_t)st.st_size, &out, &outlen);
+      
+      fputs(AnsiMessages(ctx), msg);
+   }
+   
+   if(status != ANSI_OK)
+   {
+      fprintf(msg,"%s: %s\n",job->in,AnsiStrError(status));
+      job->status = 1;
+   }
+   else
+   {
+      if(stats != NULL) JobStats(stats, ctx, msg, job->in);
+      
+      if(!same && (outlen != (size_t)st.st_size || 
+                   (outlen && memcmp(out, map, outlen))))
+      {
+         ok = FALSE;
+         if((fp = OpenAtomic(path, fd, &tmp)) != NULL)
+         {
+            ok = (BOOL)(fwrite(out, 1, outlen, fp) == outlen);
+            if(fclose(fp)) ok = FALSE;
+            
+            /* Don't lose an edit made since we read it                 */
+            if(ok && (stat(path, &now) || now.st_size != st.st_size ||
+                      now.st_mtime != st.st_mtime || 
+#ifdef __linux__
+                      now.st_mtim.tv_nsec != st.st_mtim.tv_nsec ||
+#endif
+                      now.st_ino != st.st_ino))
+            {
+               fprintf(msg,"%s changed while being converted so has "
+                       "been left alone\n",job->in);
+               ok = FALSE;
+               job->status = 1;
+            }
+            else if(ok && !rename(tmp, path))
+            {
+               job->changed = TRUE;
+            }
+            else
+            {
+               ok = FALSE;
+            }
+            if(!ok) unlink(tmp);
+            free(tmp);
+         }
+         if(!ok && !job->status)
+         {
+            fprintf(msg,"Error writing output file %s\n",job->in);
+            job->status = 1;
+         }
+      }
+      
+      /* V4.1: Keep the prototypes made, under what the file now holds  */
+      if(sigdb != NULL && 
+         !(job->changed ? SigKeep(sigdb, job->in, SigHash(out, outlen),
+                                  (long)outlen, ctx, out, outlen, TRUE)
+                        : SigKeep(sigdb, job->in, 
+                                  SigHash(map, (size_t)st.st_size),
+                                  (long)st.st_size, ctx, out, outlen, 
+                                  FALSE)))
+      {
+         fprintf(msg,"%s: %s\n",job->in,AnsiStrError(ANSI_ENOMEM));
+         job->status = 1;
+      }
+   }
+   
+   if(map != NULL) munmap(map, (size_t)st.st_size);
+   close(fd);
+   free(out);
+   free(path);
+   AnsiDestroy(ctx);
+   return(job->status);
+}
+
+/************************************************************************/
+/*>int EditJob(JOB *job, int mode, int nthreads, RUNSTATS *stats, 
+               FILE *msg, BOOL hold)
+   ---------------------------------------------------------------
+   I/O:     JOB      *job        The file to write edits for
+            RUNSTATS *stats      Statistics to add to (NULL if none)
+   Input:   int      mode        Processing mode
+            int      nthreads    Threads to split a large file over
+            FILE     *msg        Where to write messages
+            BOOL     hold        Hold the edits in a temporary file so 
+                                 they can be written out in order later
+   Returns: int                  0 if all OK, 1 on error
+
+   Writes an edit script for a file to stdout for -e. The file is 
+   converted with AnsiEditsOnly(), so only the definitions which change
+   are written, and each becomes a record with WriteEdit(). If the file
+   doesn't end with a \n, a last record adds one, as a conversion 
+   would, by replacing the last byte with itself and a \n (so --apply
+   has a byte to check). A file which AlreadyConverted() finds needs no
+   change has no records at all. For -u, the same edits are written as
+   a unified diff by WriteDiff().
+
+   16.10.26 Original
+   16.10.26 Writes a diff for -u
+   16.10.26 The record adding a \n replaces the last byte
+*/
+int EditJob(JOB *job, int mode, int nthreads, RUNSTATS *stats, 
+            FILE *msg, BOOL hold)
+{
+   struct stat st;
+   const ANSIFUNC *funcs = NULL;
+   ANSICTX  *ctx    = NULL;
+   EDIT     *edits  = NULL;
+   FILE     *fp     = stdout;
+   char     *map    = NULL,
+            *out    = NULL,
+            *last   = NULL,
+            tail[2];
+   size_t   outlen  = 0;
+   long     end     = 0;
+   int      fd,
+            nfuncs  = 0,
+            nedits  = 0,
+            i,
+            status  = ANSI_ENOMEM;
+   
+   if(hold && (fp = job->fp_out = tmpfile()) == NULL)
+   {
+      fprintf(msg,"Unable to create temporary file for %s\n",job->in);
+      return(job->status = 1);
+   }
+   if((fd = open(job->in, O_RDONLY)) < 0 || fstat(fd, &st) ||
+      (st.st_size > 0 &&
+       (map = (char *)mmap(NULL, (size_t)st.st_size, PROT_READ, 
+                           MAP_PRIVATE, fd, 0)) == MAP_FAILED))
+   {
+      fprintf(msg,"Unable to read input file %s\n",job->in);
+      if(fd >= 0) close(fd);
+      return(job->status = 1);
+   }
+   if(st.st_size == 0) map = NULL;
+   
+   if((ctx = AnsiCreate(mode)) != NULL)
+   {
+      AnsiSetThreads(ctx, nthreads);
+      AnsiKeepStats(ctx, stats != NULL);
+      AnsiEditsOnly(ctx, TRUE);
+      if(AlreadyConverted(ctx, map, (size_t)st.st_size))
+         status = ANSI_OK;
+      else
+         status = AnsiConvertBuffer(ctx, map, (size_t)st.st_size, 
+                                    &out, &outlen);
+      fputs(AnsiMessages(ctx), msg);
+   }
+   
+   if(status != ANSI_OK)
+   {
+      fprintf(msg,"%s: %s\n",job->in,AnsiStrError(status));
+      job->status = 1;
+   }
+   else
+   {
+      if(stats != NULL) JobStats(stats, ctx, msg, job->in);
+      
+      /* Each definition is replaced up to the end of the line with its
+         {, including the \n
+      */
+      if(out != NULL) funcs = AnsiFunctions(ctx, &nfuncs);
+      if((edits = (EDIT *)malloc((nfuncs + 1) * sizeof(EDIT))) == NULL)
+      {
+         fprintf(msg,"No memory for the edits to %s\n",job->in);
+         job->status = 1;
+         nfuncs      = 0;
+      }
+      for(i=0; i<nfuncs; i++, nedits++)
+      {
+         end = (funcs[i].end < st.st_size) ? funcs[i].end + 1 
+                                           : funcs[i].end;
+         edits[i].file  = job->in;
+         edits[i].text  = out + funcs[i].outpos;
+         edits[i].len   = funcs[i].outlen;
+         edits[i].start = funcs[i].start;
+         edits[i].end   = end;
+         edits[i].line  = funcs[i].line;
+      }
+      if(edits != NULL && st.st_size && map[st.st_size-1] != '\n' && 
+         end < st.st_size)
+      {
+         /* The last byte is replaced too, so there's a hash to check  */
+         tail[0] = map[st.st_size-1];
+         tail[1] = '\n';
+         edits[nedits].file  = job->in;
+         edits[nedits].text  = tail;
+         edits[nedits].len   = 2;
+         edits[nedits].start = st.st_size - 1;
+         edits[nedits].end   = st.st_size;
+         
+         /* A diff replaces the whole of the last line                  */
+         if(job->diff)
+         {
+            for(end=st.st_size; end>0 && map[end-1] != '\n'; end--) ;
+            edits[nedits].line = nedits ? edits[nedits-1].line + 
+                                 CountLines(map + edits[nedits-1].start,
+                                            map + end)
+                                        : 1 + CountLines(map, map + end);
+            if((last = (char *)malloc(st.st_size - end + 1)) == NULL)
+            {
+               fprintf(msg,"No memory for the edits to %s\n",job->in);
+               job->status = 1;
+               nedits      = 0;
+            }
+            else
+            {
+               memcpy(last, map + end, st.st_size - end);
+               last[st.st_size - end] = '\n';
+               edits[nedits].text  = last;
+               edits[nedits].len   = st.st_size - end + 1;
+               edits[nedits].start = end;
+               nedits++;
+            }
+         }
+         else
+         {
+            nedits++;
+         }
+      }
+      
+      if(job->diff)
+      {
+         WriteDiff(fp, job->in, map, st.st_size, edits, nedits);
+      }
+      else
+      {
+         for(i=0; i<nedits; i++)
+            WriteEdit(fp, job->in, map, edits[i].start, edits[i].end, 
+                      edits[i].text, edits[i].len);
+      }
+      
+      if(ferror(fp))
+      {
+         fprintf(msg,"Error writing edits for %s\n",job->in);
+         job->status = 1;
+      }
+   }
+   
+   if(map != NULL) munmap(map, (size_t)st.st_size);
+   close(fd);
+   free(out);
+   free(edits);
+   free(last);
+   AnsiDestroy(ctx);
+   return(job->status);
+}
+
+/************************************************************************/
+/*>long CountLines(const char *from, const char *to)
+   -------------------------------------------------
+   Input:   const char *from     Start of some text
+            const char *to       The byte after it
+   Returns: long                 Number of \n in it
+
+   16.10.26 Original
+*/
+long CountLines(const char *from, const char *to)
+{
+   long     n = 0;
+   
+   while(from < to && 
+         (from = (const char *)memchr(from, '\n', to - from)) != NULL)
+   {
+      n++;
+      from++;
+   }
+   return(n);
+}
+
+/************************************************************************/
+/*>void DiffLines(FILE *fp, int mark, const char *from, const char *to)
+   --------------------------------------------------------------------
+   Input:   FILE     *fp         Diff being written
+            int      mark        ' ', - or +
+            const char *from     Start of some whole lines
+            const char *to       The byte after them
+
+   Writes lines of a diff hunk, each after the mark. If the last has no
+   \n, diff's note that there was none follows.
+
+   16.10.26 Original
+*/
+void DiffLines(FILE *fp, int mark, const char *from, const char *to)
+{
+   const char *nl;
+   
+   while(from < to)
+   {
+      if((nl = (const char *)memchr(from, '\n', to - from)) == NULL)
+         nl = to - 1;
+      putc(mark, fp);
+      fwrite(from, 1, nl + 1 - from, fp);
+      if(*nl != '\n') fputs("\n\\ No newline at end of file\n", fp);
+      from = nl + 1;
+   }
+}
+
+/************************************************************************/
+/*>void WriteDiff(FILE *fp, const char *file, const char *map, long size,
+                  EDIT *edits, int nedits)
+   ----------------------------------------------------------------------
+   Input:   FILE     *fp         Diff being written
+            const char *file     File edited
+            const char *map      Its contents
+            long     size        Its size
+            EDIT     *edits      The edits to it, in order, with the 
+                                 line each starts on
+            int      nedits      How many
+
+   Writes edits as a unified diff (for -u) with DIFFCONTEXT lines of
+   context, as diff -u and git diff would, so it can be applied with
+   patch -p1 or git apply. Edits whose context would meet share a hunk.
+   Line numbers come from the edits, and only the lines around them are
+   looked at, so the rest of the file costs nothing. Each edit must 
+   start at the start of a line and end at the end of one, and is
+   trimmed by TrimEdit() to the lines which differ. The file is only
+   named as a/ and b/ if it's a relative path which stays in the 
+   current directory.
+
+   16.10.26 Original
+   16.10.26 Edits are trimmed, and only paths in the tree have a/ b/
+*/
+void WriteDiff(FILE *fp, const char *file, const char *map, long size,
+               EDIT *edits, int nedits)
+{
+   const char *from,
+            *to;
+   long     oldline,
+            oldcount,
+            newcount,
+            delta = 0,
+            n;
+   int      depth = 0,
+            i,
+            j,
+            k;
+   BOOL     inside;
+   
+   /* Lines an edit leaves as they were aren't part of the diff         */
+   for(i=j=0; i<nedits; i++)
+   {
+      if(TrimEdit(&edits[i], map)) edits[j++] = edits[i];
+   }
+   if(!(nedits = j)) return;
+   
+   /* Only a path which stays in the tree can be a/ and b/ for -p1      */
+   inside = (BOOL)(*file != '/');
+   for(from=file; inside && *from; from = *to ? to+1 : to)
+   {
+      to = from + strcspn(from, "/");
+      if(to - from == 2 && !strncmp(from, "..", 2))
+         inside = (BOOL)(--depth >= 0);
+      else if(to > from && !(to - from == 1 && *from == '.'))
+         depth++;
+   }
+   if(inside)
+      fprintf(fp, "--- a/%s\n+++ b/%s\n", file, file);
+   else
+      fprintf(fp, "--- %s\n+++ %s\n", file, file);
+   
+   for(i=0; i<nedits; i=j)
+   {
+      /* This hunk takes in each edit whose context meets the last's   */
+      for(j=i+1; j<nedits; j++)
+      {
+         if(edits[j].line - (edits[j-1].line + 
+                             CountLines(map + edits[j-1].start, 
+                                        map + edits[j-1].end)) 
+            > 2*DIFFCONTEXT)
+            break;
+      }
+      
+      /* The context before the first edit and after the last          */
+      for(from=map+edits[i].start, k=0; 
+          k<DIFFCONTEXT && from>map; k++)
+         for(from--; from>map && from[-1] != '\n'; from--) ;
+      for(to=map+edits[j-1].end, n=0; n<DIFFCONTEXT && to<map+size; n++)
+      {
+         if((to = (const char *)memchr(to, '\n', map + size - to)) == NULL)
+            to = map + size;
+         else
+            to++;
+      }
+      
+      /* Count the lines on each side                                  */
+      oldline  = edits[i].line - k;
+      oldcount = k + n;
+      newcount = k + n;
+      for(k=i; k<j; k++)
+      {
+         oldcount += CountLines(map + edits[k].start, map + edits[k].end);
+         newcount += CountLines(edits[k].text, edits[k].text + 
+                                edits[k].len);
+         if(edits[k].end > edits[k].start && map[edits[k].end-1] != '\n')
+            oldcount++;
+         if(edits[k].len && edits[k].text[edits[k].len-1] != '\n')
+            newcount++;
+         if(k > i) 
+         {
+            oldcount += CountLines(map + edits[k-1].end, 
+                                   map + edits[k].start);
+            newcount += CountLines(map + edits[k-1].end, 
+                                   map + edits[k].start);
+         }
+      }
+      
+      fprintf(fp, "@@ -%ld,%ld +%ld,%ld @@\n", 
+              oldcount ? oldline : oldline - 1, oldcount,
+              newcount ? oldline + delta : oldline + delta - 1, newcount);
+      delta += newcount - oldcount;
+      
+      /* The lines themselves                                          */
+      DiffLines(fp, ' ', from, map + edits[i].start);
+      for(k=i; k<j; k++)
+      {
+         if(k > i) DiffLines(fp, ' ', map + edits[k-1].end, 
+                             map + edits[k].start);
+         DiffLines(fp, '-', map + edits[k].start, map + edits[k].end);
+         DiffLines(fp, '+', edits[k].text, edits[k].text + edits[k].len);
+      }
+      DiffLines(fp, ' ', map + edits[j-1].end, to);
+   }
+}
+
+/************************************************************************/
+/*>BOOL TrimEdit(EDIT *edit, const char *map)
+   ------------------------------------------
+   I/O:     EDIT     *edit       An edit, with the line it starts on
+   Input:   const char *map      The file it's to
+   Returns: BOOL                 FALSE if it changes nothing at all
+
+   Moves the start of an edit past the lines at its start which it 
+   leaves as they were, and its end back over those at its end (such as
+   the { line of a definition), so a diff only shows those which 
+   change.
+
+   16.10.26 Original
+*/
+BOOL TrimEdit(EDIT *edit, const char *map)
+{
+   const char *old    = map + edit->start,
+              *oldend = map + edit->end,
+              *nl;
+   char       *text   = edit->text,
+              *end    = edit->text + edit->len;
+   size_t     len;
+   
+   while((nl = (const char *)memchr(old, '\n', oldend - old)) != NULL)
+   {
+      len = nl + 1 - old;
+      if((size_t)(end - text) < len || memcmp(old, text, len)) break;
+      old  += len;
+      text += len;
+      edit->line++;
+   }
+   
+   while(oldend > old && oldend[-1] == '\n')
+   {
+      for(nl=oldend-1; nl>old && nl[-1] != '\n'; nl--) ;
+      len = oldend - nl;
+      if((size_t)(end - text) < len || memcmp(nl, end - len, len) ||
+         (end - len > text && end[-len-1] != '\n'))
+         break;
+      oldend  = nl;
+      end    -= len;
+   }
+   
+   edit->start = old - map;
+   edit->end   = oldend - map;
+   edit->text  = text;
+   edit->len   = end - text;
+   return((BOOL)(old < oldend || text < end));
+}
+
+/************************************************************************/
+/*>void WriteEdit(FILE *fp, const char *file, const char *map, 
+                  long start, long end, const char *text, size_t len)
+   ----------------------------------------------------------------------
+   Input:   FILE     *fp         Edit script being written
+            const char *file     File edited
+            const char *map      Its contents (NULL if it's empty)
+            long     start       Offset of the first byte replaced
+            long     end         Offset of the byte after the last
+            const char *text     What replaces them
+            size_t   len         Its length
+
+   Writes a record of an edit script. Each is a line of JSON:
+      {"file":"x.c","start":120,"end":151,"hash":"0123456789abcdef",
+       "replacement":"int f(int a)\n{\n"}
+   where the hash is the XXH64 of the bytes replaced, in hex, so 
+   ApplyEdits() can tell if they've changed.
+
+   16.10.26 Original
+   16.10.26 Added map, for the hash
+*/
+void WriteEdit(FILE *fp, const char *file, const char *map, 
+               long start, long end, const char *text, size_t len)
+{
+   uint64_t hash;
+   
+   hash = XXHash64((map != NULL) ? map + start : "", end - start, 0);
+   fputs("{\"file\":", fp);
+   WriteJSON(fp, file, strlen(file));
+   fprintf(fp, ",\"start\":%ld,\"end\":%ld,\"hash\":\"%016llx\","
+           "\"replacement\":", start, end, (unsigned long long)hash);
+   WriteJSON(fp, text, len);
+   fputs("}\n", fp);
+}
+
+/************************************************************************/
+/*>void WriteJSON(FILE *fp, const char *str, size_t len)
+   -----------------------------------------------------
+   Input:   FILE     *fp         File being written
+            const char *str      Bytes to write (not terminated)
+            size_t   len         How many
+
+   Writes bytes as a JSON string, in quotes with ", \ and control 
+   characters escaped. Anything else is written as it is.
+
+   16.10.26 Original
+*/
+void WriteJSON(FILE *fp, const char *str, size_t len)
+{
+   const char *end = str + len,
+            *from;
+   
+   putc('"', fp);
+   while(str < end)
+   {
+      /* Write up to the next character which must be escaped           */
+      for(from=str; 
+          str<end && *str != '"' && *str != '\\' && 
+          (unsigned char)*str >= ' ' && *str != 127; 
+          str++) ;
+      fwrite(from, 1, str - from, fp);
+      if(str == end) break;
+      
+      switch(*str)
+      {
+      case '"':   fputs("\\\"", fp); break;
+      case '\\':  fputs("\\\\", fp); break;
+      case '\n':  fputs("\\n", fp);  break;
+      case '\r':  fputs("\\r", fp);  break;
+      case '\t':  fputs("\\t", fp);  break;
+      default:    fprintf(fp, "\\u%04x", (unsigned char)*str); break;
+      }
+      str++;
+   }
+   putc('"', fp);
+}
+
+/************************************************************************/
+/*>char *ParseJSON(char *ptr, char **str, size_t *len)
+   ---------------------------------------------------
+   Input:   char     *ptr        A JSON string, at its opening "
+   Output:  char     **str       Its contents, unescaped in place (not 
+                                 terminated)
+            size_t   *len        Their length
+   Returns: char *               Just after the closing ", NULL if it 
+                                 isn't a string
+
+   16.10.26 Original
+*/
+char *ParseJSON(char *ptr, char **str, size_t *len)
+{
+   char     *to,
+            hex[5];
+   unsigned long code;
+   
+   if(*ptr++ != '"') return(NULL);
+   for(*str=to=ptr; *ptr != '"'; ptr++)
+   {
+      if(*ptr == '\0' || *ptr == '\n') return(NULL);
+      if(*ptr != '\\')
+      {
+         *to++ = *ptr;
+         continue;
+      }
+      switch(*++ptr)
+      {
+      case 'b': *to++ = '\b'; break;
+      case 'f': *to++ = '\f'; break;
+      case 'n': *to++ = '\n'; break;
+      case 'r': *to++ = '\r'; break;
+      case 't': *to++ = '\t'; break;
+      case 'u':
+         /* Written as UTF-8                                            */
+         if(strspn(ptr+1, "0123456789abcdefABCDEF") < 4) return(NULL);
+         memcpy(hex, ptr+1, 4);
+         hex[4] = '\0';
+         code   = strtoul(hex, NULL, 16);
+         ptr   += 4;
+         if(code < 0x80)
+         {
+            *to++ = (char)code;
+         }
+         else if(code < 0x800)
+         {
+            *to++ = (char)(0xc0 | (code >> 6));
+            *to++ = (char)(0x80 | (code & 0x3f));
+         }
+         else
+         {
+            *to++ = (char)(0xe0 | (code >> 12));
+            *to++ = (char)(0x80 | ((code >> 6) & 0x3f));
+            *to++ = (char)(0x80 | (code & 0x3f));
+         }
+         break;
+      case '"':
+      case '\\':
+      case '/':
+         *to++ = *ptr;
+         break;
+      default:
+         return(NULL);
+      }
+   }
+   *len = to - *str;
+   return(ptr+1);
+}
+
+/************************************************************************/
+/*>BOOL ParseEdit(char *line, EDIT *edit)
+   --------------------------------------
+   Input:   char     *line       A record of an edit script, terminated
+                                 by a \n or NUL
+   Output:  EDIT     *edit       What it says (pointing into line)
+   Returns: BOOL                 FALSE if it isn't a valid record
+
+   Reads a record written by WriteEdit(). The fields may be in any 
+   order and others are ignored. The file name is terminated in place.
+
+   16.10.26 Original
+   16.10.26 The hash is needed too
+*/
+BOOL ParseEdit(char *line, EDIT *edit)
+{
+   char     *ptr = line,
+            *key,
+            *value,
+            *file = NULL,
+            hex[17];
+   unsigned long long hash;
+   size_t   keylen,
+            len;
+   long     number;
+   int      found = 0;
+   
+#define SKIPSPACE(p) while(*(p) == ' ' || *(p) == '\t' || *(p) == '\r') (p)++
+   SKIPSPACE(ptr);
+   if(*ptr++ != '{') return(FALSE);
+   for(;;)
+   {
+      SKIPSPACE(ptr);
+      if((ptr = ParseJSON(ptr, &key, &keylen)) == NULL) return(FALSE);
+      SKIPSPACE(ptr);
+      if(*ptr++ != ':') return(FALSE);
+      SKIPSPACE(ptr);
+      
+      if(*ptr == '"')
+      {
+         if((ptr = ParseJSON(ptr, &value, &len)) == NULL) return(FALSE);
+         if(keylen == 4 && !strncmp(key, "file", 4))
+         {
+            file      = value;
+            file[len] = '\0';      /* At or before the closing "      */
+            found    |= 1;
+         }
+         else if(keylen == 11 && !strncmp(key, "replacement", 11))
+         {
+            edit->text = value;
+            edit->len  = len;
+            found     |= 2;
+         }
+         else if(keylen == 4 && !strncmp(key, "hash", 4))
+         {
+            if(len != 16 || strspn(value, "0123456789abcdefABCDEF") < 16)
+               return(FALSE);
+            memcpy(hex, value, 16);
+            hex[16] = '\0';
+            sscanf(hex, "%llx", &hash);
+            edit->hash = (uint64_t)hash;
+            found     |= 16;
+         }
+      }
+      else
+      {
+         number = strtol(ptr, &value, 10);
+         if(value == ptr) return(FALSE);
+         ptr = value;
+         if(keylen == 5 && !strncmp(key, "start", 5))
+         {
+            edit->start = number;
+            found      |= 4;
+         }
+         else if(keylen == 3 && !strncmp(key, "end", 3))
+         {
+            edit->end = number;
+            found    |= 8;
+         }
+      }
+      
+      SKIPSPACE(ptr);
+      if(*ptr == '}') break;
+      if(*ptr++ != ',') return(FALSE);
+   }
+#undef SKIPSPACE
+   
+   edit->file = file;
+   edit->path = NULL;
+   return((BOOL)(found == 31 && edit->start >= 0 && 
+                 edit->end >= edit->start));
+}
+
+/************************************************************************/
+/*>int CompareEdits(const void *a, const void *b)
+   ----------------------------------------------
+   Input:   const void *a        EDIT
+            const void *b        EDIT
+   Returns: int                  Order of real path, offset and then 
+                                 where they were in the script
+
+   qsort() comparison for ApplyRun().
+
+   16.10.26 Original
+   16.10.26 Sorts by the real path, not the name in the script
+*/
+int CompareEdits(const void *a, const void *b)
+{
+   const EDIT *ea = (const EDIT *)a,
+              *eb = (const EDIT *)b;
+   int        cmp;
+   
+   if((cmp = strcmp(ea->path, eb->path)) != 0) return(cmp);
+   if(ea->start != eb->start) return((ea->start < eb->start) ? -1 : 1);
+   return(ea->order - eb->order);
+}
+
+/************************************************************************/
+/*>BOOL ApplyEdits(EDIT *edits, int nedits, FILE *msg)
+   ---------------------------------------------------
+   Input:   EDIT     *edits      The edits to one file, in order
+            int      nedits      How many
+            FILE     *msg        Where to write messages
+   Returns: BOOL                 FALSE if the file couldn't be edited
+
+   Makes the edits to a file. It's mapped and written, the unchanged 
+   parts straight from the map, to a temporary file beside it which is 
+   renamed over it. A symbolic link is followed. If any edit is outside 
+   the file, overlaps another (as the same edit given twice would), or
+   replaces bytes whose hash isn't the one in the script, the file is
+   left alone.
+
+   16.10.26 Original
+   16.10.26 Checks the hash of the bytes each edit replaces. The real
+            path comes from ApplyRun()
+*/
+BOOL ApplyEdits(EDIT *edits, int nedits, FILE *msg)
+{
+   struct stat st;
+   FILE     *fp;
+   char     *path,
+            *map = NULL,
+            *tmp = NULL;
+   long     pos  = 0;
+   int      fd   = -1,
+            i;
+   BOOL     ok   = FALSE;
+   
+   path = edits[0].path;
+   if((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) ||
+      !S_ISREG(st.st_mode) ||
+      (st.st_size > 0 &&
+       (map = (char *)mmap(NULL, (size_t)st.st_size, PROT_READ, 
+                           MAP_PRIVATE, fd, 0)) == MAP_FAILED))
+   {
+      fprintf(msg,"Unable to read file %s\n",edits[0].file);
+      if(fd >= 0) close(fd);
+      return(FALSE);
+   }
+   if(st.st_size == 0) map = NULL;
+   
+   for(i=0; i<nedits; i++)
+   {
+      if(edits[i].start < pos || edits[i].end > st.st_size ||
+         (i && edits[i].start == edits[i-1].start) ||
+         XXHash64((map != NULL) ? map + edits[i].start : "", 
+                  edits[i].end - edits[i].start, 0) != edits[i].hash)
+         break;
+      pos = edits[i].end;
+   }
+   
+   if(i < nedits)
+   {
+      fprintf(msg,"%s doesn't match its edits so has been left alone\n",
+              edits[0].file);
+   }
+   else if((fp = OpenAtomic(path, fd, &tmp)) != NULL)
+   {
+      for(i=0, pos=0; i<nedits; i++)
+      {
+         fwrite(map + pos, 1, edits[i].start - pos, fp);
+         fwrite(edits[i].text, 1, edits[i].len, fp);
+         pos = edits[i].end;
+      }
+      fwrite(map + pos, 1, st.st_size - pos, fp);
+      ok = (BOOL)!ferror(fp);
+      if(fclose(fp) || (ok && rename(tmp, path))) ok = FALSE;
+      if(!ok) unlink(tmp);
+      free(tmp);
+   }
+   if(!ok && i == nedits)
+      fprintf(msg,"Error writing file %s\n",edits[0].file);
+   
+   if(map != NULL) munmap(map, (size_t)st.st_size);
+   close(fd);
+   return(ok);
+}
+
+/************************************************************************/
+/*>int ApplyRun(int nscripts, char **scripts, BOOL noisy)
+   ------------------------------------------------------
+   Input:   int      nscripts    Number of edit scripts
+            char     **scripts   Their names (none to read stdin)
+            BOOL     noisy       Say how many edits were made
+   Returns: int                  0 if all OK, 1 on error
 
-   Works like FindString(), but imposes the additional condition that the
-   string must be preceded by a space or * and must be followed by one of
-   space ; [ ) or ,
+   Makes the edits in scripts written by -e, for --apply. All the 
+   records are read and sorted by the real path of their file, so each
+   file is only written once, by ApplyEdits(), however it's named.
 
-   14.02.92 Original   By: ACRM
+   16.10.26 Original
+   16.10.26 Files are grouped by their real paths
 */
-char *FindVarName(char *buffer, char *string)
+int ApplyRun(int nscripts, char **scripts, BOOL noisy)
 {
-   char  *ptr;
-   int   ok = FALSE,
-         i;
+   FILE     *fp;
+   EDIT     *edits  = NULL,
+            *ptr;
+   char     **data,
+            *line,
+            *next;
+   size_t   len;
+   int      nedits  = 0,
+            maxedits = 0,
+            nfiles  = 0,
+            status  = 0,
+            i,
+            j;
    
-   ptr = buffer;
+   if((data = (char **)calloc((nscripts > 0) ? nscripts : 1, 
+                              sizeof(char *))) == NULL)
+   {
+      fprintf(stderr,"No memory for edit scripts\n");
+      return(1);
+   }
    
-   while(!ok)
+   for(i=0; i<((nscripts > 0) ? nscripts : 1) && !status; i++)
    {
-      /* Step ptr along buffer till we find first character of string with
-         a space or * before it.
-      */
-      ptr--;
-      do
+      if(nscripts == 0)
+         fp = stdin;
+      else if((fp = fopen(scripts[i], "r")) == NULL)
       {
-         ptr++;
-         while(*ptr && *ptr != *string) ptr++;
-      }  while(*ptr && *(ptr-1) != ' ' && 
-                       *(ptr-1) != '*' && 
-                       *(ptr-1) != ',');
-
-      /* Return NULL if we didn't find it                               */
-      if(*ptr == '\0') return((char *)NULL);
+         fprintf(stderr,"Unable to open edit script %s\n",scripts[i]);
+         status = 1;
+         break;
+      }
+      data[i] = ReadAll(fp, &len);
+      if(fp != stdin) fclose(fp);
+      if(data[i] == NULL)
+      {
+         fprintf(stderr,"No memory for edit scripts\n");
+         status = 1;
+         break;
+      }
+      data[i][len] = '\0';
       
-      /* Now compare the rest of the string                             */
-      ok = TRUE;
-      for(i=0; i<strlen(string); i++)
+      /* Each line is a record                                          */
+      for(line=data[i]; *line && !status; line=next)
       {
-         if(ptr[i] != string[i])
+         if((next = strchr(line, '\n')) != NULL)
+            *next++ = '\0';
+         else
+            next = line + strlen(line);
+         if(strspn(line, " \t\r") == strlen(line)) continue;
+         
+         if(nedits == maxedits)
          {
-            ok = FALSE;
+            maxedits = maxedits ? 2*maxedits : 256;
+            if((ptr = (EDIT *)realloc(edits, maxedits * sizeof(EDIT)))
+               == NULL)
+            {
+               fprintf(stderr,"No memory for edit scripts\n");
+               status = 1;
+               break;
+            }
+            edits = ptr;
+         }
+         if(!ParseEdit(line, &edits[nedits]))
+         {
+            fprintf(stderr,"Not an edit: %.60s\n", line);
+            status = 1;
             break;
          }
+         edits[nedits].order = nedits;
+         nedits++;
       }
-      
-      /* Check the character after the string                           */
-      if(*(ptr+i) != ';' && *(ptr+i) != '[' && 
-         *(ptr+i) != ' ' && *(ptr+i) != ')' && *(ptr+i) != ',') 
-         ok = FALSE;
-
-      ptr++;
    }
-   return(--ptr);
-}
-
-/************************************************************************/
-/*>int isFunc(char funcdef[][], int ndef)
-   --------------------------------------
-   Input:   char     funcdef[][]    Array of lines forming function 
-                                    definition
-            int      ndef           Number of lines
-   Returns: int                     1: This is a function
-                                    0: Not a function
-
-   Determines whether a possible function definition identified by 
-   isInteresting() really is a function.
-
-   17.12.91 Original    By: ACRM
-*/
-int isFunc(char funcdef[MAXLINES][MAXBUFF], int ndef)
-{
-   char  *termchar;
-   int   line,
-         retval;
-   
-   /* If it's a prototype, it will not be terminated by a {             */
-   if(strchr(funcdef[ndef],'{') != NULL) return(1);
    
-   /* It's now either a prototype or a K&R function defintion.
-      To be a prototype, the first non-space character before the
-      ; must be a )
-      
-      Step backwards.
-   */
-   line = ndef;
-   for(;;)
+   /* One which can't be found is kept by name, and fails to open       */
+   for(i=0; i<nedits && !status; i++)
    {
-      termchar = strchr(funcdef[line],';') - 1;
-      while(termchar >= funcdef[line] && 
-            (*termchar == ' ' || *termchar == '\t'))
-         termchar--;
-      
-      /* If we stepped back beyond the start of the line, go to the
-         previous line
-      */
-      if(termchar < funcdef[line])
+      if((edits[i].path = realpath(edits[i].file, NULL)) == NULL &&
+         (edits[i].path = strdup(edits[i].file)) == NULL)
       {
-         line--;
-         if(line < 0) break;
-         termchar = funcdef[line] + strlen(funcdef[line]);
+         fprintf(stderr,"No memory for edit scripts\n");
+         status = 1;
       }
-      else
+   }
+   
+   if(!status && nedits)
+   {
+      qsort(edits, nedits, sizeof(EDIT), CompareEdits);
+      for(i=0; i<nedits; i=j)
       {
-         break;
+         for(j=i+1; j<nedits && !strcmp(edits[i].path, edits[j].path); 
+             j++) ;
+         if(!ApplyEdits(edits+i, j-i, stderr)) status = 1;
+         nfiles++;
       }
    }
+   if(!status && noisy)
+      printf("%d edits made to %d files\n", nedits, nfiles);
    
-   /* OK, see if the character was a )                                  */
-   if(*termchar == ')')
-      retval = 0;
-   else
-      retval = 1;
-      
-   return(retval);
+   for(i=0; i<((nscripts > 0) ? nscripts : 1); i++)
+      free(data[i]);
+   for(i=0; i<nedits; i++)
+      free(edits[i].path);
+   free(data);
+   free(edits);
+   return(status);
 }
 
 /************************************************************************/
-/*>void terminate(char *string)
+/*>BOOL MakeParents(char *path)
    ----------------------------
-   I/O:     char     *string        A character string
-   Returns: void
+   Input:   char     *path       A file
+   Returns: BOOL                 FALSE if a directory couldn't be made
 
-   Terminates a string at the first \n
+   Makes any directories missing from the path to a file.
 
-   17.12.91 Original    By: ACRM
+   16.10.26 Original
 */
-void terminate(char *string)
+BOOL MakeParents(char *path)
 {
-   int i;
+   char     *slash;
+   BOOL     ok = TRUE;
    
-   for(i=0;string[i];i++)
+   for(slash=strchr(path+1, '/'); slash!=NULL && ok; 
+       slash=strchr(slash+1, '/'))
    {
-      if(string[i] == '\n')
-      {
-         string[i] = '\0';
-         break;
-      }
+      *slash = '\0';
+      if(mkdir(path, 0777) && errno != EEXIST) ok = FALSE;
+      *slash = '/';
    }
+   return(ok);
 }
 
 /************************************************************************/
-/*>void DeAnsify(FILE *fp, char funcdef[][], int ndef)
-   ---------------------------------------------------
-   Input:   FILE     *fp            File being written
-            char     funcdef[][]    Function definition array
-            int      ndef           Number of definition lines
-   Returns: void
+/*>char *JoinPath(const char *dir, const char *name)
+   -------------------------------------------------
+   Input:   const char *dir      A directory ("" for none)
+            const char *name     Something in it ("" for the directory)
+   Returns: char *               dir/name from malloc(), NULL if no 
+                                 memory
 
-   Writes a K&R function definition from the ANSI (or K&R) form in funcdef.
-   If it's already K&R, just writes it; otherwise assembles function into
-   a single buffer line, writes the function name and calls WriteKR() to
-   write the definition of each variable.
+   16.10.26 Original
+*/
+char *JoinPath(const char *dir, const char *name)
+{
+   char     *path;
+   
+   if((path = (char *)malloc(strlen(dir) + strlen(name) + 2)) != NULL)
+   {
+      if(!*dir)       strcpy(path, name);
+      else if(!*name) strcpy(path, dir);
+      else            sprintf(path, "%s/%s", dir, name);
+   }
+   return(path);
+}
 
-   17.12.91 Original    By: ACRM
+#  ifdef WATCH
+/************************************************************************/
+/*>int WatchRun(char *src, char *dst, int mode, int nworkers, 
+                RUNSTATS *stats, BOOL noisy)
+   ----------------------------------------------------------
+   Input:   char     *src        Source tree
+            char     *dst        Where it's converted to
+            int      mode        Processing mode
+            int      nworkers    Threads to convert with
+            RUNSTATS *stats      Statistics to add to (NULL if none)
+            BOOL     noisy       Say how long each batch took
+   Returns: int                  1 on error (it doesn't return 
+                                 otherwise)
+
+   Keeps a converted copy of a source tree for --watch. Every directory
+   in the tree is watched with inotify, and files whose outputs are
+   missing or older are converted at once. After that, a .c file which 
+   is written or moved into the tree is queued, and the queue is 
+   converted as one batch once nothing else has changed for WATCHQUIET
+   ms, or WATCHMAX ms after the first change if they go on. The outputs
+   are written atomically. A directory moved out of the tree is no
+   longer watched, and one moved into it, or renamed in it, is watched
+   under its new name.
+
+   16.10.26 Original
+   16.10.26 Directories which are moved are followed
 */
-void DeAnsify(FILE *fp,
-              char funcdef[MAXLINES][MAXBUFF],
-              int ndef)
+int WatchRun(char *src, char *dst, int mode, int nworkers, 
+             RUNSTATS *stats, BOOL noisy)
 {
-   int   i,
-         j,
-         nparam,
-         isKR     = FALSE,
-         bufflen  = 0,
-         last     = FALSE;
-   char  *buffer  = NULL,
-         *bufptr,
-         *funptr,
-         *ptr,
-         *start,
-         *stop,
-         temp[MAXBUFF],
-         func[MAXBUFF],
-         varname[80];
+   struct inotify_event *event;
+   struct pollfd pfd;
+   WATCHER  watch;
+   char     buffer[65536],
+            *realsrc = NULL,
+            *realdst = NULL,
+            *rel;
+   double   first    = 0.0,
+            now,
+            cpu;
+   ssize_t  len,
+            pos;
+   int      timeout,
+            nfiles,
+            status   = 1;
    
-   ndef++;
+   memset(&watch, 0, sizeof(WATCHER));
+   watch.fd  = -1;
+   watch.src = src;
+   watch.dst = dst;
    
-   /* If any of the lines contains a ;, it's already KR                 */
-   for(i=0; i<ndef; i++)
+   /* The output mustn't be in the tree, or we'd convert our own output */
+   if(mkdir(dst, 0777) && errno != EEXIST) 
    {
-      if(strchr(funcdef[i], ';') != NULL)
-      {
-         isKR = TRUE;
-         break;
-      }
+      fprintf(stderr,"Unable to make output directory %s\n",dst);
+      return(1);
+   }
+   if((realsrc = realpath(src, NULL)) == NULL ||
+      (realdst = realpath(dst, NULL)) == NULL)
+   {
+      fprintf(stderr,"Unable to find directory %s\n",
+              (realsrc == NULL) ? src : dst);
+      goto done;
+   }
+   len = (ssize_t)strlen(realsrc);
+   if(!strncmp(realsrc, realdst, len) && 
+      (realdst[len] == '/' || realdst[len] == '\0'))
+   {
+      fprintf(stderr,"The output directory may not be in %s\n",src);
+      goto done;
    }
    
-   if(isKR)
+   if((watch.fd = inotify_init()) < 0 || !WatchDir(&watch, ""))
    {
-      /* It's already KR, so just output it                             */
-      for(i=0; i<ndef; i++) fprintf(fp, "%s\n", funcdef[i]);
+      fprintf(stderr,"Unable to watch %s\n",src);
+      goto done;
    }
-   else     /* It's not KR, so we convert it.                           */
+   pfd.fd     = watch.fd;
+   pfd.events = POLLIN;
+   
+   /* Catch up with what changed while we weren't watching              */
+   WatchFlush(&watch, mode, nworkers, stats);
+   fflush(stdout);
+   
+   for(;;)
    {
-      /* First allocate some memory                                     */
-      for(i=0; i<ndef; i++) bufflen += strlen(funcdef[i]);
-      bufflen += 2;
-      buffer = (char *)malloc(bufflen * sizeof(char));
-      buffer[0] = '\0';
-      
-      /* Now build all the strings into the single buffer ignoring 
-         comments 
-      */
-      for(i=0; i<ndef; i++) strcat(buffer,funcdef[i]);
-
-      /* Find the first (, copy up to here and print it                 */
-      for(i=0; buffer[i] != '('; i++) temp[i] = buffer[i];
-      temp[i]     = '(';
-      temp[i+1]   = '\0';
-      fprintf(fp,"%s",temp);
-      
-      /* Set bufptr to point to the buffer excluding the function name  */
-      bufptr = strchr(buffer, '(') + 1;
+      /* Wait for a change, or for a pause in them                      */
+      timeout = -1;
+      if(watch.npending)
+      {
+         StatClock(&now, &cpu);
+         timeout = WATCHMAX - (int)((now - first) * 1000.0);
+         if(timeout > WATCHQUIET) timeout = WATCHQUIET;
+         if(timeout < 0)          timeout = 0;
+      }
       
-      /* Count the number of commas in the parameter list               */
-      nparam = 0;
-      for(funptr = bufptr; *funptr && *funptr != ')'; funptr++)
-         if(*funptr == ',') nparam++;
-         
-      if(nparam)
+      if(poll(&pfd, 1, timeout) < 0)
       {
-         /* If there were *any* commas, the number of parameters is one
-            more than the number of commas
-         */
-         nparam++;
+         if(errno == EINTR) continue;
+         break;
       }
-      else
+      
+      if(!(pfd.revents & POLLIN))
       {
-         /* If there weren't any commas, there are either 0 or 1 params.
-            If there's only white space, or `void' between the ( and ) 
-            there are 0 parameters. Otherwise, there's 1
-         */
-         if(FindString(bufptr,"void") || FindString(bufptr,"VOID"))
-         {
-            nparam = 0;
-         }
-         else
-         {
-            for(funptr = bufptr; *funptr && *funptr != ')'; funptr++)
-            {
-               if(*funptr != ' ' && *funptr != '\t')
-               {
-                  nparam = 1;
-                  break;
-               }
-            }
-         }
+         nfiles = WatchFlush(&watch, mode, nworkers, stats);
+         StatClock(&now, &cpu);
+         if(noisy && nfiles)
+            printf("Converted %d file%s %.1fms after the first change\n",
+                   nfiles, (nfiles == 1) ? "" : "s", 
+                   (now - first) * 1000.0);
+         fflush(stdout);
+         continue;
       }
       
-      /* If there weren't any parameters we can just output a closing
-         parenthesis an opening { and return.
-      */
-      if(nparam==0)
+      if((len = read(watch.fd, buffer, sizeof(buffer))) <= 0)
       {
-         fprintf(fp,")\n{\n");
-         free(buffer);
-         return;
+         if(len < 0 && errno == EINTR) continue;
+         break;
       }
-
-      /* Step through the parameter list getting a parameter at a time.
-         Assemble these into func.
-         The variable names are delimited by a , a [ or the closing )
-      */
-      func[0] = '\0';
-      funptr = bufptr;
-      for(i=0; i<nparam; i++)
+      if(!watch.npending) StatClock(&first, &cpu);
+      
+      for(pos=0; pos<len; pos+=sizeof(struct inotify_event)+event->len)
       {
-         /* Step funptr on to the next , or )                           */
-         if((funptr = strchr(funptr,',')) == NULL)
+         event = (struct inotify_event *)(buffer + pos);
+         
+         /* Events were lost, so look at everything again               */
+         if(event->mask & IN_Q_OVERFLOW)
          {
-            funptr = strchr(bufptr,')');
-            last = TRUE;
+            WatchDir(&watch, "");
+            continue;
          }
+         if(event->wd < 0 || event->wd >= watch.maxdirs ||
+            watch.dirs[event->wd] == NULL)
+            continue;
          
-         /* Step back over any spaces                                   */
-         stop = funptr-1;
-         while(stop>bufptr && (*stop==' ' || *stop=='\t')) stop--;
-         
-         /* Step back to the start of the variable name                 */
-         start = stop;
-         while(start>=bufptr && *start!=' ' && 
-               *start!='\t' && *start != '*')
-            start--;
-         start++;
+         /* The tree itself has been moved, so its name is no use now   */
+         if((event->mask & IN_MOVE_SELF) && !*watch.dirs[event->wd])
+         {
+            fprintf(stderr,"%s has been moved\n",src);
+            goto done;
+         }
          
-         /* Copy the variable name into our function buffer adding 
-            a , and space or ) as appropriate.
-         */
-         for(j=0; start<=stop; start++, j++)
-            temp[j] = *start;
-         temp[j] = '\0';
-
-         if((ptr = strchr(temp,'[')) != NULL)
-            *ptr = '\0';
-            
-         if(last)
-            strcat(temp,")");
-         else
-            strcat(temp,", ");
+         /* A directory has gone                                        */
+         if(event->mask & IN_IGNORED)
+         {
+            free(watch.dirs[event->wd]);
+            watch.dirs[event->wd] = NULL;
+            continue;
+         }
+         if(!event->len ||
+            (rel = JoinPath(watch.dirs[event->wd], event->name)) == NULL)
+            continue;
          
-         strcat(func, temp);
-         funptr++;
+         if(event->mask & IN_ISDIR)
+         {
+            /* One moved here may be one moved from elsewhere in the 
+               tree, whose watches are then renamed by WatchDir()       */
+            if(event->mask & IN_MOVED_FROM)
+               WatchForget(&watch, rel);
+            else
+               WatchDir(&watch, rel);
+            free(rel);
+         }
+         else if(!(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) ||
+                 !IsSource(event->name) || !WatchQueue(&watch, rel))
+         {
+            free(rel);
+         }
       }
-      
-      /* We can now echo the parameter list to the output file          */
-      fprintf(fp,"%s\n",func);
+   }
+   fprintf(stderr,"Error watching %s\n",src);
 
-      /* Work through the parameter list writing the parameter 
-         definition lines
-      */
-      funptr = func;
-      while(*funptr && *funptr != ')')
+done:
+   if(watch.fd >= 0) close(watch.fd);
+   free(realsrc);
+   free(realdst);
+   return(status);
+}
+
+/************************************************************************/
+/*>BOOL WatchDir(WATCHER *watch, const char *rel)
+   ----------------------------------------------
+   I/O:     WATCHER  *watch      The tree being watched
+   Input:   const char *rel      Directory in it, relative to its top
+   Returns: BOOL                 FALSE if it couldn't be watched
+
+   Watches a directory and those in it, and queues any .c files in them
+   whose outputs are missing or no newer than they are. Watching one 
+   again is harmless, and gives its watch the name it has now.
+
+   16.10.26 Original
+   16.10.26 The name of a watch is replaced when it's watched again
+*/
+BOOL WatchDir(WATCHER *watch, const char *rel)
+{
+   struct stat st,
+               outst;
+   struct dirent *entry;
+   DIR      *dir;
+   char     *path,
+            *out,
+            *sub,
+            *name,
+            **dirs;
+   int      wd,
+            max;
+   
+   if((path = JoinPath(watch->src, rel)) == NULL) return(FALSE);
+   if((wd = inotify_add_watch(watch->fd, path, IN_CLOSE_WRITE | 
+                              IN_MOVED_FROM | IN_MOVED_TO | IN_MOVE_SELF |
+                              IN_CREATE | IN_ONLYDIR)) < 0)
+   {
+      free(path);
+      return(FALSE);
+   }
+   
+   /* Note the directory of the watch                                   */
+   if(wd >= watch->maxdirs)
+   {
+      for(max = watch->maxdirs ? 2*watch->maxdirs : 64; max <= wd; 
+          max *= 2) ;
+      if((dirs = (char **)realloc(watch->dirs, max * sizeof(char *))) 
+         == NULL)
+      {
+         free(path);
+         return(FALSE);
+      }
+      memset(dirs + watch->maxdirs, 0, 
+             (max - watch->maxdirs) * sizeof(char *));
+      watch->dirs    = dirs;
+      watch->maxdirs = max;
+   }
+   if(watch->dirs[wd] == NULL || strcmp(watch->dirs[wd], rel))
+   {
+      if((name = strdup(rel)) == NULL)
+      {
+         free(path);
+         return(FALSE);
+      }
+      free(watch->dirs[wd]);
+      watch->dirs[wd] = name;
+   }
+   
+   if((dir = opendir(path)) == NULL)
+   {
+      free(path);
+      return(TRUE);
+   }
+   while((entry = readdir(dir)) != NULL)
+   {
+      if(entry->d_name[0] == '.' && 
+         (!entry->d_name[1] || 
+          (entry->d_name[1] == '.' && !entry->d_name[2])))
+         continue;
+      if((sub = JoinPath(rel, entry->d_name)) == NULL) break;
+      free(path);
+      if((path = JoinPath(watch->src, sub)) == NULL ||
+         lstat(path, &st))
       {
-         /* Kill spaces                                                 */
-         for( ; funptr && (*funptr == ' ' || *funptr == '\t'); funptr++) ;
-         /* Get a parameter                                             */
-         funptr += GetVarName(funptr, varname) + 1;
-         /* Write the K&R version                                       */
-         WriteKR(fp, varname, bufptr);
+         free(sub);
+         continue;
       }
       
-      fprintf(fp,"{\n");
-
-      /* Free memory                                                    */
-      free(buffer);
+      if(S_ISDIR(st.st_mode))
+      {
+         WatchDir(watch, sub);
+      }
+      else if(IsSource(entry->d_name) && !stat(path, &st) && 
+              S_ISREG(st.st_mode) &&
+              (out = JoinPath(watch->dst, sub)) != NULL)
+      {
+         if(stat(out, &outst) || outst.st_mtime <= st.st_mtime)
+         {
+            if(WatchQueue(watch, sub)) sub = NULL;
+         }
+         free(out);
+      }
+      free(sub);
    }
+   closedir(dir);
+   free(path);
+   return(TRUE);
 }
 
 /************************************************************************/
-/*>void WriteKR(FILE *fp, char *varname, char *definitions)
-   --------------------------------------------------------
-   Input:   FILE     *fp            File being written
-            char     *varname       Variable being processed
-            char     *definitions   ANSI style definitions
-   Returns: void
+/*>void WatchForget(WATCHER *watch, const char *rel)
+   -------------------------------------------------
+   I/O:     WATCHER  *watch      The tree being watched
+   Input:   const char *rel      Directory which has been moved away,
+                                 relative to the top of the tree
 
-   Writes a variable definition in K&R form by extracting information from
-   the ANSI definition.
+   Stops watching a directory and those in it, and drops any of their
+   files from the queue, since they're no longer where they were.
 
-   17.12.91 Original    By: ACRM
-   26.03.92 Added call to FindVarName()
+   16.10.26 Original
 */
-void WriteKR(FILE *fp, char *varname, char *definitions)
+void WatchForget(WATCHER *watch, const char *rel)
 {
-   char  *start,
-         *stop,
-         temp[MAXBUFF];
-   int   i;
-   
-   /* Find the variable name in the definitions                         */
-/*** V1.5+
-// start = stop = FindString(definitions,varname);
-*/
-   start = stop = FindVarName(definitions,varname);
-/*** V1.5-                                                              */
+   size_t   len = strlen(rel);
+   char     *name;
+   int      wd,
+            i,
+            n;
    
-   /* Step start back to the preceeding , / or (, then forward 
-      over any spaces
-   */
-   while(start >= definitions && *start != '(' && 
-         *start != ',' && *start != '/')
-      start--;
-   start++;
-   while(start<stop && (*start==' ' || *start=='\t')) start++;
-   
-   /* Step stop on to the following , or )                              */
-   while(*stop && *stop != ')' && *stop != ',') stop++;
-   stop--;
+   for(wd=0; wd<watch->maxdirs; wd++)
+   {
+      name = watch->dirs[wd];
+      if(name != NULL && !strncmp(name, rel, len) &&
+         (name[len] == '/' || name[len] == '\0'))
+      {
+         inotify_rm_watch(watch->fd, wd);
+         free(name);
+         watch->dirs[wd] = NULL;
+      }
+   }
    
-   /* Copy the variable definition, add a ; and output.                 */
-   for(i=0; start<=stop; start++, i++)
-      temp[i] = *start;
-   temp[i]     = ';';
-   temp[i+1]   = '\0';
+   for(i=n=0; i<watch->npending; i++)
+   {
+      name = watch->pending[i];
+      if(!strncmp(name, rel, len) && name[len] == '/')
+         free(name);
+      else
+         watch->pending[n++] = name;
+   }
+   watch->npending = n;
+}
+
+/************************************************************************/
+/*>BOOL WatchQueue(WATCHER *watch, char *rel)
+   ------------------------------------------
+   I/O:     WATCHER  *watch      The tree being watched
+   Input:   char     *rel        File to convert, from malloc(), which
+                                 is taken over
+   Returns: BOOL                 FALSE if no memory (rel isn't taken)
 
-   fprintf(fp,"%s\n",temp);
+   Queues a file to be converted by WatchFlush().
+
+   16.10.26 Original
+*/
+BOOL WatchQueue(WATCHER *watch, char *rel)
+{
+   char     **pending;
+   int      max;
+   
+   if(watch->npending == watch->maxpending)
+   {
+      max = watch->maxpending ? 2*watch->maxpending : 64;
+      if((pending = (char **)realloc(watch->pending, max * sizeof(char *)))
+         == NULL)
+         return(FALSE);
+      watch->pending    = pending;
+      watch->maxpending = max;
+   }
+   watch->pending[watch->npending++] = rel;
+   return(TRUE);
 }
 
 /************************************************************************/
-/*>void KillComments(char *buffer)
-   -------------------------------
-   I/O:     char     *buffer     String from which to remove any comments
-   Returns: void
+/*>int WatchFlush(WATCHER *watch, int mode, int nworkers, RUNSTATS *stats)
+   ----------------------------------------------------------------------
+   I/O:     WATCHER  *watch      The tree being watched, whose queue is
+                                 emptied
+            RUNSTATS *stats      Statistics to add to (NULL if none)
+   Input:   int      mode        Processing mode
+            int      nworkers    Threads to convert with
+   Returns: int                  Number of files converted
 
-   Takes a string and removes any section enclosed in comments.
+   Converts the files queued, each once, as a batch of atomic jobs.
 
-   19.02.92 Original
+   16.10.26 Original
 */
-void KillComments(char *buffer)
+int WatchFlush(WATCHER *watch, int mode, int nworkers, RUNSTATS *stats)
 {
-   int   in       = 0,
-         out      = 0,
-         comment  = 0,
-         len;
+   JOB      *jobs;
+   int      njobs = 0,
+            i;
    
-   len = strlen(buffer);
+   if(!watch->npending) return(0);
    
-   for(in=0;in<len;in++)
+   qsort(watch->pending, watch->npending, sizeof(char *), ComparePaths);
+   if((jobs = (JOB *)calloc(watch->npending, sizeof(JOB))) != NULL)
    {
-      if(buffer[in]   == '/' && buffer[in+1] == '*') comment++;
-      if(buffer[in-2] == '*' && buffer[in-1] == '/') comment--;
+      for(i=0; i<watch->npending; i++)
+      {
+         if(i && !strcmp(watch->pending[i], watch->pending[i-1]))
+            continue;
+         jobs[njobs].in     = JoinPath(watch->src, watch->pending[i]);
+         jobs[njobs].out    = JoinPath(watch->dst, watch->pending[i]);
+         jobs[njobs].atomic = TRUE;
+         if(jobs[njobs].in == NULL || jobs[njobs].out == NULL ||
+            !MakeParents(jobs[njobs].out))
+         {
+            free(jobs[njobs].in);
+            free(jobs[njobs].out);
+            continue;
+         }
+         njobs++;
+      }
       
-      if(!comment) buffer[out++] = buffer[in];
+      RunBatch(jobs, njobs, mode, nworkers, NULL, NULL, stats);
+      
+      for(i=0; i<njobs; i++)
+      {
+         free(jobs[i].in);
+         free(jobs[i].out);
+      }
+      free(jobs);
    }
    
-   buffer[out] = '\0';
+   for(i=0; i<watch->npending; i++)
+      free(watch->pending[i]);
+   watch->npending = 0;
+   return(njobs);
+}
+
+/************************************************************************/
+/*>BOOL IsSource(const char *name)
+   -------------------------------
+   Input:   const char *name     File name
+   Returns: BOOL                 Whether it's a .c file
+
+   16.10.26 Original
+*/
+BOOL IsSource(const char *name)
+{
+   size_t   len = strlen(name);
+   
+   return((BOOL)(len > 2 && !strcmp(name + len - 2, ".c")));
 }
 
+/************************************************************************/
+/*>int ComparePaths(const void *a, const void *b)
+   ----------------------------------------------
+   Input:   const void *a        char *
+            const void *b        char *
+   Returns: int                  As strcmp()
+
+   qsort() comparison for WatchFlush().
+
+   16.10.26 Original
+*/
+int ComparePaths(const void *a, const void *b)
+{
+   return(strcmp(*(char * const *)a, *(char * const *)b));
+}
+#  endif
+#endif
+#endif
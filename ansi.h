@@ -0,0 +1,214 @@
+/***************************************************************************
+
+   Program:    ansi
+   File:       ansi.h
+
+   Version:    V4.1
+   Date:       16.10.26
+   Function:   Interface for using the ansi converter as a library
+
+   Copyright:  SciTech Software 1991
+   Author:     Andrew C. R. Martin
+   EMail:      andrew@abyinformatics.com
+
+****************************************************************************
+
+   This program is not in the public domain, but it may be freely copied
+   and distributed for no charge providing this header is included.
+   The code may be modified as required, but any modifications must be
+   documented so that the person responsible can be identified. If someone
+   else breaks this code, I don't want to be blamed for code that does not
+   work! The code may not be sold commercially without prior permission from
+   the author, although it may be given away free with commercial products,
+   providing it is made clear that this program is free and that the source
+   code is provided with the program.
+
+****************************************************************************
+
+   Description:
+   ============
+
+   Compile ansi.c with ANSI_LIBRARY defined to leave out main() and the
+   rest of the command line program. e.g.
+      cc -c -DANSI_LIBRARY ansi.c
+      ar rcs libansi.a ansi.o
+   Only the functions declared here are exported; everything else in 
+   ansi.c is static, so it can't clash with a program's own names.
+
+   Each conversion needs an ANSICTX from AnsiCreate(). A context holds
+   all the state for a conversion and may be reused for any number of
+   files, one at a time. Different contexts may be used at the same time
+   from different threads.
+
+   The conversion routines return ANSI_OK or one of the error codes below.
+   Warnings, such as a K&R parameter with no definition, do not stop the
+   conversion and are available from AnsiMessages() afterwards.
+
+   Comments, strings and function bodies are skipped with SSE2 or AVX2 
+   code where the processor has it. AnsiSetScanner() chooses another (or
+   set ANSI_SCAN in the environment before creating the context), which
+   is mostly useful for measuring them; the output is always the same.
+
+   AnsiSetThreads() lets a context split large files which are mapped or
+   in memory into pieces converted at the same time. The threads are 
+   started and finished within each conversion, so the context is still
+   used from one thread.
+
+   Once AnsiKeepFunctions() has been called, AnsiFunctions() lists the
+   function definitions found by a conversion, with where each was in 
+   the input and what was written for it (the prototype with 
+   MakeProtos). Otherwise memory use doesn't depend on the size of the
+   input, only on the largest definition, if it's read from a pipe.
+
+   Once AnsiKeepStats() has been called, AnsiStats() says how much work
+   the last conversion did and how long each stage took. Define NOSTATS
+   when compiling ansi.c to leave the counting out altogether.
+
+   AnsiCheckBuffer() finds whether source is already in the form the
+   context converts to without converting it. It stops at the first
+   function definition which would be converted and gives its line.
+
+   After AnsiEditsOnly(), a conversion writes only the definitions which
+   change, and AnsiFunctions() says which part of the input each 
+   replaces, so a file can be edited rather than written again.
+
+   After AnsiKeepPrototypes(), a conversion to ANSI also makes the 
+   prototypes of the definitions it finds, just as MakeProtos would,
+   without reading the input again. AnsiPrototypes() gives them and 
+   AnsiFunctions() says where each function's is.
+
+****************************************************************************
+
+   Revision History:
+   =================
+
+   V2.0  16.10.26
+   Original
+
+   V2.1  16.10.26
+   There is no longer a limit on the size of a definition so ANSI_ETOOBIG
+   is not returned.
+
+   V2.3  16.10.26
+   Added AnsiSetScanner(), AnsiScannerName() and ANSI_ESCAN.
+
+   V2.6  16.10.26
+   Added AnsiSetThreads().
+
+   V2.8  16.10.26
+   Added ANSIFUNC and AnsiFunctions().
+
+   V2.9  16.10.26
+   Added AnsiKeepFunctions(). Functions are no longer kept unless it's
+   called.
+
+   V3.0  16.10.26
+   Added ANSISTATS, AnsiKeepStats() and AnsiStats().
+
+   V3.7  16.10.26
+   Added AnsiCheckBuffer().
+
+   V3.9  16.10.26
+   Added AnsiEditsOnly().
+
+   V4.0  16.10.26
+   ANSIFUNC gives the line each function starts on.
+
+   V4.1  16.10.26
+   Added AnsiKeepPrototypes() and AnsiPrototypes(). ANSIFUNC gives where
+   each function's prototype is.
+
+*************************************************************************/
+#ifndef _ANSI_H
+#define _ANSI_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/************************************************************************/
+/* Processing modes
+*/
+#define MakeANSI     1     /* K&R-->ANSI                                */
+#define MakeKR       2     /* ANSI-->K&R                                */
+#define MakeProtos   3     /* Make prototypes                           */
+
+/* Return codes
+*/
+#define ANSI_OK      0     /* All OK                                    */
+#define ANSI_ENOMEM  1     /* Out of memory                             */
+#define ANSI_EMODE   2     /* Invalid processing mode                   */
+#define ANSI_EREAD   3     /* Error reading input                       */
+#define ANSI_EWRITE  4     /* Error writing output                      */
+#define ANSI_ETOOBIG 5     /* Function definition too big (no longer
+                              returned since V2.1)                      */
+#define ANSI_ESCAN   6     /* Scanner not available                     */
+
+/* V3.0: Stages timed in ANSISTATS
+*/
+#define ANSI_STAGE_SCAN    0  /* Reading and scanning the input         */
+#define ANSI_STAGE_CONVERT 1  /* Rewriting definitions                  */
+#define ANSI_STAGE_WRITE   2  /* Writing the output                     */
+#define ANSI_NSTAGES       3
+
+/************************************************************************/
+/* Types
+*/
+typedef struct ansi_context ANSICTX;
+
+typedef struct             /* V2.8: A function definition found         */
+{
+   const char *name;
+   long     start,         /* Offsets in the input of the start of its  */
+            end;           /* first line and the end of the line with   */
+                           /* the { (-1 if the input was a stream)      */
+   long     line;          /* V4.0: The line it starts on (from 1)      */
+   size_t   outpos,        /* Offset and length in the output of what   */
+            outlen,        /* was written for it                        */
+            protopos,      /* V4.1: The same for its prototype, in the  */
+            protolen;      /* output with MakeProtos, otherwise in      */
+                           /* AnsiPrototypes() (0 if not kept)          */
+}  ANSIFUNC;
+
+typedef struct             /* V3.0: What a conversion did               */
+{
+   unsigned long bytes,    /* Bytes of input                            */
+            lines,         /* Lines scanned                             */
+            interesting,   /* Lines which might start a definition      */
+            candidates,    /* Of those, ones with a ( which were        */
+                           /* assembled as a definition                 */
+            accepted,      /* Candidates which were functions           */
+            rejected,      /* Candidates which were prototypes          */
+            converted,     /* Functions rewritten (not already in the   */
+                           /* form wanted)                              */
+            findvar,       /* Searches for a parameter's declaration    */
+            findbytes;     /* Bytes those searches looked at            */
+   double   wall,          /* Seconds taken and processor time used for */
+            cpu,           /* the whole conversion (on all threads)     */
+            stagewall[ANSI_NSTAGES],   /* The same for each stage, added */
+            stagecpu[ANSI_NSTAGES];    /* up over the threads used       */
+}  ANSISTATS;
+
+/************************************************************************/
+/* Prototypes
+*/
+ANSICTX     *AnsiCreate(int mode);
+int         AnsiConvertBuffer(ANSICTX *ctx, const char *in, size_t inlen,
+                              char **out, size_t *outlen);
+int         AnsiConvertStream(ANSICTX *ctx, FILE *in, FILE *out);
+int         AnsiCheckBuffer(ANSICTX *ctx, const char *in, size_t inlen,
+                            long *line);
+const char  *AnsiMessages(ANSICTX *ctx);
+const char  *AnsiStrError(int error);
+int         AnsiSetScanner(ANSICTX *ctx, const char *name);
+const char  *AnsiScannerName(ANSICTX *ctx);
+int         AnsiSetThreads(ANSICTX *ctx, int nthreads);
+const ANSIFUNC *AnsiFunctions(ANSICTX *ctx, int *nfuncs);
+int         AnsiKeepFunctions(ANSICTX *ctx, int keep);
+int         AnsiKeepStats(ANSICTX *ctx, int keep);
+int         AnsiEditsOnly(ANSICTX *ctx, int edits);
+int         AnsiKeepPrototypes(ANSICTX *ctx, int keep);
+const char  *AnsiPrototypes(ANSICTX *ctx, size_t *len);
+const ANSISTATS *AnsiStats(ANSICTX *ctx);
+void        AnsiDestroy(ANSICTX *ctx);
+
+#endif
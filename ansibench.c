@@ -0,0 +1,995 @@
+/***************************************************************************
+
+   Program:    ansibench
+   File:       ansibench.c
+
+   Version:    V1.1
+   Date:       16.10.26
+   Function:   Measure the speed of the ansi converter
+
+   Copyright:  SciTech Software 1991
+   Author:     Andrew C. R. Martin
+   EMail:      andrew@abyinformatics.com
+
+****************************************************************************
+
+   This program is not in the public domain, but it may be freely copied
+   and distributed for no charge providing this header is included.
+   The code may be modified as required, but any modifications must be
+   documented so that the person responsible can be identified. If someone
+   else breaks this code, I don't want to be blamed for code that does not
+   work! The code may not be sold commercially without prior permission from
+   the author, although it may be given away free with commercial products,
+   providing it is made clear that this program is free and that the source
+   code is provided with the program.
+
+****************************************************************************
+
+   Description:
+   ============
+
+   Converts the same input repeatedly in memory and reports the speed in
+   MB/s and functions/s, for each mode, scanner and number of threads
+   asked for, and relative to the first of them. Also checks that they
+   all give the same output.
+
+   The input is either files or a synthetic corpus made up to order, so
+   that the effect of each feature of the source can be seen and
+   releases compared on exactly the same input. K&R source is made for
+   MakeANSI and MakeProtos, and ANSI source for MakeKR.
+
+   Each result can also be written as a line of JSON to a file for
+   comparison with later runs.
+
+****************************************************************************
+
+   Usage:
+   ======
+
+   ansibench [-k -p -A] [-n count] [-s scanners] [-t threads]
+             [-o results] <in.c> [<in.c>...]
+   ansibench [-k -p -A] [-n count] [-s scanners] [-t threads]
+             [-o results] -g [-S sizes] [-f n] [-a n] [-h n] [-b n]
+             [-c pct] [-w len] [-d depth]
+         -k converts ANSI to K&R
+         -p generates prototypes
+         -A times all three modes
+         -n number of times to convert each file (default 20)
+         -s scanners to time, separated by commas (default all those
+            the processor has)
+         -t numbers of threads to time, separated by commas (default 1).
+            Only files of 8MB or more are split between threads
+         -o appends a line of JSON for each result to this file
+         -g times a generated corpus rather than files
+            -S sizes of corpus in MB, separated by commas (default 1)
+            -f functions per file (default 0: each corpus is one file)
+            -a parameters per function (default 3)
+            -h lines each function's header is spread over (default 1)
+            -b lines in each function's body (default 10)
+            -c percentage of body lines which are comments (default 20)
+            -w length of a long line in each body (default 0: none)
+            -d depth of nested braces in each body (default 2)
+
+   Build with:
+      cc -O2 -DANSI_LIBRARY -o ansibench ansibench.c ansi.c -lpthread
+
+   Gains from the scanners are largest for files with long comments and
+   long lines in function bodies, since those are what they skip.
+
+****************************************************************************
+
+   Revision History:
+   =================
+
+   V1.0  16.10.26
+   Original
+
+   V1.1  16.10.26
+   Added the corpus generator, timing of all three modes, several sizes
+   and numbers of threads, functions/s, a warm-up conversion before each
+   timing and JSON output.
+
+*************************************************************************/
+/* System includes
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ansi.h"
+
+/************************************************************************/
+#define NREPEAT      20    /* Default times to convert each file        */
+#define MAXLIST      16    /* Most values in a list given to a switch   */
+#define MAXSCAN      8     /* Most scanners                             */
+
+typedef struct             /* Sources to be converted                   */
+{
+   char     **text;        /* Each file, from malloc()                  */
+   size_t   *len,
+            total;         /* Size of all of them                       */
+   int      nfiles;
+}  CORPUS;
+
+typedef struct             /* What the generator makes                  */
+{
+   int      funcs,         /* Functions per file (0 for one file)       */
+            params,        /* Parameters per function                   */
+            hdrlines,      /* Lines each header is spread over          */
+            body,          /* Lines in each body                        */
+            comments,      /* Percentage of body lines which comment    */
+            longline,      /* Length of a long line in each body        */
+            depth;         /* Depth of nested braces                    */
+}  GENOPTS;
+
+
+typedef struct             /* Text being generated                      */
+{
+   char     *text;
+   size_t   len,
+            size;
+}  TEXT;
+
+/************************************************************************/
+/* Globals
+*/
+static unsigned long Seed = 1;   /* For Random()                       */
+
+/************************************************************************/
+/* Prototypes
+*/
+int      main(int argc, char **argv);
+int      TimeRun(int mode, CORPUS *corpus, char *scanner, int nthreads,
+                 int repeat, double *secs, long *nfuncs, char **first,
+                 size_t *firstlen);
+void     WriteResult(FILE *fp, char *mode, CORPUS *corpus, GENOPTS *gen,
+                     long nfuncs, char *scanner, int nthreads, int repeat,
+                     double secs);
+int      ReadCorpus(char **files, int nfiles, CORPUS *corpus);
+int      Generate(GENOPTS *gen, int ansi, size_t size, CORPUS *corpus);
+int      GenFunction(TEXT *text, GENOPTS *gen, int ansi, long n);
+int      AddText(TEXT *text, const char *str, size_t len);
+void     FreeCorpus(CORPUS *corpus);
+unsigned Random(unsigned n);
+int      ParseList(char *list, double *values);
+char     *ReadFile(char *file, size_t *len);
+double   Now(void);
+
+/************************************************************************/
+/*>int main(int argc, char **argv)
+   ---------------------------
+   Benchmark main program
+
+   16.10.26 Original
+   16.10.26 Generated corpora, modes, sizes, threads and JSON output
+*/
+int main(int argc, char **argv)
+{
+   static char *allscan[]  = {"scalar", "sse2", "avx2", NULL},
+               *modename[] = {NULL, "ansi", "kr", "protos"};
+   char     *scanners[MAXSCAN],
+            *results = NULL,
+            *value,
+            *out,
+            *ref;
+   int      modes[3],
+            nmodes   = 1,
+            nscan    = 0,
+            nthreads = 1,
+            nsizes   = 1,
+            repeat   = NREPEAT,
+            generate = 0,
+            status   = 0,
+            opt,
+            m,
+            s,
+            t,
+            z;
+   double   threads[MAXLIST],
+            sizes[MAXLIST],
+            secs,
+            refsecs  = 0.0;
+   long     nfuncs;
+   size_t   outlen,
+            reflen   = 0;
+   GENOPTS  gen;
+   CORPUS   files,
+            krsrc,
+            ansisrc,
+            *corpus;
+   ANSICTX  *ctx;
+   FILE     *fp      = NULL;
+
+   modes[0]     = MakeANSI;
+   threads[0]   = 1.0;
+   sizes[0]     = 1.0;
+   gen.funcs    = 0;
+   gen.params   = 3;
+   gen.hdrlines = 1;
+   gen.body     = 10;
+   gen.comments = 20;
+   gen.longline = 0;
+   gen.depth    = 2;
+   memset(&files,   0, sizeof(CORPUS));
+   memset(&krsrc,   0, sizeof(CORPUS));
+   memset(&ansisrc, 0, sizeof(CORPUS));
+
+   for(argc--, argv++; argc && argv[0][0] == '-'; argc--, argv++)
+   {
+      /* Pick up the value for switches which have one                  */
+      value = NULL;
+      opt   = argv[0][1];
+      if(opt != '\0' && strchr("nstoSfahbcwd", opt) != NULL)
+      {
+         if(argc < 2)
+         {
+            fprintf(stderr,"%s needs a value\n",argv[0]);
+            return(1);
+         }
+         value = argv[1];
+         argc--;
+         argv++;
+      }
+
+      switch(opt)
+      {
+      case 'k':
+         modes[0] = MakeKR;
+         nmodes   = 1;
+         break;
+      case 'p':
+         modes[0] = MakeProtos;
+         nmodes   = 1;
+         break;
+      case 'A':
+         modes[0] = MakeANSI;
+         modes[1] = MakeKR;
+         modes[2] = MakeProtos;
+         nmodes   = 3;
+         break;
+      case 'n':
+         if((repeat = atoi(value)) < 1)
+         {
+            fprintf(stderr,"-n needs a count\n");
+            return(1);
+         }
+         break;
+      case 's':
+         for(nscan=0, value=strtok(value, ","); value != NULL;
+             value=strtok(NULL, ","))
+         {
+            if(nscan == MAXSCAN)
+            {
+               fprintf(stderr,"Too many scanners\n");
+               return(1);
+            }
+            scanners[nscan++] = value;
+         }
+         break;
+      case 't':
+         if((nthreads = ParseList(value, threads)) == 0)
+         {
+            fprintf(stderr,"-t needs numbers of threads\n");
+            return(1);
+         }
+         break;
+      case 'o':
+         results = value;
+         break;
+      case 'g':
+         generate = 1;
+         break;
+      case 'S':
+         if((nsizes = ParseList(value, sizes)) == 0)
+         {
+            fprintf(stderr,"-S needs sizes\n");
+            return(1);
+         }
+         break;
+      case 'f':
+         gen.funcs    = atoi(value);
+         break;
+      case 'a':
+         gen.params   = atoi(value);
+         break;
+      case 'h':
+         if((gen.hdrlines = atoi(value)) < 1)
+         {
+            fprintf(stderr,"-h needs a number of lines\n");
+            return(1);
+         }
+         break;
+      case 'b':
+         gen.body     = atoi(value);
+         break;
+      case 'c':
+         gen.comments = atoi(value);
+         break;
+      case 'w':
+         gen.longline = atoi(value);
+         break;
+      case 'd':
+         gen.depth    = atoi(value);
+         break;
+      default:
+         fprintf(stderr,"Unknown switch %s\n",argv[0]);
+         return(1);
+      }
+   }
+   if(generate ? (argc != 0) : (argc < 1))
+   {
+      fprintf(stderr,"Usage: ansibench [-k -p -A] [-n count] \
+[-s scanners] [-t threads]\n\
+                 [-o results] <in.c> [<in.c>...]\n\
+       ansibench [-k -p -A] [-n count] [-s scanners] [-t threads]\n\
+                 [-o results] -g [-S sizes] [-f n] [-a n] [-h n] [-b n]\n\
+                 [-c pct] [-w len] [-d depth]\n");
+      return(1);
+   }
+
+   /* Keep the scanners asked for (or all of them) which this processor
+      has
+   */
+   if(nscan == 0)
+   {
+      for(s=0; allscan[s] != NULL; s++)
+         scanners[nscan++] = allscan[s];
+   }
+   if((ctx = AnsiCreate(MakeANSI)) == NULL)
+   {
+      fprintf(stderr,"No memory\n");
+      return(1);
+   }
+   for(s=0; s<nscan; s++)
+   {
+      if(AnsiSetScanner(ctx, scanners[s]) != ANSI_OK)
+      {
+         printf("%s scanner not available\n", scanners[s]);
+         memmove(scanners+s, scanners+s+1, (nscan-s-1) * sizeof(char *));
+         nscan--;
+         s--;
+      }
+   }
+   AnsiDestroy(ctx);
+
+   if(results != NULL && (fp = fopen(results, "a")) == NULL)
+   {
+      fprintf(stderr,"Unable to write %s\n",results);
+      return(1);
+   }
+
+   if(generate)
+   {
+      printf("Generated corpus, %d function(s) per file, %d parameter(s), \
+%d header line(s),\n%d body line(s), %d%% comments, long lines of %d, \
+depth %d; each converted %d times\n\n",
+             gen.funcs, gen.params, gen.hdrlines, gen.body, gen.comments,
+             gen.longline, gen.depth, repeat);
+   }
+   else
+   {
+      if(!ReadCorpus(argv, argc, &files)) return(1);
+      printf("%d file(s), each converted %d times\n\n", argc, repeat);
+      nsizes = 1;
+   }
+   printf("mode         MB  files     funcs  scanner  threads      MB/s    \
+funcs/s  speedup\n");
+
+   for(z=0; z<nsizes; z++)
+   {
+      /* Make K&R source for MakeANSI and MakeProtos, and ANSI source for
+         MakeKR
+      */
+      if(generate)
+      {
+         FreeCorpus(&krsrc);
+         FreeCorpus(&ansisrc);
+         for(m=0; m<nmodes; m++)
+         {
+            corpus = (modes[m] == MakeKR) ? &ansisrc : &krsrc;
+            if(corpus->nfiles == 0 &&
+               !Generate(&gen, modes[m] == MakeKR, (size_t)(sizes[z]*1e6),
+                         corpus))
+            {
+               fprintf(stderr,"No memory\n");
+               return(1);
+            }
+         }
+      }
+
+      for(m=0; m<nmodes; m++)
+      {
+         if(generate)
+            corpus = (modes[m] == MakeKR) ? &ansisrc : &krsrc;
+         else
+            corpus = &files;
+
+         /* Time each number of threads with each scanner, checking
+            they all give the same output as the first
+         */
+         ref = NULL;
+         for(t=0; t<nthreads; t++)
+         {
+            for(s=0; s<nscan; s++)
+            {
+               if((status = TimeRun(modes[m], corpus, scanners[s],
+                                    (int)threads[t], repeat, &secs,
+                                    &nfuncs, &out, &outlen)) != ANSI_OK)
+               {
+                  fprintf(stderr,"%s: %s\n",
+                          scanners[s], AnsiStrError(status));
+                  return(1);
+               }
+
+               if(ref == NULL)
+               {
+                  ref     = out;
+                  reflen  = outlen;
+                  refsecs = secs;
+               }
+               else
+               {
+                  if(outlen != reflen || memcmp(out, ref, outlen))
+                  {
+                     fprintf(stderr,"%s scanner with %d thread(s) gave \
+different output\n", scanners[s], (int)threads[t]);
+                     status = 1;
+                  }
+                  free(out);
+               }
+
+               printf("%-7s %7.2f %6d %9ld  %-7s %8d %9.1f %10.0f %7.2fx\n",
+                      modename[modes[m]], corpus->total/1e6,
+                      corpus->nfiles, nfuncs, scanners[s], (int)threads[t],
+                      (double)corpus->total * repeat / 1e6 / secs,
+                      (double)nfuncs * repeat / secs, refsecs / secs);
+               if(fp != NULL)
+                  WriteResult(fp, modename[modes[m]], corpus,
+                              generate ? &gen : NULL, nfuncs, scanners[s],
+                              (int)threads[t], repeat, secs);
+            }
+         }
+         free(ref);
+      }
+   }
+
+   if(fp != NULL && fclose(fp) == EOF)
+   {
+      fprintf(stderr,"Unable to write %s\n",results);
+      status = 1;
+   }
+   return(status ? 1 : 0);
+}
+
+/************************************************************************/
+/*>int TimeRun(int mode, CORPUS *corpus, char *scanner, int nthreads,
+               int repeat, double *secs, long *nfuncs, char **first,
+               size_t *firstlen)
+   -------------------------------------------------------------------
+   Input:   int      mode        Processing mode
+            CORPUS   *corpus     Sources to convert
+            char     *scanner    Scanner to use
+            int      nthreads    Threads to use
+            int      repeat      Times to convert each file
+   Output:  double   *secs       Time taken
+            long     *nfuncs     Functions in the sources
+            char     **first     Output for the first file (from malloc())
+            size_t   *firstlen   Its length
+   Returns: int                  ANSI_OK or an error code
+
+   Converts the corpus once untimed, to count the functions, keep the
+   output for checking and warm up the caches, then times converting it
+   repeat times.
+
+   16.10.26 Original
+*/
+int TimeRun(int mode, CORPUS *corpus, char *scanner, int nthreads,
+            int repeat, double *secs, long *nfuncs, char **first,
+            size_t *firstlen)
+{
+   ANSICTX  *ctx;
+   char     *out;
+   size_t   outlen;
+   double   start;
+   int      status,
+            n,
+            i,
+            j;
+
+   *first  = NULL;
+   *nfuncs = 0;
+   if((ctx = AnsiCreate(mode)) == NULL) return(ANSI_ENOMEM);
+   if((status = AnsiSetScanner(ctx, scanner))   != ANSI_OK ||
+      (status = AnsiSetThreads(ctx, nthreads))  != ANSI_OK ||
+      (status = AnsiKeepFunctions(ctx, 1))      != ANSI_OK)
+   {
+      AnsiDestroy(ctx);
+      return(status);
+   }
+
+   for(i=0; i<corpus->nfiles; i++)
+   {
+      if((status = AnsiConvertBuffer(ctx, corpus->text[i], corpus->len[i],
+                                     &out, &outlen)) != ANSI_OK)
+         break;
+      AnsiFunctions(ctx, &n);
+      *nfuncs += n;
+      if(i == 0)
+      {
+         *first    = out;
+         *firstlen = outlen;
+      }
+      else
+      {
+         free(out);
+      }
+   }
+   AnsiKeepFunctions(ctx, 0);
+
+   start = Now();
+   for(j=0; j<repeat && status == ANSI_OK; j++)
+   {
+      for(i=0; i<corpus->nfiles; i++)
+      {
+         if((status = AnsiConvertBuffer(ctx, corpus->text[i],
+                                        corpus->len[i], &out, &outlen))
+            != ANSI_OK)
+            break;
+         free(out);
+      }
+   }
+   *secs = Now() - start;
+
+   AnsiDestroy(ctx);
+   if(status != ANSI_OK)
+   {
+      free(*first);
+      *first = NULL;
+   }
+   return(status);
+}
+
+/************************************************************************/
+/*>void WriteResult(FILE *fp, char *mode, CORPUS *corpus, GENOPTS *gen,
+                    long nfuncs, char *scanner, int nthreads, int repeat,
+                    double secs)
+   --------------------------------------------------------------------
+   Input:   FILE     *fp         File to write to
+            char     *mode       Name of the mode
+            CORPUS   *corpus     Sources converted
+            GENOPTS  *gen        How they were generated (NULL for files)
+            long     nfuncs      Functions in them
+            char     *scanner    Scanner used
+            int      nthreads    Threads used
+            int      repeat      Times each file was converted
+            double   secs        Time taken
+
+   Writes a result as one line of JSON.
+
+   16.10.26 Original
+*/
+void WriteResult(FILE *fp, char *mode, CORPUS *corpus, GENOPTS *gen,
+                 long nfuncs, char *scanner, int nthreads, int repeat,
+                 double secs)
+{
+   fprintf(fp,"{\"time\":%ld,\"mode\":\"%s\",\"input\":\"%s\",\
+\"bytes\":%lu,\"files\":%d,\"functions\":%ld,\"scanner\":\"%s\",\
+\"threads\":%d,\"repeat\":%d,\"seconds\":%.6f,\"mb_per_s\":%.2f,\
+\"funcs_per_s\":%.0f",
+           (long)time(NULL), mode, gen ? "generated" : "files",
+           (unsigned long)corpus->total, corpus->nfiles, nfuncs, scanner,
+           nthreads, repeat, secs,
+           (double)corpus->total * repeat / 1e6 / secs,
+           (double)nfuncs * repeat / secs);
+   if(gen != NULL)
+   {
+      fprintf(fp,",\"generator\":{\"funcs\":%d,\"params\":%d,\
+\"hdrlines\":%d,\"body\":%d,\"comments\":%d,\"longline\":%d,\"depth\":%d}",
+              gen->funcs, gen->params, gen->hdrlines, gen->body,
+              gen->comments, gen->longline, gen->depth);
+   }
+   fprintf(fp,"}\n");
+}
+
+/************************************************************************/
+/*>int ReadCorpus(char **files, int nfiles, CORPUS *corpus)
+   --------------------------------------------------------
+   Input:   char     **files     File names
+            int      nfiles      Number of them
+   Output:  CORPUS   *corpus     Their contents
+   Returns: int                  1 if OK, 0 on error (which is reported)
+
+   Reads all the files into memory.
+
+   16.10.26 Original
+*/
+int ReadCorpus(char **files, int nfiles, CORPUS *corpus)
+{
+   int      i;
+
+   corpus->text  = (char **)malloc(nfiles * sizeof(char *));
+   corpus->len   = (size_t *)malloc(nfiles * sizeof(size_t));
+   corpus->total = 0;
+   if(corpus->text == NULL || corpus->len == NULL)
+   {
+      fprintf(stderr,"No memory\n");
+      return(0);
+   }
+   for(corpus->nfiles=0; corpus->nfiles<nfiles; corpus->nfiles++)
+   {
+      i = corpus->nfiles;
+      if((corpus->text[i] = ReadFile(files[i], &corpus->len[i])) == NULL)
+      {
+         fprintf(stderr,"Unable to read %s\n",files[i]);
+         return(0);
+      }
+      corpus->total += corpus->len[i];
+   }
+
+   return(1);
+}
+
+/************************************************************************/
+/*>int Generate(GENOPTS *gen, int ansi, size_t size, CORPUS *corpus)
+   -----------------------------------------------------------------
+   Input:   GENOPTS  *gen        What to generate
+            int      ansi        Generate ANSI rather than K&R
+            size_t   size        Bytes to generate
+   Output:  CORPUS   *corpus     The files generated
+   Returns: int                  1 if OK, 0 if out of memory
+
+   Generates files of gen->funcs functions (or a single file) until
+   there are at least size bytes. The same options always give the same
+   functions, in K&R or ANSI.
+
+   16.10.26 Original
+*/
+int Generate(GENOPTS *gen, int ansi, size_t size, CORPUS *corpus)
+{
+   static char preamble[] = "/* Generated by ansibench */\n\
+#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n\n\
+struct item\n{\n   int         value;\n   struct item *next;\n};\n\n";
+   TEXT     text;
+   char     **newtext;
+   size_t   *newlen;
+   long     n    = 0;
+   int      nfile;
+
+   Seed = 1;
+   memset(corpus, 0, sizeof(CORPUS));
+   while(corpus->total < size)
+   {
+      text.text = NULL;
+      text.len  = text.size = 0;
+      if(!AddText(&text, preamble, strlen(preamble))) return(0);
+      for(nfile=0;
+          gen->funcs ? (nfile < gen->funcs) : (text.len < size);
+          nfile++)
+      {
+         if(!GenFunction(&text, gen, ansi, n++)) return(0);
+      }
+
+      if((newtext = (char **)realloc(corpus->text,
+                           (corpus->nfiles+1) * sizeof(char *))) == NULL)
+         return(0);
+      corpus->text = newtext;
+      if((newlen = (size_t *)realloc(corpus->len,
+                           (corpus->nfiles+1) * sizeof(size_t))) == NULL)
+         return(0);
+      corpus->len = newlen;
+      corpus->text[corpus->nfiles] = text.text;
+      corpus->len[corpus->nfiles]  = text.len;
+      corpus->nfiles++;
+      corpus->total += text.len;
+   }
+
+   return(1);
+}
+
+/************************************************************************/
+/*>int GenFunction(TEXT *text, GENOPTS *gen, int ansi, long n)
+   -----------------------------------------------------------
+   I/O:     TEXT     *text       Text to add to
+   Input:   GENOPTS  *gen        What to generate
+            int      ansi        Generate ANSI rather than K&R
+            long     n           Number of the function
+   Returns: int                  1 if OK, 0 if out of memory
+
+   Adds a function with a comment before it, gen->params parameters
+   spread over gen->hdrlines lines, and a body of gen->body lines in
+   gen->depth nested blocks, gen->comments percent of which are comments
+   and one of which is gen->longline long (if that isn't 0).
+
+   16.10.26 Original
+*/
+int GenFunction(TEXT *text, GENOPTS *gen, int ansi, long n)
+{
+   static char *types[]   = {"int", "char *", "double", "long",
+                             "struct item *", "unsigned char", "char **",
+                             "float"},
+               *returns[] = {"int", "static int", "long", "double",
+                             "char *", "void"},
+               *stmts[]   = {"x = x * %d + 1;",
+                             "printf(\"{%d} \\\"%%d\\\"\\n\", x);",
+                             "if(x > %d) x = 0;",
+                             "x += sizeof(struct item) * %d;"},
+               *comment   = "/* Keep the running total within the range \
+of an int              */",
+               spaces[]   = "                                        \
+                                        ";
+   char     buffer[160],
+            *type,
+            *ret      = returns[n % 6],
+            c;
+   int      indent,
+            width,
+            line,
+            i;
+
+#define ADD(s)    if(!AddText(text, (s), strlen(s))) return(0)
+#define INDENT(n) if(!AddText(text, spaces, (n))) return(0)
+
+   sprintf(buffer, "/*************************************************\
+***********************/\n/* fn%ld\n   Works out a value from its \
+parameters.\n*/\n%s\nfn%ld(", n, ret, n);
+   ADD(buffer);
+
+   /* The parameter list, spread over gen->hdrlines lines               */
+   width = sprintf(buffer, "fn%ld(", n);
+   if(gen->params == 0 && ansi) ADD("void");
+   for(i=0, line=0; i<gen->params; i++)
+   {
+      if(i)
+      {
+         ADD(",");
+         if(i * gen->hdrlines / gen->params != line)
+         {
+            line = i * gen->hdrlines / gen->params;
+            ADD("\n");
+            INDENT(width);
+         }
+         else
+         {
+            ADD(" ");
+         }
+      }
+      type = types[(n + i) % 8];
+      if(ansi)
+         sprintf(buffer, "%s%sp%d", type,
+                 type[strlen(type)-1] == '*' ? "" : " ", i);
+      else
+         sprintf(buffer, "p%d", i);
+      ADD(buffer);
+   }
+   ADD(")\n");
+   for(i=0; !ansi && i<gen->params; i++)
+   {
+      type = types[(n + i) % 8];
+      sprintf(buffer, "%s%sp%d;\n", type,
+              type[strlen(type)-1] == '*' ? "" : " ", i);
+      ADD(buffer);
+   }
+
+   /* The body                                                          */
+   ADD("{\n   int x = 0;\n\n");
+   for(i=0; i<gen->depth; i++)
+   {
+      indent = 3 * (i + 1);
+      sprintf(buffer, "if(x >= %d)\n", i);
+      INDENT(indent);
+      ADD(buffer);
+      INDENT(indent);
+      ADD("{\n");
+   }
+   indent = 3 * (gen->depth + 1);
+   for(i=0; i<gen->body; i++)
+   {
+      INDENT(indent);
+      if((int)Random(100) < gen->comments)
+      {
+         ADD(comment);
+      }
+      else
+      {
+         sprintf(buffer, stmts[Random(4)], i);
+         ADD(buffer);
+      }
+      ADD("\n");
+   }
+   if(gen->longline)
+   {
+      INDENT(indent);
+      ADD("x += strlen(\"");
+      for(i=indent+16; i<gen->longline; i++)
+      {
+         c = 'a' + i % 26;
+         if(!AddText(text, &c, 1)) return(0);
+      }
+      ADD("\");\n");
+   }
+   for(i=gen->depth-1; i>=0; i--)
+   {
+      INDENT(3 * (i + 1));
+      ADD("}\n");
+   }
+   if(!strcmp(ret, "char *"))
+   {
+      ADD("   return(NULL);\n");
+   }
+   else if(strcmp(ret, "void"))
+   {
+      ADD("   return(x);\n");
+   }
+   ADD("}\n\n");
+
+#undef ADD
+#undef INDENT
+
+   return(1);
+}
+
+/************************************************************************/
+/*>int AddText(TEXT *text, const char *str, size_t len)
+   ----------------------------------------------------
+   I/O:     TEXT     *text       Text to add to
+   Input:   const char *str      Text to add
+            size_t   len         Its length
+   Returns: int                  1 if OK, 0 if out of memory
+
+   Adds to the end of some text, making space as needed.
+
+   16.10.26 Original
+*/
+int AddText(TEXT *text, const char *str, size_t len)
+{
+   char     *ptr;
+   size_t   size;
+
+   if(text->len + len > text->size)
+   {
+      for(size = text->size ? 2*text->size : 65536;
+          size < text->len + len;
+          size *= 2) ;
+      if((ptr = (char *)realloc(text->text, size)) == NULL)
+      {
+         free(text->text);
+         text->text = NULL;
+         return(0);
+      }
+      text->text = ptr;
+      text->size = size;
+   }
+   memcpy(text->text + text->len, str, len);
+   text->len += len;
+
+   return(1);
+}
+
+/************************************************************************/
+/*>void FreeCorpus(CORPUS *corpus)
+   -------------------------------
+   I/O:     CORPUS   *corpus     Sources to free
+
+   Frees the sources and leaves the corpus empty.
+
+   16.10.26 Original
+*/
+void FreeCorpus(CORPUS *corpus)
+{
+   int      i;
+
+   for(i=0; i<corpus->nfiles; i++)
+      free(corpus->text[i]);
+   free(corpus->text);
+   free(corpus->len);
+   memset(corpus, 0, sizeof(CORPUS));
+}
+
+/************************************************************************/
+/*>unsigned Random(unsigned n)
+   ---------------------------
+   Input:   unsigned n           Range
+   Returns: unsigned             A number from 0 to n-1
+
+   A simple random number generator, so that the corpus is the same on
+   every machine.
+
+   16.10.26 Original
+*/
+unsigned Random(unsigned n)
+{
+   Seed = (Seed * 1103515245UL + 12345UL) & 0xffffffffUL;
+   return((unsigned)((Seed >> 16) & 0x7fff) % n);
+}
+
+/************************************************************************/
+/*>int ParseList(char *list, double *values)
+   -----------------------------------------
+   Input:   char     *list       Numbers separated by commas
+   Output:  double   *values     The numbers (up to MAXLIST)
+   Returns: int                  How many there were (0 on error)
+
+   Reads a list of positive numbers given to a switch.
+
+   16.10.26 Original
+*/
+int ParseList(char *list, double *values)
+{
+   char     *end;
+   int      n = 0;
+
+   for(;;)
+   {
+      if(n == MAXLIST) return(0);
+      values[n] = strtod(list, &end);
+      if(end == list || values[n++] <= 0.0) return(0);
+      if(*end == '\0') return(n);
+      if(*end != ',')  return(0);
+      list = end + 1;
+   }
+}
+
+/************************************************************************/
+/*>char *ReadFile(char *file, size_t *len)
+   ---------------------------------------
+   Input:   char     *file       File name
+   Output:  size_t   *len        Length of the file
+   Returns: char *               The contents (NULL on error)
+
+   Reads a whole file into memory.
+
+   16.10.26 Original
+*/
+char *ReadFile(char *file, size_t *len)
+{
+   FILE     *fp;
+   char     *buffer = NULL,
+            *ptr;
+   size_t   size    = 0,
+            n;
+
+   if((fp = fopen(file, "rb")) == NULL) return(NULL);
+
+   *len = 0;
+   for(;;)
+   {
+      if(*len == size)
+      {
+         size = size ? 2*size : 65536;
+         if((ptr = (char *)realloc(buffer, size)) == NULL)
+         {
+            free(buffer);
+            fclose(fp);
+            return(NULL);
+         }
+         buffer = ptr;
+      }
+      if((n = fread(buffer + *len, 1, size - *len, fp)) == 0) break;
+      *len += n;
+   }
+   fclose(fp);
+
+   return(buffer);
+}
+
+/************************************************************************/
+/*>double Now(void)
+   ----------------
+   Returns: double               Time in seconds
+
+   Wall clock time where we have it, otherwise processor time.
+
+   16.10.26 Original
+*/
+double Now(void)
+{
+#if defined(__unix__) || defined(__APPLE__)
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return(ts.tv_sec + ts.tv_nsec / 1e9);
+#else
+   return((double)clock() / CLOCKS_PER_SEC);
+#endif
+}